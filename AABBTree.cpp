@@ -0,0 +1,502 @@
+#include "AABBTree.h"
+#include "Progress.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <cstdint>
+
+namespace {
+
+const int numBins = 16;
+const int maxLeafSize = 8;
+const int lbvhLeafSize = 4;
+/* Cost of visiting a node, relative to testing one triangle */
+const float traversalCost = 1.f;
+/* Nodes with this many triangles are binned and partitioned by all threads */
+const int parallelNodeSize = 1 << 15;
+
+inline float coord(const Point &p, int axis) {
+    return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+}
+
+struct Bin {
+    AABB box;
+    int count;
+    Bin() : count(0) { }
+};
+
+/* A triangle being sorted into the tree */
+struct Ref {
+    AABB box;
+    Point centroid;
+    int face;
+};
+
+/* size centroid bins along one axis of the centroid box cbox */
+struct Binning {
+    int axis;
+    int size;
+    float lo;
+    float scale;
+    Binning(const AABB &cbox, int axis, int size) : axis(axis), size(size), lo(lower(cbox, axis)) {
+        float extent = upper(cbox, axis) - lo;
+        scale = extent > 0 ? size / extent : 0;
+    }
+    int bin(const Point &c) const {
+        return std::min(size - 1, static_cast<int>((coord(c, axis) - lo) * scale));
+    }
+};
+
+/* Bins of all three axes */
+struct NodeBins {
+    Bin bins[3][numBins];
+    void add(const Binning binning[3], const AABB &box, const Point &c) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (binning[axis].scale == 0)
+                continue;
+            /* Branch free, this runs for every triangle at every depth */
+            Bin &b = bins[axis][binning[axis].bin(c)];
+            b.count++;
+            b.box.x1 = std::min(b.box.x1, box.x1);
+            b.box.y1 = std::min(b.box.y1, box.y1);
+            b.box.z1 = std::min(b.box.z1, box.z1);
+            b.box.x2 = std::max(b.box.x2, box.x2);
+            b.box.y2 = std::max(b.box.y2, box.y2);
+            b.box.z2 = std::max(b.box.z2, box.z2);
+        }
+    }
+    void merge(const NodeBins &o) {
+        for (int axis = 0; axis < 3; axis++)
+            for (int b = 0; b < numBins; b++) {
+                bins[axis][b].count += o.bins[axis][b].count;
+                bins[axis][b].box.add(o.bins[axis][b].box);
+            }
+    }
+};
+
+/* Splits [0, n) into chunks contiguous ranges and runs f(chunk, begin, end) on each of them */
+template<class F>
+void forChunks(size_t n, unsigned int chunks, F f) {
+    parallelChunks(chunks, [n, chunks, &f] (unsigned int c) {
+        f(c, n * c / chunks, n * (c + 1) / chunks);
+    });
+}
+
+unsigned int chunksFor(size_t n, size_t minChunk) {
+    size_t chunks = std::min<size_t>(numThreads(), n / minChunk);
+    return static_cast<unsigned int>(std::max<size_t>(chunks, 1));
+}
+
+/*
+ * Grows a tree from its root one depth at a time. split(i, chunks) decides
+ * on node i and returns the number of its triangles going to the left
+ * child, or -1 for a leaf. Large nodes are split one after the other with
+ * all threads, the others are split side by side
+ * */
+template<class Split>
+void growLevels(std::vector<AABBTree::Node> &nodes, size_t numFaces, Progress *progress, Split split) {
+    size_t done = 0;
+    for (size_t begin = 0, end = nodes.size(); begin < end; begin = end, end = nodes.size()) {
+        std::vector<int> mid(end - begin);
+        unsigned int all = numThreads();
+        for (size_t i = begin; i < end; i++)
+            if (nodes[i].count >= parallelNodeSize)
+                mid[i - begin] = split(i, all);
+        parallelFor(end - begin, [&nodes, &mid, &split, begin] (size_t b, size_t e) {
+            for (size_t i = begin + b; i < begin + e; i++)
+                if (nodes[i].count < parallelNodeSize)
+                    mid[i - begin] = split(i, 1u);
+        }, 64);
+
+        for (size_t i = begin; i < end; i++) {
+            const int first = nodes[i].first;
+            const int count = nodes[i].count;
+            if (mid[i - begin] < 0) {
+                done += count;
+                continue;
+            }
+            AABBTree::Node left;
+            left.first = first;
+            left.count = mid[i - begin];
+            AABBTree::Node right;
+            right.first = first + left.count;
+            right.count = count - left.count;
+            nodes[i].first = static_cast<int>(nodes.size());
+            nodes[i].count = 0;
+            nodes.push_back(left);
+            nodes.push_back(right);
+        }
+        if (progress && numFaces)
+            progress->update(static_cast<float>(done) / numFaces);
+    }
+}
+
+template<class Key> struct Morton;
+
+template<> struct Morton<uint32_t> {
+    static const int axisBits = 10;
+    /* Spreads the low 10 bits of v to every third bit */
+    static uint32_t spread(uint32_t v) {
+        v &= 0x3ff;
+        v = (v | v << 16) & 0x30000ff;
+        v = (v | v << 8) & 0x300f00f;
+        v = (v | v << 4) & 0x30c30c3;
+        v = (v | v << 2) & 0x9249249;
+        return v;
+    }
+};
+
+template<> struct Morton<uint64_t> {
+    static const int axisBits = 21;
+    /* Spreads the low 21 bits of v to every third bit */
+    static uint64_t spread(uint64_t v) {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffULL;
+        v = (v | v << 16) & 0x1f0000ff0000ffULL;
+        v = (v | v << 8) & 0x100f00f00f00f00fULL;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+        v = (v | v << 2) & 0x1249249249249249ULL;
+        return v;
+    }
+};
+
+/*
+ * Stable least significant digit radix sort of keys, carrying values
+ * along. Every thread counts and scatters its own range of the input,
+ * digits all keys share are skipped
+ * */
+template<class Key>
+void radixSort(std::vector<Key> &keys, std::vector<int> &values, int bits) {
+    const size_t n = keys.size();
+    const unsigned int chunks = chunksFor(n, 1 << 16);
+    std::vector<Key> keyTmp(n);
+    std::vector<int> valueTmp(n);
+    std::vector<size_t> offset(chunks * 256);
+    for (int shift = 0; shift < bits; shift += 8) {
+        std::fill(offset.begin(), offset.end(), 0);
+        forChunks(n, chunks, [&keys, &offset, shift] (unsigned int c, size_t begin, size_t end) {
+            size_t *count = &offset[c * 256];
+            for (size_t i = begin; i < end; i++)
+                count[(keys[i] >> shift) & 0xff]++;
+        });
+        size_t sum = 0;
+        bool shared = false;
+        for (int d = 0; d < 256; d++) {
+            size_t digitCount = 0;
+            for (unsigned int c = 0; c < chunks; c++) {
+                size_t k = offset[c * 256 + d];
+                offset[c * 256 + d] = sum;
+                sum += k;
+                digitCount += k;
+            }
+            shared = shared || digitCount == n;
+        }
+        if (shared)
+            continue;
+        forChunks(n, chunks, [&keys, &values, &keyTmp, &valueTmp, &offset, shift] (unsigned int c, size_t begin, size_t end) {
+            size_t *next = &offset[c * 256];
+            for (size_t i = begin; i < end; i++) {
+                size_t to = next[(keys[i] >> shift) & 0xff]++;
+                keyTmp[to] = keys[i];
+                valueTmp[to] = values[i];
+            }
+        });
+        keys.swap(keyTmp);
+        values.swap(valueTmp);
+    }
+}
+
+template<class Key>
+int highestBit(Key x) {
+    int b = 0;
+    while (x >>= 1)
+        b++;
+    return b;
+}
+
+/*
+ * Splits nodes by binned SAH, partitioning refs in place. Every depth
+ * touches each triangle a constant number of times, so a build costs
+ * O(n log n)
+ * */
+void buildSAH(std::vector<AABBTree::Node> &nodes, std::vector<Ref> &refData, Progress *progress) {
+    /* Room for the parallel partitions of large nodes */
+    std::vector<Ref> scratch(refData.size() >= static_cast<size_t>(parallelNodeSize) ? refData.size() : 0);
+
+    growLevels(nodes, refData.size(), progress, [&nodes, &refData, &scratch] (size_t i, unsigned int threads) -> int {
+        const int count = nodes[i].count;
+        Ref *refs = refData.data() + nodes[i].first;
+        const unsigned int chunks = threads > 1 ? chunksFor(count, 4096) : 1;
+
+        /* Per chunk results, small nodes keep theirs on the stack */
+        AABB localBox[2];
+        NodeBins localBins;
+        std::vector<AABB> chunkBoxes(chunks > 1 ? 2 * chunks : 0);
+        std::vector<NodeBins> chunkBins(chunks > 1 ? chunks : 0);
+        AABB *boxes = chunks > 1 ? chunkBoxes.data() : localBox;
+        AABB *cboxes = boxes + chunks;
+        NodeBins *bins = chunks > 1 ? chunkBins.data() : &localBins;
+
+        forChunks(count, chunks, [refs, boxes, cboxes] (unsigned int c, size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++) {
+                boxes[c].add(refs[k].box);
+                cboxes[c].add(refs[k].centroid);
+            }
+        });
+        AABB box;
+        AABB cbox;
+        for (unsigned int c = 0; c < chunks; c++) {
+            box.add(boxes[c]);
+            cbox.add(cboxes[c]);
+        }
+        nodes[i].box = box;
+        if (count <= 1)
+            return -1;
+
+        /* Small nodes have as many bins as triangles, which is cheaper to evaluate */
+        const int size = std::min(count, numBins);
+        Binning binning[3] = { Binning(cbox, 0, size), Binning(cbox, 1, size), Binning(cbox, 2, size) };
+        forChunks(count, chunks, [refs, &binning, bins] (unsigned int c, size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++)
+                bins[c].add(binning, refs[k].box, refs[k].centroid);
+        });
+        for (unsigned int c = 1; c < chunks; c++)
+            bins[0].merge(bins[c]);
+
+        /* Best split of all axes, costs are left unscaled by the node area */
+        const float leafCost = count * box.area();
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        int bestBin = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (binning[axis].scale == 0)
+                continue;
+            const Bin *axisBins = bins[0].bins[axis];
+            float rightArea[numBins];
+            int rightCount[numBins];
+            AABB acc;
+            int n = 0;
+            for (int b = size - 1; b > 0; b--) {
+                acc.add(axisBins[b].box);
+                n += axisBins[b].count;
+                rightArea[b] = acc.area();
+                rightCount[b] = n;
+            }
+            acc = AABB();
+            n = 0;
+            for (int b = 0; b < size - 1; b++) {
+                acc.add(axisBins[b].box);
+                n += axisBins[b].count;
+                if (!n || !rightCount[b + 1])
+                    continue;
+                float cost = traversalCost * box.area() + n * acc.area() + rightCount[b + 1] * rightArea[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        if (bestAxis < 0 || (bestCost >= leafCost && count <= maxLeafSize)) {
+            /* Centroids coincide, bound the leaf size anyway */
+            return count > maxLeafSize ? count / 2 : -1;
+        }
+        const Binning &split = binning[bestAxis];
+        auto isLeft = [&split, bestBin] (const Ref &r) {
+            return split.bin(r.centroid) <= bestBin;
+        };
+        if (chunks == 1)
+            return static_cast<int>(std::partition(refs, refs + count, isLeft) - refs);
+
+        /* Each chunk copies its left and right triangles to their own ranges of scratch */
+        std::vector<size_t> lefts(chunks);
+        forChunks(count, chunks, [refs, &isLeft, &lefts] (unsigned int c, size_t begin, size_t end) {
+            lefts[c] = std::count_if(refs + begin, refs + end, isLeft);
+        });
+        size_t mid = 0;
+        for (unsigned int c = 0; c < chunks; c++)
+            mid += lefts[c];
+        Ref *out = scratch.data();
+        forChunks(count, chunks, [refs, out, &isLeft, &lefts, mid] (unsigned int c, size_t begin, size_t end) {
+            size_t left = 0;
+            for (unsigned int d = 0; d < c; d++)
+                left += lefts[d];
+            size_t right = mid + (begin - left);
+            for (size_t k = begin; k < end; k++) {
+                if (isLeft(refs[k]))
+                    out[left++] = refs[k];
+                else
+                    out[right++] = refs[k];
+            }
+        });
+        forChunks(count, chunks, [refs, out] (unsigned int, size_t begin, size_t end) {
+            std::copy(out + begin, out + end, refs + begin);
+        });
+        return static_cast<int>(mid);
+    });
+}
+
+/* Sorts refs along a Morton curve of their centroids and splits where the highest bit of the codes flips */
+template<class Key>
+void buildLBVH(std::vector<AABBTree::Node> &nodes, std::vector<Ref> &refs, Progress *progress) {
+    const size_t nF = refs.size();
+    const unsigned int chunks = chunksFor(nF, 4096);
+    std::vector<AABB> cboxes(chunks);
+    forChunks(nF, chunks, [&refs, &cboxes] (unsigned int c, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            cboxes[c].add(refs[i].centroid);
+    });
+    AABB cbox;
+    for (unsigned int c = 0; c < chunks; c++)
+        cbox.add(cboxes[c]);
+
+    /* Codes of the centroids on a grid spanning their box */
+    const Key cells = Key(1) << Morton<Key>::axisBits;
+    float scale[3];
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = upper(cbox, axis) - lower(cbox, axis);
+        scale[axis] = extent > 0 ? cells / extent : 0;
+    }
+    std::vector<Key> keys(nF);
+    std::vector<int> order(nF);
+    parallelFor(nF, [&refs, &cbox, &keys, &order, &scale, cells] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            Key code = 0;
+            for (int axis = 0; axis < 3; axis++) {
+                Key q = static_cast<Key>((coord(refs[i].centroid, axis) - lower(cbox, axis)) * scale[axis]);
+                code |= Morton<Key>::spread(std::min(q, cells - 1)) << axis;
+            }
+            keys[i] = code;
+            order[i] = static_cast<int>(i);
+        }
+    });
+    radixSort(keys, order, 3 * Morton<Key>::axisBits);
+    {
+        std::vector<Ref> sorted(nF);
+        parallelFor(nF, [&refs, &order, &sorted] (size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                sorted[i] = refs[order[i]];
+        });
+        refs.swap(sorted);
+    }
+
+    growLevels(nodes, nF, progress, [&nodes, &keys] (size_t i, unsigned int) -> int {
+        const int first = nodes[i].first;
+        const int count = nodes[i].count;
+        if (count <= lbvhLeafSize)
+            return -1;
+        Key lo = keys[first];
+        Key hi = keys[first + count - 1];
+        if (lo == hi)
+            return count / 2;
+        const Key bit = Key(1) << highestBit(lo ^ hi);
+        return static_cast<int>(std::partition_point(keys.begin() + first, keys.begin() + first + count,
+                    [bit] (Key k) { return !(k & bit); }) - (keys.begin() + first));
+    });
+}
+
+}
+
+AABBTree::AABBTree(const TriMesh &m, const Point &center, Progress *progress, Builder builder) {
+    const std::vector<Point> &vertexData = m.vertsWithNormals();
+    const std::vector<Face> &faceData = m.faces();
+    const size_t nF = faceData.size();
+    if (nF > static_cast<size_t>(std::numeric_limits<int>::max()))
+        throw std::range_error("Too many triangles");
+
+    std::vector<Ref> refs(nF);
+    parallelFor(nF, [&vertexData, &faceData, &center, &refs] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const Face &f = faceData[i];
+            Ref &r = refs[i];
+            r.box = AABB();
+            r.box.add(Point(vertexData[f.v1], center));
+            r.box.add(Point(vertexData[f.v2], center));
+            r.box.add(Point(vertexData[f.v3], center));
+            r.centroid = Point(0.5f * (r.box.x1 + r.box.x2), 0.5f * (r.box.y1 + r.box.y2), 0.5f * (r.box.z1 + r.box.z2));
+            r.face = static_cast<int>(i);
+        }
+    });
+
+    Node root;
+    root.first = 0;
+    root.count = static_cast<int>(nF);
+    _nodes.push_back(root);
+    if (builder == SAH)
+        buildSAH(_nodes, refs, progress);
+    /* 30 bit codes put 500 cells per triangle below 2M triangles, enough to tell them apart */
+    else if (nF < (1 << 21))
+        buildLBVH<uint32_t>(_nodes, refs, progress);
+    else
+        buildLBVH<uint64_t>(_nodes, refs, progress);
+    findLevels();
+
+    _faces.resize(nF);
+    parallelFor(nF, [this, &refs] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            _faces[i] = refs[i].face;
+    });
+    if (builder == SAH)
+        return;
+    /* LBVH boxes from the deepest nodes up */
+    for (int d = depth() - 1; d >= 0; d--)
+        parallelFor(levelEnd(d) - levelBegin(d), [this, &refs, d] (size_t b, size_t e) {
+            for (size_t i = levelBegin(d) + b; i < levelBegin(d) + e; i++) {
+                Node &n = _nodes[i];
+                AABB box;
+                if (n.isLeaf()) {
+                    for (int k = n.first; k < n.first + n.count; k++)
+                        box.add(refs[k].box);
+                } else {
+                    box = _nodes[n.first].box;
+                    box.add(_nodes[n.first + 1].box);
+                }
+                n.box = box;
+            }
+        }, 1024);
+}
+
+AABBTree::AABBTree(const Node *nodes, size_t numNodes, const int *faces, size_t numFaces)
+    : _nodes(nodes, nodes + numNodes), _faces(faces, faces + numFaces)
+{
+    if (_nodes.empty())
+        throw std::invalid_argument("Tree without a root");
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        const Node &n = _nodes[i];
+        bool valid = n.isLeaf() ?
+            n.first >= 0 && n.count >= 0 && static_cast<size_t>(n.first) + n.count <= _faces.size() :
+            static_cast<size_t>(n.first) > i && static_cast<size_t>(n.first) + 1 < _nodes.size();
+        if (!valid)
+            throw std::invalid_argument("Tree node refers outside of the tree");
+    }
+    findLevels();
+}
+
+void AABBTree::findLevels() {
+    /* Children of one depth form the next one */
+    _levelStart.assign(1, 0);
+    size_t begin = 0;
+    size_t end = 1;
+    while (begin < end) {
+        _levelStart.push_back(end);
+        size_t next = end;
+        for (size_t i = begin; i < end; i++)
+            if (!_nodes[i].isLeaf())
+                next = std::max(next, static_cast<size_t>(_nodes[i].first) + 2);
+        begin = end;
+        end = next;
+    }
+}
+
+float AABBTree::sahCost() const {
+    const float rootArea = _nodes[0].box.area();
+    if (rootArea == 0)
+        return 0;
+    double cost = 0;
+    for (auto n = _nodes.begin(); n != _nodes.end(); n++)
+        cost += (n->isLeaf() ? n->count : traversalCost) * static_cast<double>(n->box.area());
+    return static_cast<float>(cost / rootArea);
+}
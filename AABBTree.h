@@ -0,0 +1,69 @@
+#ifndef __AABBTREE_H__
+#define __AABBTREE_H__
+
+#include "Mesh.h"
+
+#include <vector>
+#include <cassert>
+
+class Progress;
+
+#include "Box.h"
+
+/*
+ * Bounding volume hierarchy over the triangles of a TriMesh, split by the
+ * binned surface area heuristic. Nodes are stored breadth first, so every
+ * depth is a contiguous range of nodes and siblings are neighbours. Leaves
+ * refer to ranges of a permutation of the triangles, no triangle is stored
+ * twice. Triangles are numbered in 32 bits like vertices. Boxes are
+ * relative to the center passed to the constructor.
+ *
+ * Two builders trade build time for tree quality: SAH evaluates binned
+ * split costs at every node, LBVH sorts the triangles along a Morton curve
+ * and splits where the codes differ, which is several times faster and
+ * gives a costlier tree. Both grow the tree one depth at a time, nodes of a
+ * depth are split in parallel and the few large nodes near the root are
+ * binned and partitioned in parallel themselves
+ * */
+
+class AABBTree {
+public:
+    enum Builder { SAH, LBVH };
+
+    /*
+     * Leaves have count > 0 triangles starting at faces()[first]. Inner nodes
+     * have count == 0 and children first and first + 1. The root of a tree
+     * without triangles is a leaf with none
+     * */
+    struct Node {
+        AABB box;
+        int first;
+        int count;
+        bool isLeaf() const { return count > 0 || first == 0; }
+    };
+private:
+    std::vector<Node> _nodes;
+    std::vector<int> _faces;
+    std::vector<size_t> _levelStart;
+
+    void findLevels();
+public:
+    AABBTree(const TriMesh &m, const Point &center, Progress *progress = 0, Builder builder = SAH);
+    /* Takes a tree built before, throws if the nodes do not form one */
+    AABBTree(const Node *nodes, size_t numNodes, const int *faces, size_t numFaces);
+
+    const std::vector<Node> &nodes() const { return _nodes; }
+    const std::vector<int> &faces() const { return _faces; }
+
+    /* Nodes of depth d are [levelBegin(d), levelEnd(d)) */
+    int depth() const { return static_cast<int>(_levelStart.size()) - 1; }
+    size_t levelBegin(int d) const { return _levelStart[d]; }
+    size_t levelEnd(int d) const { return _levelStart[d + 1]; }
+
+    float radius() const { return _nodes[0].box.radius(); }
+
+    /* Expected cost of a random ray hitting the root, in triangle tests */
+    float sahCost() const;
+};
+
+#endif
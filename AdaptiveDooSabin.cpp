@@ -0,0 +1,299 @@
+#include "AdaptiveDooSabin.h"
+#include "DooSabin.h"
+#include "Adjacency.h"
+#include "HalfEdge.h"
+#include "Progress.h"
+#include "Parallel.h"
+
+#include <stdexcept>
+#include <limits>
+#include <iostream>
+#include <sstream>
+#include <cmath>
+
+namespace {
+
+/* Unit normal of a polygon by Newell's method, zero for degenerate faces */
+Point faceNormal(const Mesh &m, size_t f) {
+    PolyFace pf = m.face(f);
+    Point n(0, 0, 0);
+    for (auto it = pf.begin; it != pf.end; it++) {
+        const Point &p = m.vert(*it);
+        const Point &q = m.vert(it + 1 == pf.end ? *pf.begin : it[1]);
+        n += Point((p.y - q.y) * (p.z + q.z), (p.z - q.z) * (p.x + q.x), (p.x - q.x) * (p.y + q.y));
+    }
+    float r = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+    return r > 0 ? (1 / r) * n : n;
+}
+
+}
+
+AdaptiveDooSabin::AdaptiveDooSabin(const Mesh &m, const std::vector<char> &selected, Progress *progress)
+    : Mesh(m.filename() + "*")
+{
+    if (selected.size() != m.numFaces())
+        throw std::invalid_argument("Face selection does not match the mesh");
+    const Adjacency adj(m);
+    adj.checkTopology();
+    const HalfEdge he(m);
+
+    const std::vector<offset_t> &fs = m.faceStarts();
+    const std::vector<index_t> &fv = m.faceVerts();
+    const size_t nV = m.numVertices();
+    const size_t nF = m.numFaces();
+    const size_t nE = he.size();
+
+    /* Old vertices touching an unselected face survive */
+    std::vector<int> keep(nV + 1);
+    keep[0] = 0;
+    parallelFor(nV, [&adj, &selected, &keep] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            int k = 0;
+            for (const int *f = adj.facesBegin(i); f != adj.facesEnd(i) && !k; f++)
+                k = !selected[*f];
+            keep[i + 1] = k;
+        }
+    }, 1024);
+    for (size_t i = 0; i < nV; i++)
+        keep[i + 1] += keep[i];
+    const int numKept = keep[nV];
+
+    /* Every selected face brings its own points */
+    if (numKept + nE > static_cast<size_t>(std::numeric_limits<int>::max()))
+        throw std::range_error("Too many vertices");
+    std::vector<int> firstPoint(nF + 1);
+    firstPoint[0] = numKept;
+    for (size_t f = 0; f < nF; f++)
+        firstPoint[f + 1] = firstPoint[f] + (selected[f] ? static_cast<int>(fs[f + 1] - fs[f]) : 0);
+    auto point = [&he, &fs, &firstPoint] (int h) {
+        int f = he.face(h);
+        return firstPoint[f] + static_cast<int>(h - fs[f]);
+    };
+
+    /*
+     * Counting pass over the vertices, as in DooSabin. A run of k selected faces
+     * gives a polygon of k points, plus the old vertex when the run is open.
+     * Runs of one face need none, their two border quads meet directly
+     * */
+    std::vector<offset_t> vertexFace(nV + 1);
+    std::vector<offset_t> vertexCorner(nV + 1);
+    std::vector<offset_t> edgeFace(nV + 1);
+    vertexFace[0] = vertexCorner[0] = edgeFace[0] = 0;
+    auto inSelection = [&selected] (int f) { return selected[f] != 0; };
+    parallelFor(nV, [&m, &adj, &he, &selected, &keep, &vertexFace, &vertexCorner, &edgeFace, &inSelection]
+            (size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++) {
+            bool kept = keep[i + 1] != keep[i];
+            int faces = 0;
+            int corners = 0;
+            int size = he.forEachRun(i, inSelection, [kept, &faces, &corners] (int, int count, bool closed) {
+                if (closed) {
+                    faces++;
+                    corners += count;
+                } else if (kept && count > 1) {
+                    faces++;
+                    corners += count + 1;
+                }
+            });
+            if (size != adj.numFaces(i)) {
+                std::ostringstream msg;
+                msg << "Vertex " << i << std::endl;
+                for (const int *f = adj.facesBegin(i); f != adj.facesEnd(i); f++) {
+                    PolyFace pf = m.face(*f);
+                    msg << "Face " << *f << ":";
+                    for (auto x = pf.begin; x != pf.end; x++)
+                        msg << " " << *x;
+                    msg << std::endl;
+                }
+                std::cerr << msg.str();
+                throw std::logic_error("Faces do not form a fan around vertex");
+            }
+            vertexFace[i + 1] = faces;
+            vertexCorner[i + 1] = corners;
+
+            int quads = 0;
+            for (const int *it = he.edgesBegin(i); it != he.edgesEnd(i); it++)
+                if (he.origin(*it) == static_cast<int>(i) && !he.isBoundary(*it) &&
+                        (selected[he.face(*it)] || selected[he.face(he.twin(*it))]))
+                    quads++;
+            edgeFace[i + 1] = quads;
+        }
+    }, 1024);
+    for (size_t i = 0; i < nV; i++) {
+        vertexFace[i + 1] += vertexFace[i];
+        vertexCorner[i + 1] += vertexCorner[i];
+        edgeFace[i + 1] += edgeFace[i];
+    }
+
+    const size_t firstVertexFace = nF;
+    const size_t firstEdgeFace = firstVertexFace + vertexFace[nV];
+    const size_t firstVertexCorner = nE;
+    const size_t firstEdgeCorner = firstVertexCorner + vertexCorner[nV];
+
+    std::vector<Point> &verts = vertData();
+    std::vector<offset_t> &facestart = faceStartData();
+    std::vector<index_t> &facevert = faceVertData();
+    verts.resize(firstPoint[nF]);
+    facestart.resize(firstEdgeFace + edgeFace[nV] + 1);
+    facevert.resize(firstEdgeCorner + 4 * edgeFace[nV]);
+
+    /* Old faces keep their place, shrunk or pointing to the kept vertices */
+    DooSabin::shrinkFaces(m, selected, firstPoint, verts.data(), progress, 3);
+    parallelFor(nV, [&m, &keep, &verts] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            if (keep[i + 1] != keep[i])
+                verts[keep[i]] = m.vert(i);
+    });
+    std::copy(fs.begin(), fs.end(), facestart.begin());
+    parallelFor(nE, [&he, &fv, &selected, &keep, &facevert, &point] (size_t begin, size_t end) {
+        for (size_t h = begin; h < end; h++)
+            facevert[h] = selected[he.face(h)] ? point(h) : keep[fv[h]];
+    });
+
+    /* Faces at old vertices, closing the runs of selected faces */
+    parallelFor(nV, [&he, &inSelection, &keep, &vertexFace, &vertexCorner, &facestart, &facevert, &point,
+            firstVertexFace, firstVertexCorner, progress] (size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++) {
+            reportProgress(progress, end - begin + i - begin, 3 * (end - begin));
+            bool kept = keep[i + 1] != keep[i];
+            size_t face = firstVertexFace + vertexFace[i];
+            offset_t corner = firstVertexCorner + vertexCorner[i];
+            he.forEachRun(i, inSelection, [&] (int first, int count, bool closed) {
+                if (!closed && (!kept || count < 2))
+                    return;
+                int h = first;
+                for (int k = 0; k < count; k++, h = he.rotate(h))
+                    facevert[corner++] = point(h);
+                if (!closed)
+                    facevert[corner++] = keep[i];
+                facestart[++face] = corner;
+            });
+        }
+    }, 1024);
+
+    /*
+     * Faces at old edges. Inside the region they are the usual Doo-Sabin quads,
+     * on its border the quad joins the shrunk edge to the old one
+     * */
+    parallelFor(nV, [&he, &fv, &selected, &keep, &edgeFace, &facestart, &facevert, &point,
+            firstEdgeFace, firstEdgeCorner, progress] (size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++) {
+            reportProgress(progress, 2 * (end - begin) + i - begin, 3 * (end - begin));
+            offset_t q = edgeFace[i];
+            for (const int *it = he.edgesBegin(i); it != he.edgesEnd(i); it++) {
+                int h = *it;
+                if (he.origin(h) != static_cast<int>(i) || he.isBoundary(h))
+                    continue;
+                int t = he.twin(h);
+                bool inH = selected[he.face(h)] != 0;
+                bool inT = selected[he.face(t)] != 0;
+                if (!inH && !inT)
+                    continue;
+                int *quad = facevert.data() + firstEdgeCorner + 4 * q;
+                if (inH && inT) {
+                    quad[0] = point(h);
+                    quad[1] = point(he.next(t));
+                    quad[2] = point(t);
+                    quad[3] = point(he.next(h));
+                } else {
+                    int g = inH ? h : t;
+                    quad[0] = point(g);
+                    quad[1] = keep[fv[g]];
+                    quad[2] = keep[he.target(g)];
+                    quad[3] = point(he.next(g));
+                }
+                q++;
+                facestart[firstEdgeFace + q] = firstEdgeCorner + 4 * q;
+            }
+        }
+    }, 1024);
+
+    updateSum();
+}
+
+std::vector<char> AdaptiveDooSabin::selectInBox(const Mesh &m, const Point &lo, const Point &hi) {
+    std::vector<char> selected(m.numFaces());
+    parallelFor(m.numFaces(), [&m, &lo, &hi, &selected] (size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            PolyFace pf = m.face(f);
+            char in = 0;
+            for (auto it = pf.begin; it != pf.end && !in; it++) {
+                const Point &p = m.vert(*it);
+                in = p.x >= lo.x && p.y >= lo.y && p.z >= lo.z && p.x <= hi.x && p.y <= hi.y && p.z <= hi.z;
+            }
+            selected[f] = in;
+        }
+    }, 1024);
+    return selected;
+}
+
+std::vector<char> AdaptiveDooSabin::selectCurved(const Mesh &m, float minAngle) {
+    const HalfEdge he(m);
+    const size_t nF = m.numFaces();
+    std::vector<Point> normal(nF);
+    parallelFor(nF, [&m, &normal] (size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++)
+            normal[f] = faceNormal(m, f);
+    }, 1024);
+
+    const float minCos = cos(minAngle * 0.017453292519943295769f);
+    std::vector<char> selected(nF);
+    parallelFor(nF, [&m, &he, &normal, &selected, minCos] (size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            const Point &a = normal[f];
+            char in = 0;
+            for (int h = static_cast<int>(m.faceStarts()[f]); h < m.faceStarts()[f + 1] && !in; h++) {
+                if (he.isBoundary(h))
+                    continue;
+                const Point &b = normal[he.face(he.twin(h))];
+                in = a.x * b.x + a.y * b.y + a.z * b.z < minCos;
+            }
+            selected[f] = in;
+        }
+    }, 1024);
+    return selected;
+}
+
+std::vector<char> AdaptiveDooSabin::selectLarge(const Mesh &m, const Matrix &mvp, float width, float height,
+        float minPixels)
+{
+    /* Window coordinates of every vertex, w <= 0 marks points behind the eye */
+    const size_t nV = m.numVertices();
+    std::vector<float> clip(4 * nV);
+    parallelFor(nV, [&m, &mvp, &clip] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            mvp.transform(m.vert(i), &clip[4 * i]);
+    });
+
+    std::vector<char> selected(m.numFaces());
+    const float min2 = minPixels * minPixels;
+    parallelFor(m.numFaces(), [&m, &clip, &selected, width, height, min2] (size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            PolyFace pf = m.face(f);
+            /* Outcodes of the clip planes every corner is outside of */
+            int outside = 63;
+            bool front = true;
+            for (auto it = pf.begin; it != pf.end; it++) {
+                const float *c = &clip[4 * *it];
+                front = front && c[3] > 0;
+                outside &= (c[0] < -c[3]) | (c[0] > c[3]) << 1 | (c[1] < -c[3]) << 2 |
+                    (c[1] > c[3]) << 3 | (c[2] < -c[3]) << 4 | (c[2] > c[3]) << 5;
+            }
+            char in = 0;
+            if (front && !outside) {
+                for (auto it = pf.begin; it != pf.end && !in; it++) {
+                    const float *p = &clip[4 * *it];
+                    const float *q = &clip[4 * (it + 1 == pf.end ? *pf.begin : it[1])];
+                    float dx = 0.5f * width * (p[0] / p[3] - q[0] / q[3]);
+                    float dy = 0.5f * height * (p[1] / p[3] - q[1] / q[3]);
+                    in = dx * dx + dy * dy > min2;
+                }
+            }
+            selected[f] = in;
+        }
+    }, 1024);
+    return selected;
+}
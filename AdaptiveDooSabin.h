@@ -0,0 +1,36 @@
+#ifndef __ADAPTIVEDOOSABIN_H__
+#define __ADAPTIVEDOOSABIN_H__
+
+#include "Mesh.h"
+#include "Matrix.h"
+
+#include <vector>
+
+/*
+ * One Doo-Sabin step restricted to the selected faces. Unselected faces are
+ * copied and keep their old vertices. Along the border of the selected region
+ * every edge gets a quad between the shrunk face and the old edge, and every
+ * old vertex a polygon closing each run of selected faces around it, so the
+ * result stays watertight. Selecting every face gives plain DooSabin.
+ * Old vertices still in use come first, then the shrunk face points.
+ * Face f of the result is face f of m, refined or copied
+ * */
+
+class AdaptiveDooSabin: public Mesh {
+public:
+    AdaptiveDooSabin(const Mesh &m, const std::vector<char> &selected, Progress *progress = 0);
+
+    /* Faces with a vertex inside the box [lo, hi] */
+    static std::vector<char> selectInBox(const Mesh &m, const Point &lo, const Point &hi);
+
+    /* Faces meeting a neighbour at more than minAngle degrees between their normals */
+    static std::vector<char> selectCurved(const Mesh &m, float minAngle);
+
+    /*
+     * Faces in front of the camera and at least partly in view with an edge
+     * longer than minPixels on a width x height viewport after mvp
+     * */
+    static std::vector<char> selectLarge(const Mesh &m, const Matrix &mvp, float width, float height, float minPixels);
+};
+
+#endif
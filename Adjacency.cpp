@@ -0,0 +1,178 @@
+#include "Adjacency.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+/*
+ * Sorts and dedups every vertex list in place, then packs the lists
+ * into fresh arrays. Returns the new offsets through start
+ * */
+void compact(std::vector<offset_t> &start, std::vector<int> &items, bool parallel) {
+    const size_t nV = start.size() - 1;
+    std::vector<offset_t> count(nV + 1, 0);
+    auto dedup = [&start, &items, &count] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            int *b = items.data() + start[v];
+            int *e = items.data() + start[v + 1];
+            std::sort(b, e);
+            count[v + 1] = std::unique(b, e) - b;
+        }
+    };
+    if (parallel)
+        parallelFor(nV, dedup);
+    else
+        dedup(0, nV);
+    for (size_t v = 0; v < nV; v++)
+        count[v + 1] += count[v];
+    if (count[nV] == start[nV])
+        return;
+    std::vector<int> packed(count[nV]);
+    auto pack = [&start, &items, &count, &packed] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++)
+            std::copy(items.data() + start[v], items.data() + start[v] + (count[v + 1] - count[v]),
+                    packed.data() + count[v]);
+    };
+    if (parallel)
+        parallelFor(nV, pack);
+    else
+        pack(0, nV);
+    start.swap(count);
+    items.swap(packed);
+}
+
+inline void checkVertex(int v, size_t nV) {
+    if (v < 0 || static_cast<size_t>(v) >= nV)
+        throw std::out_of_range("Face refers to a missing vertex");
+}
+
+}
+
+Adjacency::Adjacency(const Mesh &m, bool parallel) {
+    /* Face ids are stored as int */
+    if (m.numFaces() > static_cast<size_t>(std::numeric_limits<int>::max()))
+        throw std::range_error("Too many faces");
+    if (parallel && numThreads() > 1)
+        buildParallel(m);
+    else
+        buildSerial(m);
+    compact(_faceStart, _faces, parallel);
+    compact(_edgeStart, _edges, parallel);
+}
+
+void Adjacency::buildSerial(const Mesh &m) {
+    const std::vector<offset_t> &fs = m.faceStarts();
+    const std::vector<index_t> &fv = m.faceVerts();
+    const size_t nV = m.numVertices();
+    const size_t nF = m.numFaces();
+
+    /* Counting pass */
+    _faceStart.assign(nV + 1, 0);
+    for (auto v = fv.begin(); v != fv.end(); v++) {
+        checkVertex(*v, nV);
+        _faceStart[*v + 1]++;
+    }
+    for (size_t v = 0; v < nV; v++)
+        _faceStart[v + 1] += _faceStart[v];
+    _edgeStart.resize(nV + 1);
+    for (size_t v = 0; v <= nV; v++)
+        _edgeStart[v] = 2 * _faceStart[v];
+
+    /* Filling pass, every face corner adds its face and both its neighbours */
+    _faces.resize(_faceStart[nV]);
+    _edges.resize(_edgeStart[nV]);
+    std::vector<offset_t> cursor(_faceStart.begin(), _faceStart.end() - 1);
+    for (size_t f = 0; f < nF; f++) {
+        offset_t b = fs[f];
+        offset_t e = fs[f + 1];
+        for (offset_t j = b; j < e; j++) {
+            int v = fv[j];
+            offset_t k = cursor[v]++;
+            _faces[k] = static_cast<int>(f);
+            _edges[2 * k] = fv[j == b ? e - 1 : j - 1];
+            _edges[2 * k + 1] = fv[j + 1 == e ? b : j + 1];
+        }
+    }
+}
+
+void Adjacency::buildParallel(const Mesh &m) {
+    const std::vector<offset_t> &fs = m.faceStarts();
+    const std::vector<index_t> &fv = m.faceVerts();
+    const size_t nV = m.numVertices();
+    const size_t nF = m.numFaces();
+
+    /* Counts first, then the next free slot of every vertex */
+    std::unique_ptr<std::atomic<offset_t>[]> counter(new std::atomic<offset_t>[nV + 1]);
+    parallelFor(nV + 1, [&counter] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++)
+            counter[v].store(0, std::memory_order_relaxed);
+    });
+
+    /* Counting pass */
+    parallelFor(fv.size(), [&fv, &counter, nV] (size_t begin, size_t end) {
+        for (size_t j = begin; j < end; j++) {
+            checkVertex(fv[j], nV);
+            counter[fv[j] + 1].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    _faceStart.resize(nV + 1);
+    _faceStart[0] = 0;
+    for (size_t v = 0; v < nV; v++)
+        _faceStart[v + 1] = _faceStart[v] + counter[v + 1].load(std::memory_order_relaxed);
+    _edgeStart.resize(nV + 1);
+    parallelFor(nV + 1, [this, &counter] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            _edgeStart[v] = 2 * _faceStart[v];
+            counter[v].store(_faceStart[v], std::memory_order_relaxed);
+        }
+    });
+
+    /* Filling pass. Slots are claimed in any order, compact() sorts them afterwards */
+    _faces.resize(_faceStart[nV]);
+    _edges.resize(_edgeStart[nV]);
+    parallelFor(nF, [this, &fs, &fv, &counter] (size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            offset_t b = fs[f];
+            offset_t e = fs[f + 1];
+            for (offset_t j = b; j < e; j++) {
+                int v = fv[j];
+                offset_t k = counter[v].fetch_add(1, std::memory_order_relaxed);
+                _faces[k] = static_cast<int>(f);
+                _edges[2 * k] = fv[j == b ? e - 1 : j - 1];
+                _edges[2 * k + 1] = fv[j + 1 == e ? b : j + 1];
+            }
+        }
+    }, 1024);
+}
+
+void Adjacency::checkTopology(bool reportBorders) const {
+    for (size_t i = 0; i < numVertices(); i++) {
+        if (!isBorder(i) && !isOrphan(i)) {
+            if (numFaces(i) < 3) {
+                std::cerr << "Vertex " << i << " has less than 3 faces around and is not a boundary one" << std::endl;
+                throw std::logic_error("Non-boundary vertex with less than 3 faces");
+            }
+            continue;
+        }
+        int def = numEdges(i) - numFaces(i);
+        if (!reportBorders && (def == 0 || def == 1))
+            continue;
+        std::cerr << "Defect at vertex " << i
+            << ", edges = " << numEdges(i)
+            << ", faces = " << numFaces(i);
+        if (def == 1)
+            std::cerr << " Looks like a face fan" << std::endl;
+        else if (def == 0)
+            std::cerr << " Orphan vertex" << std::endl;
+        else {
+            std::cerr << " No way to resolve" << std::endl;
+            throw std::logic_error("Unrecoverable topology error in mesh");
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef __ADJACENCY_H__
+#define __ADJACENCY_H__
+
+#include "Mesh.h"
+
+#include <vector>
+#include <cstddef>
+
+/*
+ * Vertex to face and vertex to vertex incidence of a Mesh, stored as flat
+ * offset + index arrays. Both lists of every vertex are sorted and
+ * have no repeats
+ * */
+
+class Adjacency {
+    std::vector<offset_t> _faceStart;
+    std::vector<int> _faces;
+    std::vector<offset_t> _edgeStart;
+    std::vector<int> _edges;
+
+    void buildSerial(const Mesh &m);
+    void buildParallel(const Mesh &m);
+public:
+    Adjacency(const Mesh &m, bool parallel = true);
+
+    size_t numVertices() const { return _faceStart.size() - 1; }
+
+    int numFaces(size_t v) const { return static_cast<int>(_faceStart[v + 1] - _faceStart[v]); }
+    const int *facesBegin(size_t v) const { return _faces.data() + _faceStart[v]; }
+    const int *facesEnd(size_t v) const { return _faces.data() + _faceStart[v + 1]; }
+    /* Position of v's face list in the flat array, handy for per (vertex, face) data */
+    offset_t faceOffset(size_t v) const { return _faceStart[v]; }
+    size_t numVertexFaces() const { return _faces.size(); }
+
+    int numEdges(size_t v) const { return static_cast<int>(_edgeStart[v + 1] - _edgeStart[v]); }
+    const int *edgesBegin(size_t v) const { return _edges.data() + _edgeStart[v]; }
+    const int *edgesEnd(size_t v) const { return _edges.data() + _edgeStart[v + 1]; }
+
+    /* A boundary vertex has one more neighbour than faces, an orphan one has no faces at all */
+    bool isBorder(size_t v) const { return numEdges(v) != numFaces(v); }
+    bool isOrphan(size_t v) const { return numFaces(v) == 0; }
+
+    /*
+     * Reports defective vertices and throws if the mesh can not be subdivided.
+     * Boundary and orphan vertices are only reported when reportBorders is set
+     * */
+    void checkTopology(bool reportBorders = true) const;
+};
+
+#endif
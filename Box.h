@@ -21,30 +21,23 @@ struct AABB {
         if (p.z > z2) z2 = p.z;
         if (p.z < z1) z1 = p.z;
     }
-    bool isInLeft(const Point &pp, const Point &c) const {
-        const Point p(pp, c);
+    void add(const AABB &b) {
+        if (b.x2 > x2) x2 = b.x2;
+        if (b.x1 < x1) x1 = b.x1;
+        if (b.y2 > y2) y2 = b.y2;
+        if (b.y1 < y1) y1 = b.y1;
+        if (b.z2 > z2) z2 = b.z2;
+        if (b.z1 < z1) z1 = b.z1;
+    }
+    /* Surface area, zero for an empty box */
+    float area() const {
+        if (isEmpty())
+            return 0;
         float dx, dy, dz;
         dx = x2 - x1;
         dy = y2 - y1;
         dz = z2 - z1;
-        if (dx >= dy && dx >= dz)
-            return 2 * p.x < x1 + x2;
-        if (dy >= dx && dy >= dz)
-            return 2 * p.y < y1 + y2;
-        if (dz >= dx && dz >= dy)
-            return 2 * p.z < z1 + z2;
-        assert(false);
-        return false;
-    }
-    bool hasOnLeft (const Face &f, const std::vector<Point> &ps, const Point &c) {
-        return isInLeft(ps[f.v1], c) ||
-               isInLeft(ps[f.v2], c) ||
-               isInLeft(ps[f.v3], c);
-    }
-    bool hasOnRight(const Face &f, const std::vector<Point> &ps, const Point &c) {
-        return !isInLeft(ps[f.v1], c) ||
-               !isInLeft(ps[f.v2], c) ||
-               !isInLeft(ps[f.v3], c);
+        return 2 * (dx * dy + dy * dz + dz * dx);
     }
     float radius() const {
         float dx, dy, dz;
@@ -64,7 +57,7 @@ struct AABB {
         y2 += d;
         z2 += d;
     }
-    void writeVertex(float buf[]) {
+    void writeVertex(float buf[]) const {
         if (isEmpty()) {
             for (int j = 0; j < 8 * 3; j++)
                 buf[j] = 0;
@@ -82,4 +75,13 @@ struct AABB {
     }
 };
 
+/* Box bounds along axis 0, 1 or 2 */
+inline float lower(const AABB &b, int axis) {
+    return axis == 0 ? b.x1 : (axis == 1 ? b.y1 : b.z1);
+}
+
+inline float upper(const AABB &b, int axis) {
+    return axis == 0 ? b.x2 : (axis == 1 ? b.y2 : b.z2);
+}
+
 #endif
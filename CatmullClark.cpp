@@ -0,0 +1,113 @@
+#include "CatmullClark.h"
+#include "Adjacency.h"
+#include "HalfEdge.h"
+#include "Progress.h"
+#include "Parallel.h"
+
+#include <stdexcept>
+#include <limits>
+
+CatmullClark::CatmullClark(const Mesh &m, Progress *progress) : Mesh(m.filename() + "*") {
+    const Adjacency adj(m);
+    adj.checkTopology();
+    const HalfEdge he(m);
+
+    const size_t nV = m.numVertices();
+    const size_t nF = m.numFaces();
+    const size_t nE = he.size();
+    const std::vector<offset_t> &fs = m.faceStarts();
+
+    std::vector<int> edgeId;
+    std::vector<int> edgeHalf;
+    const size_t numEdges = he.numberEdges(edgeId, edgeHalf);
+
+    const size_t firstEdge = nV;
+    const size_t firstFace = nV + numEdges;
+    if (firstFace + nF > static_cast<size_t>(std::numeric_limits<int>::max()))
+        throw std::range_error("Too many vertices");
+    std::vector<Point> &verts = vertData();
+    std::vector<offset_t> &facestart = faceStartData();
+    std::vector<index_t> &facevert = faceVertData();
+    verts.resize(firstFace + nF);
+    facestart.resize(nE + 1);
+    facevert.resize(4 * nE);
+
+    /* Face points */
+    parallelFor(nF, [&m, &fs, &verts, firstFace, progress] (size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            reportProgress(progress, f - begin, 4 * (end - begin));
+            Point c(0, 0, 0);
+            for (offset_t h = fs[f]; h < fs[f + 1]; h++)
+                c += m.vert(m.faceVerts()[h]);
+            verts[firstFace + f] = (1.f / (fs[f + 1] - fs[f])) * c;
+        }
+    }, 1024);
+
+    /* Edge points, midpoints on the boundary */
+    parallelFor(numEdges, [&m, &he, &edgeHalf, &verts, firstEdge, firstFace, progress] (size_t begin, size_t end) {
+        for (size_t e = begin; e < end; e++) {
+            reportProgress(progress, end - begin + e - begin, 4 * (end - begin));
+            int h = edgeHalf[e];
+            int t = he.twin(h);
+            Point p = m.vert(he.origin(h));
+            p += m.vert(he.target(h));
+            if (t < 0) {
+                verts[firstEdge + e] = 0.5f * p;
+                continue;
+            }
+            p += verts[firstFace + he.face(h)];
+            p += verts[firstFace + he.face(t)];
+            verts[firstEdge + e] = 0.25f * p;
+        }
+    }, 1024);
+
+    /* Vertex points (F + R' + (n - 2) P) / n, with R' the average neighbour */
+    parallelFor(nV, [&m, &adj, &he, &verts, firstFace, progress] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            reportProgress(progress, 2 * (end - begin) + v - begin, 4 * (end - begin));
+            const Point &p = m.vert(v);
+            if (adj.isOrphan(v)) {
+                verts[v] = p;
+                continue;
+            }
+            if (adj.isBorder(v)) {
+                /* Boundary neighbours are ahead of the first outgoing and behind the last one */
+                int h = he.vertexEdge(v);
+                Point q = m.vert(he.target(h));
+                while (he.rotate(h) >= 0)
+                    h = he.rotate(h);
+                q += m.vert(he.origin(he.prev(h)));
+                q += 6 * p;
+                verts[v] = 0.125f * q;
+                continue;
+            }
+            int n = adj.numEdges(v);
+            Point f(0, 0, 0);
+            for (const int *it = adj.facesBegin(v); it != adj.facesEnd(v); it++)
+                f += verts[firstFace + *it];
+            Point r(0, 0, 0);
+            for (const int *it = adj.edgesBegin(v); it != adj.edgesEnd(v); it++)
+                r += m.vert(*it);
+            Point q = (1.f / n) * f;
+            q += (1.f / n) * r;
+            q += static_cast<float>(n - 2) * p;
+            verts[v] = (1.f / n) * q;
+        }
+    }, 1024);
+
+    /* Corner h of an old face gives the quad (vertex, edge h, face, edge before h) */
+    parallelFor(nE, [&he, &edgeId, &facestart, &facevert, firstEdge, firstFace, progress] (size_t begin, size_t end) {
+        for (size_t h = begin; h < end; h++) {
+            reportProgress(progress, 3 * (end - begin) + h - begin, 4 * (end - begin));
+            int *quad = facevert.data() + 4 * h;
+            quad[0] = he.origin(h);
+            quad[1] = static_cast<int>(firstEdge + edgeId[h]);
+            quad[2] = static_cast<int>(firstFace + he.face(h));
+            quad[3] = static_cast<int>(firstEdge + edgeId[he.prev(h)]);
+            facestart[h + 1] = static_cast<offset_t>(4 * (h + 1));
+        }
+    });
+    facestart[0] = 0;
+
+    updateSum();
+}
@@ -0,0 +1,17 @@
+#ifndef __CATMULLCLARK_H__
+#define __CATMULLCLARK_H__
+
+#include "Mesh.h"
+
+/*
+ * Catmull-Clark subdivision, every corner of an old face becomes a quad.
+ * New vertices are the old vertex points, then edge points, then face points.
+ * Boundaries follow the cubic B-spline curve rules
+ * */
+
+class CatmullClark: public Mesh {
+public:
+    CatmullClark(const Mesh &m, Progress *progress = 0);
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "Culling.h"
+#include "HiZBuffer.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <cmath>
+
+Frustum::Frustum(const Matrix &mvp) {
+    /* Clip space is -w <= x, y, z <= w, each side is the last row plus or minus another */
+    const float *m = mvp.data();
+    for (int i = 0; i < 6; i++) {
+        float sign = i % 2 ? -1.f : 1.f;
+        for (int j = 0; j < 4; j++)
+            plane[i][j] = m[12 + j] + sign * m[4 * (i / 2) + j];
+        /* Unit normals make the left side a distance, spheres compare against it */
+        float len = std::sqrt(plane[i][0] * plane[i][0] + plane[i][1] * plane[i][1] + plane[i][2] * plane[i][2]);
+        if (len > 0)
+            for (int j = 0; j < 4; j++)
+                plane[i][j] /= len;
+    }
+}
+
+int Frustum::classify(const AABB &b, int planes) const {
+    for (int p = 0; p < 6; p++) {
+        if (!(planes & (1 << p)))
+            continue;
+        const float *q = plane[p];
+        /* Corners farthest along and against the plane normal */
+        float front = q[0] * (q[0] >= 0 ? b.x2 : b.x1) + q[1] * (q[1] >= 0 ? b.y2 : b.y1) +
+            q[2] * (q[2] >= 0 ? b.z2 : b.z1) + q[3];
+        float back = q[0] * (q[0] >= 0 ? b.x1 : b.x2) + q[1] * (q[1] >= 0 ? b.y1 : b.y2) +
+            q[2] * (q[2] >= 0 ? b.z1 : b.z2) + q[3];
+        if (front < 0)
+            return -1;
+        if (back >= 0)
+            planes &= ~(1 << p);
+    }
+    return planes;
+}
+
+int Frustum::classify(const Point &center, float radius, int planes) const {
+    for (int p = 0; p < 6; p++) {
+        if (!(planes & (1 << p)))
+            continue;
+        const float *q = plane[p];
+        float d = q[0] * center.x + q[1] * center.y + q[2] * center.z + q[3];
+        if (d < -radius)
+            return -1;
+        if (d >= radius)
+            planes &= ~(1 << p);
+    }
+    return planes;
+}
+
+DrawRanges::DrawRanges(const AABBTree &tree) : _tree(tree) {
+    const std::vector<AABBTree::Node> &nodes = tree.nodes();
+    _begin.resize(nodes.size());
+    _end.resize(nodes.size());
+    /* Children come after their parent */
+    for (size_t i = nodes.size(); i-- > 0;) {
+        const AABBTree::Node &n = nodes[i];
+        if (n.isLeaf()) {
+            _begin[i] = n.first;
+            _end[i] = n.first + n.count;
+            continue;
+        }
+        int l = n.first;
+        int r = n.first + 1;
+        if (_end[l] != _begin[r] && _end[r] != _begin[l])
+            throw std::invalid_argument("Tree node does not cover a contiguous range of triangles");
+        _begin[i] = std::min(_begin[l], _begin[r]);
+        _end[i] = std::max(_end[l], _end[r]);
+    }
+}
+
+void DrawRanges::clusters(std::vector<int> &first, std::vector<int> &count) const {
+    first.clear();
+    count.clear();
+    const std::vector<AABBTree::Node> &nodes = _tree.nodes();
+    std::vector<int> stack(1, 0);
+    while (!stack.empty()) {
+        int i = stack.back();
+        stack.pop_back();
+        const AABBTree::Node &n = nodes[i];
+        if (!n.isLeaf() && _end[i] - _begin[i] >= CLUSTER_SIZE) {
+            int l = n.first;
+            int r = n.first + 1;
+            if (_begin[l] > _begin[r])
+                std::swap(l, r);
+            stack.push_back(r);
+            stack.push_back(l);
+        } else if (_end[i] > _begin[i]) {
+            first.push_back(_begin[i]);
+            count.push_back(_end[i] - _begin[i]);
+        }
+    }
+}
+
+size_t DrawRanges::cull(const Frustum &f, std::vector<int> &first, std::vector<int> &count,
+        const HiZBuffer *hiz, size_t *occluded) const {
+    first.clear();
+    count.clear();
+    if (occluded)
+        *occluded = 0;
+    const std::vector<AABBTree::Node> &nodes = _tree.nodes();
+    if (nodes[0].box.isEmpty())
+        return 0;
+
+    /* Nodes with the bit mask of planes they may still cross */
+    std::vector<std::pair<int, int> > stack(1, std::make_pair(0, static_cast<int>(Frustum::ALL_PLANES)));
+    size_t visible = 0;
+    while (!stack.empty()) {
+        int i = stack.back().first;
+        int planes = f.classify(nodes[i].box, stack.back().second);
+        stack.pop_back();
+        if (planes < 0)
+            continue;
+        if (hiz && hiz->occluded(nodes[i].box)) {
+            if (occluded)
+                *occluded += _end[i] - _begin[i];
+            continue;
+        }
+
+        const AABBTree::Node &n = nodes[i];
+        if ((planes || hiz) && !n.isLeaf() && _end[i] - _begin[i] >= CLUSTER_SIZE) {
+            /* Lower range on top, so ranges come out ascending */
+            int l = n.first;
+            int r = n.first + 1;
+            if (_begin[l] > _begin[r])
+                std::swap(l, r);
+            stack.push_back(std::make_pair(r, planes));
+            stack.push_back(std::make_pair(l, planes));
+            continue;
+        }
+
+        visible += _end[i] - _begin[i];
+        if (!first.empty() && first.back() + count.back() == _begin[i])
+            count.back() += _end[i] - _begin[i];
+        else {
+            first.push_back(_begin[i]);
+            count.push_back(_end[i] - _begin[i]);
+        }
+    }
+    return visible;
+}
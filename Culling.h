@@ -0,0 +1,64 @@
+#ifndef __CULLING_H__
+#define __CULLING_H__
+
+#include "AABBTree.h"
+#include "Matrix.h"
+
+#include <vector>
+
+/* Inside where a x + b y + c z + d >= 0 for all six planes (a, b, c, d), with unit (a, b, c) */
+struct Frustum {
+    float plane[6][4];
+    /* Clip volume of mvp, in the space mvp maps from */
+    explicit Frustum(const Matrix &mvp);
+
+    enum { ALL_PLANES = (1 << 6) - 1 };
+    /*
+     * Tests b against the planes in the bit mask planes. Returns -1 if b is
+     * outside one of them, else the mask without the planes b is inside of
+     * */
+    int classify(const AABB &b, int planes = ALL_PLANES) const;
+    /* Same for the sphere around center */
+    int classify(const Point &center, float radius, int planes = ALL_PLANES) const;
+};
+
+class HiZBuffer;
+
+/*
+ * Triangle ranges of the nodes of an AABBTree. Every subtree owns a
+ * contiguous range of faces(), so an index buffer written in that order
+ * draws a whole subtree with one call. Culling walks the tree against a
+ * frustum, stops at subtrees entirely inside or outside and remembers
+ * the planes a node is already inside of for its descendants. Subtrees
+ * of fewer than CLUSTER_SIZE triangles are clusters that are kept or
+ * dropped whole, triangles may be reordered freely inside them
+ * */
+
+class DrawRanges {
+    const AABBTree &_tree;
+    std::vector<int> _begin;
+    std::vector<int> _end;
+public:
+    enum { CLUSTER_SIZE = 256 };
+
+    /* Throws if some subtree does not cover a contiguous range */
+    explicit DrawRanges(const AABBTree &tree);
+
+    /* Triangles [begin(i), end(i)) of faces() are below node i */
+    int begin(size_t i) const { return _begin[i]; }
+    int end(size_t i) const { return _end[i]; }
+
+    /* Replaces first and count by the ranges of the largest clusters, which cover faces() in order */
+    void clusters(std::vector<int> &first, std::vector<int> &count) const;
+
+    /*
+     * Replaces first and count by the ranges of faces() in clusters touching f,
+     * ascending and with touching ranges merged. Returns their triangle count.
+     * With hiz, nodes behind its occluders are left out as well and their
+     * triangles counted in occluded
+     * */
+    size_t cull(const Frustum &f, std::vector<int> &first, std::vector<int> &count,
+        const HiZBuffer *hiz = 0, size_t *occluded = 0) const;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "Culling.h"
+#include "Mesh.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+
+/*
+ * Checks frustum and draw range culling without a GL context:
+ *   cullingtest file.ply ...
+ * Returns the number of failed checks
+ * */
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string &what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+AABB box(float x1, float y1, float z1, float x2, float y2, float z2) {
+    AABB b;
+    b.add(Point(x1, y1, z1));
+    b.add(Point(x2, y2, z2));
+    return b;
+}
+
+void knownBoxes() {
+    /* The identity keeps the clip cube, planes come in the order x >= -1, x <= 1, y >= -1, ... */
+    Frustum cube((IdentityMatrix()));
+    check(cube.classify(box(-.5f, -.5f, -.5f, .5f, .5f, .5f)) == 0, "box inside the cube");
+    check(cube.classify(box(2, -.5f, -.5f, 3, .5f, .5f)) == -1, "box right of the cube");
+    check(cube.classify(box(-.5f, -3, -.5f, .5f, -2, .5f)) == -1, "box below the cube");
+    check(cube.classify(box(.5f, -.5f, -.5f, 1.5f, .5f, .5f)) == 1 << 1, "box crossing x = 1");
+    check(cube.classify(box(-.5f, -.5f, -1.5f, .5f, .5f, 1.5f)) == (1 << 4 | 1 << 5), "box crossing both z planes");
+    check(cube.classify(box(-2, -2, -2, 2, 2, 2)) == Frustum::ALL_PLANES, "box around the cube");
+    check(cube.classify(box(.5f, -.5f, -.5f, 1.5f, .5f, .5f), 1) == 0, "planes already passed are skipped");
+    check(cube.classify(box(2, -.5f, -.5f, 3, .5f, .5f), ~(1 << 1) & Frustum::ALL_PLANES) == 0,
+        "outside a skipped plane only");
+    check(cube.classify(Point(0, 0, 0), .5f) == 0, "sphere inside the cube");
+    check(cube.classify(Point(0, 0, 1), .5f) == 1 << 5, "sphere crossing z = 1");
+    check(cube.classify(Point(2, 0, 0), .9f) == -1, "sphere right of the cube");
+    check(cube.classify(Point(1.5f, 0, 0), .6f) == 1 << 1, "sphere reaching into the cube");
+
+    /* The camera looks down -z between 0.5 and 4.5, planes are normalized */
+    Frustum view(PerspectiveMatrix(0.5f, 4.5f, 30, 1));
+    for (int p = 0; p < 6; p++) {
+        const float *q = view.plane[p];
+        check(std::fabs(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] - 1) < 1e-5f, "unit plane normal");
+    }
+    check(view.classify(box(-.1f, -.1f, -2.1f, .1f, .1f, -1.9f)) == 0, "box in front of the camera");
+    check(view.classify(box(-.1f, -.1f, 1.9f, .1f, .1f, 2.1f)) == -1, "box behind the camera");
+    check(view.classify(box(-.1f, -.1f, -4.6f, .1f, .1f, -4.4f)) == 1 << 5, "box crossing the far plane");
+    check(view.classify(box(-.1f, -.1f, -5.1f, .1f, .1f, -4.9f)) == -1, "box beyond the far plane");
+    check(view.classify(box(2, -.1f, -2.1f, 2.2f, .1f, -1.9f)) == -1, "box right of the view");
+    check(view.classify(Point(0, 0, -.5f), .1f) == 1 << 4, "sphere on the near plane");
+}
+
+/* Maps the centered space of the tree to clip space, looking at the model from a random side */
+Matrix randomView(std::mt19937 &random, float radius, int zoom) {
+    std::uniform_real_distribution<float> angle(-180, 180);
+    Matrix mvp(RotateMatrix(angle(random), angle(random)));
+    mvp.multWithLeft(Scale(std::exp(0.05f * zoom) / radius));
+    mvp.multWithLeft(Translate(Point(0, 0, -2)));
+    mvp.multWithLeft(PerspectiveMatrix(0.5f, 4.5f, 30, 1.5f));
+    return mvp;
+}
+
+/* DrawRanges::cull against culling every cluster by the box of its triangles */
+void ranges(const std::string &name, const TriMesh &m, const Point &center, AABBTree::Builder builder) {
+    const std::string what = name + (builder == AABBTree::SAH ? ", SAH: " : ", LBVH: ");
+    AABBTree tree(m, center, 0, builder);
+    DrawRanges ranges(tree);
+    const std::vector<int> &order = tree.faces();
+    const std::vector<Point> &v = m.vertsWithNormals();
+    const int n = static_cast<int>(order.size());
+    check(ranges.begin(0) == 0 && ranges.end(0) == n, what + "root covers all triangles");
+
+    std::vector<int> clusterFirst, clusterCount;
+    ranges.clusters(clusterFirst, clusterCount);
+    std::vector<AABB> clusterBox(clusterFirst.size());
+    int next = 0;
+    for (size_t c = 0; c < clusterFirst.size(); c++) {
+        check(clusterFirst[c] == next && clusterCount[c] > 0, what + "clusters cover the triangles in order");
+        next = clusterFirst[c] + clusterCount[c];
+        for (int k = clusterFirst[c]; k < next; k++) {
+            const Face &f = m.faces()[order[k]];
+            clusterBox[c].add(Point(v[f.v1], center));
+            clusterBox[c].add(Point(v[f.v2], center));
+            clusterBox[c].add(Point(v[f.v3], center));
+        }
+    }
+    check(next == n, what + "clusters end with the last triangle");
+
+    std::mt19937 random(5);
+    std::vector<int> first, count, expectedFirst, expectedCount;
+    for (int view = 0; view < 100; view++) {
+        Frustum f(randomView(random, tree.radius(), view % 60 - 10));
+        size_t visible = ranges.cull(f, first, count);
+
+        /* Kept clusters, with neighbours merged */
+        size_t expected = 0;
+        expectedFirst.clear();
+        expectedCount.clear();
+        for (size_t c = 0; c < clusterFirst.size(); c++) {
+            if (f.classify(clusterBox[c]) < 0)
+                continue;
+            expected += clusterCount[c];
+            if (!expectedFirst.empty() && expectedFirst.back() + expectedCount.back() == clusterFirst[c])
+                expectedCount.back() += clusterCount[c];
+            else {
+                expectedFirst.push_back(clusterFirst[c]);
+                expectedCount.push_back(clusterCount[c]);
+            }
+        }
+        check(visible == expected, what + "visible triangle count");
+        check(first == expectedFirst && count == expectedCount, what + "ranges are the kept clusters, merged");
+
+        /* No triangle with a corner in view is dropped */
+        std::vector<char> drawn(n, 0);
+        for (size_t i = 0; i < first.size(); i++)
+            for (int k = first[i]; k < first[i] + count[i]; k++)
+                drawn[k] = 1;
+        for (int k = 0; k < n; k++) {
+            const Face &t = m.faces()[order[k]];
+            const int corners[3] = {t.v1, t.v2, t.v3};
+            for (int j = 0; j < 3 && !drawn[k]; j++) {
+                const Point p(v[corners[j]], center);
+                if (f.classify(p, 0) >= 0) {
+                    check(false, what + "triangle in view is culled");
+                    break;
+                }
+            }
+        }
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    knownBoxes();
+    for (int i = 1; i < argc; i++) {
+        PLYMesh control(argv[i]);
+        TriMesh m(control);
+        ranges(argv[i], m, control.center(), AABBTree::SAH);
+        ranges(argv[i], m, control.center(), AABBTree::LBVH);
+    }
+    if (failures)
+        std::cerr << failures << " checks failed" << std::endl;
+    return failures;
+}
@@ -1,257 +1,278 @@
 #include "DooSabin.h"
+#include "Adjacency.h"
+#include "HalfEdge.h"
+#include "Progress.h"
+#include "Parallel.h"
 
-#include <cmath>
 #include <stdexcept>
 #include <iostream>
+#include <sstream>
 #include <algorithm>
-#include <cassert>
 
-int DooSabin::maxFaceOrder() {
-    return 100;
+namespace {
+
+/*
+ * Shrunk face point j of a face of order n is sum_k w(n, |j - k|) p_k with
+ * w(n, d) = [d == 0] / 4 + (3 + 2 cos(2 pi d / n)) / 4n
+ * Cosine is evaluated by a Taylor series so the weights can be built at compile
+ * time. Angles are rounded to float first, as the old run-time tables did
+ * */
+constexpr double pi = 3.14159265358979323846;
+constexpr float piF = 3.14159265358979323846f;
+
+constexpr double cosSeries(double x2, double term, int k, double sum) {
+    return k > 12 ? sum : cosSeries(x2, -term * x2 / ((2 * k + 1) * (2 * k + 2)), k + 1, sum + term);
+}
+constexpr double cosQuarter(double x) { return cosSeries(x * x, 1, 0, 0); }
+constexpr double cosHalf(double x) { return x > pi / 2 ? -cosQuarter(pi - x) : cosQuarter(x); }
+constexpr double cosTurn(double x) { return x > pi ? cosHalf(2 * pi - x) : cosHalf(x); }
+
+constexpr float weight(int n, int d) {
+    return (!d ? 0.25f : 0) + 0.25f * (3.f + 2.f * static_cast<float>(cosTurn(2 * piF / n * d))) / n;
 }
 
-std::vector<int> DooSabin::initOffsetTable() {
-    std::vector<int> ret;
-    ret.push_back(0); /* n = 0 */
-    ret.push_back(0); /* n = 1 */
-    for (int n = 1; n <= maxFaceOrder(); n++) {
-        int last = ret.back();
-        ret.push_back(last + n);
+constexpr float triWeights[3] = {weight(3, 0), weight(3, 1), weight(3, 2)};
+constexpr float quadWeights[4] = {weight(4, 0), weight(4, 1), weight(4, 2), weight(4, 3)};
+constexpr float pentWeights[5] = {weight(5, 0), weight(5, 1), weight(5, 2), weight(5, 3), weight(5, 4)};
+constexpr float hexWeights[6] = {weight(6, 0), weight(6, 1), weight(6, 2), weight(6, 3), weight(6, 4), weight(6, 5)};
+
+/* Shrinks a face of fixed order N. Loops have constant trip counts and get unrolled */
+template<int N>
+inline void shrink(const Mesh &m, const int *fv, const float (&w)[N], Point *out) {
+    Point ps[N];
+    for (int k = 0; k < N; k++)
+        ps[k] = m.vert(fv[k]);
+    for (int j = 0; j < N; j++) {
+        Point p(0, 0, 0);
+        for (int k = 0; k < N; k++)
+            p += w[j > k ? j - k : k - j] * ps[k];
+        out[j] = p;
     }
-    return ret;
 }
 
-std::vector<float> DooSabin::initCosTable() {
-    std::vector<float> ret;
-    const float pi = 4 * atan(1.f);
-    for (int n = 1; n <= maxFaceOrder(); n++) {
-        float alpha = 2 * pi / n;
-        for (int ij = 0; ij < n; ij++)
-            ret.push_back(cos(alpha * ij));
+/* Any other order, with weights and points in caller owned buffers */
+void shrink(const Mesh &m, const int *fv, int n, std::vector<float> &w, std::vector<Point> &ps, Point *out) {
+    w.resize(n);
+    ps.resize(n);
+    for (int k = 0; k < n; k++) {
+        w[k] = weight(n, k);
+        ps[k] = m.vert(fv[k]);
+    }
+    for (int j = 0; j < n; j++) {
+        Point p(0, 0, 0);
+        for (int k = 0; k < n; k++)
+            p += w[j > k ? j - k : k - j] * ps[k];
+        out[j] = p;
     }
-    return ret;
 }
 
-float DooSabin::a(int n, int i, int j) {
-    static std::vector<int> offs = initOffsetTable();
-    static std::vector<float> cost = initCosTable();
-    int ij = abs(i - j);
-    if (n > maxFaceOrder())
-        throw std::range_error("Please increase maxFaceOrder");
-    float cv = cost[offs[n] + ij];
-    return (!ij ? 0.25f : 0) + 0.25f * (3.f + 2.f * cv) / n;
+/* Shrinks face f of m into out, picking the fixed order kernel where there is one */
+inline void shrinkFace(const Mesh &m, size_t f, Point *out, std::vector<float> &w, std::vector<Point> &ps) {
+    const index_t *fv = m.faceVerts().data();
+    offset_t h0 = m.faceStarts()[f];
+    int n = static_cast<int>(m.faceStarts()[f + 1] - h0);
+    switch (n) {
+        case 3: shrink<3>(m, fv + h0, triWeights, out); break;
+        case 4: shrink<4>(m, fv + h0, quadWeights, out); break;
+        case 5: shrink<5>(m, fv + h0, pentWeights, out); break;
+        case 6: shrink<6>(m, fv + h0, hexWeights, out); break;
+        default: shrink(m, fv + h0, n, w, ps, out);
+    }
 }
 
-struct NewPoint {
-    int vertex;
-    int oldface;
-    NewPoint() { }
-    NewPoint(int v, int f) : vertex(v), oldface(f) { }
-};
+}
 
-DooSabin::DooSabin(const Mesh &m) : Mesh(m.filename() + "*") {
-    std::vector<std::vector<int> > origEdges(m.numVertices());
-    std::vector<Point> innerPoint(m.numVertices());
-    std::vector<std::vector<int> > origFaces(m.numVertices());
-    std::vector<bool> borderVertex(m.numVertices());
-    std::vector<bool> orphanVertex(m.numVertices());
+void DooSabin::shrinkFaces(const Mesh &m, Point *points, Progress *progress, int parts) {
+    parallelFor(m.numFaces(), [&m, points, progress, parts] (size_t begin, size_t end) {
+        std::vector<float> w;
+        std::vector<Point> ps;
+        for (size_t i = begin; i < end; i++) {
+            reportProgress(progress, i - begin, parts * (end - begin));
+            shrinkFace(m, i, points + m.faceStarts()[i], w, ps);
+        }
+    }, 256);
+}
 
-    for (size_t i = 0; i < m.numFaces(); i++) {
-        PolyFace f = m.face(i);
-        for (auto it = f.begin; it + 1 != f.end; it++) {
-            origEdges[*it].push_back(*(it + 1));
-            origEdges[*(it + 1)].push_back(*it);
+void DooSabin::shrinkFaces(const Mesh &m, const std::vector<char> &selected, const std::vector<int> &firstPoint,
+        Point *points, Progress *progress, int parts)
+{
+    parallelFor(m.numFaces(), [&m, &selected, &firstPoint, points, progress, parts] (size_t begin, size_t end) {
+        std::vector<float> w;
+        std::vector<Point> ps;
+        for (size_t i = begin; i < end; i++) {
+            reportProgress(progress, i - begin, parts * (end - begin));
+            if (selected[i])
+                shrinkFace(m, i, points + firstPoint[i], w, ps);
         }
-        origEdges[*(f.end - 1)].push_back(*f.begin);
-        origEdges[*f.begin].push_back(*(f.end - 1));
-        for (auto it = f.begin; it != f.end; it++)
-            origFaces[*it].push_back(i);
-    }
+    }, 256);
+}
 
-    for (size_t i = 0; i < origEdges.size(); i++) {
-        std::vector<int> &v = origEdges[i];
-        std::sort(v.begin(), v.end());
-        v.erase(std::unique(v.begin(), v.end()), v.end());
+StencilTable DooSabin::stencils(const Mesh &m) {
+    const std::vector<offset_t> &fs = m.faceStarts();
+    const std::vector<index_t> &fv = m.faceVerts();
+    const size_t nF = m.numFaces();
 
-        std::vector<int> &w = origFaces[i];
-        std::sort(w.begin(), w.end());
-        w.erase(std::unique(w.begin(), w.end()), w.end());
+    /* Row h is the shrunk point of corner h and has as many entries as its face has corners */
+    std::vector<offset_t> start(fv.size() + 1);
+    std::vector<int> index;
+    std::vector<float> weights;
+    start[0] = 0;
+    size_t total = 0;
+    for (size_t f = 0; f < nF; f++) {
+        int n = static_cast<int>(fs[f + 1] - fs[f]);
+        for (offset_t h = fs[f]; h < fs[f + 1]; h++)
+            start[h + 1] = static_cast<offset_t>(total += n);
     }
-
-    for (size_t i = 0; i < origEdges.size(); i++) {
-        borderVertex[i] = origEdges[i].size() != origFaces[i].size();
-        orphanVertex[i] = origFaces[i].size() == 0;
-
-        if (!borderVertex[i] && !orphanVertex[i]) {
-            if (origFaces[i].size() < 3) {
-                std::cerr << "Vertex " << i << " has less than 3 faces around and is not a boundary one" << std::endl;
-                throw std::logic_error("Non-boundary vertex with less than 3 faces");
+    index.resize(total);
+    weights.resize(total);
+    parallelFor(nF, [&fs, &fv, &start, &index, &weights] (size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            offset_t h0 = fs[f];
+            int n = static_cast<int>(fs[f + 1] - h0);
+            for (int j = 0; j < n; j++) {
+                offset_t out = start[h0 + j];
+                for (int k = 0; k < n; k++, out++) {
+                    index[out] = fv[h0 + k];
+                    weights[out] = weight(n, j > k ? j - k : k - j);
+                }
             }
-            continue;
         }
-        std::cerr << "Defect at vertex " << i
-            << ", edges = " << origEdges[i].size()
-            << ", faces = " << origFaces[i].size();
-        int def = origEdges[i].size() - origFaces[i].size();
-        if (def == 1)
-            std::cout << " Looks like a face fan" << std::endl;
-        else if (def == 0)
-            std::cout << " Orphan vertex" << std::endl;
-        else {
-            std::cout << " No way to resolve" << std::endl;
-            throw std::logic_error("Unrecoverable topology error in mesh");
-        }
-    }
+    }, 256);
+    return StencilTable(start, index, weights, m.numVertices());
+}
 
-    std::vector<std::vector<NewPoint> > newVertex(m.numVertices());
-    /* Shrink old faces */
-    for (size_t i = 0; i < m.numFaces(); i++) {
-        PolyFace f = m.face(i);
-        int n = f.end - f.begin;
-        std::vector<Point> ps;
-        for (auto j = f.begin; j < f.end; j++)
-            ps.push_back(m.vert(*j));
-        std::vector<int> fv;
-        for (int j = 0; j < n; j++) {
-            Point p(0, 0, 0);
-            for (int k = 0; k < n; k++) {
-                float al = a(n, j, k);
-                p += al * ps[k];
-            }
-            int currentNewPoint = verts().size();
-            fv.push_back(currentNewPoint);
-            newVertex[*(f.begin + j)].push_back(NewPoint(currentNewPoint, i));
-            pushVertex(p);
-        }
+DooSabin::DooSabin(const Mesh &m, Progress *progress, std::vector<int> *parentFace, bool reportBorders)
+    : Mesh(m.filename() + "*")
+{
+    const Adjacency adj(m);
+    adj.checkTopology(reportBorders);
+    const HalfEdge he(m);
+
+    const size_t nV = m.numVertices();
+    const size_t nF = m.numFaces();
+    const size_t nE = he.size();
 
-        pushFace(fv);
+    /*
+     * Output sizes are known beforehand: every old face of order n gives n new
+     * points and a face, every interior vertex a face, every interior edge a quad.
+     * Exclusive prefix sums over the vertices place the faces of each stage,
+     * in 64 bits like face offsets since they count corners
+     * */
+    std::vector<offset_t> vertexFace(nV + 1);
+    std::vector<offset_t> vertexCorner(nV + 1);
+    std::vector<offset_t> edgeFace(nV + 1);
+    vertexFace[0] = vertexCorner[0] = edgeFace[0] = 0;
+    parallelFor(nV, [&adj, &he, &vertexFace, &vertexCorner, &edgeFace] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            bool face = !adj.isOrphan(i) && !adj.isBorder(i);
+            vertexFace[i + 1] = face ? 1 : 0;
+            vertexCorner[i + 1] = face ? adj.numFaces(i) : 0;
+            int quads = 0;
+            for (const int *it = he.edgesBegin(i); it != he.edgesEnd(i); it++)
+                if (he.origin(*it) == static_cast<int>(i) && !he.isBoundary(*it))
+                    quads++;
+            edgeFace[i + 1] = quads;
+        }
+    }, 1024);
+    for (size_t i = 0; i < nV; i++) {
+        vertexFace[i + 1] += vertexFace[i];
+        vertexCorner[i + 1] += vertexCorner[i];
+        edgeFace[i + 1] += edgeFace[i];
     }
 
-    /* New faces at old vertices */
-    for (size_t i = 0; i < newVertex.size(); i++) {
-        std::vector<NewPoint> &v = newVertex[i];
-        std::vector<int> vFace;
+    const size_t firstVertexFace = nF;
+    const size_t firstEdgeFace = firstVertexFace + vertexFace[nV];
+    const size_t firstVertexCorner = nE;
+    const size_t firstEdgeCorner = firstVertexCorner + vertexCorner[nV];
 
-        if (orphanVertex[i])
-            continue;
+    std::vector<Point> &verts = vertData();
+    std::vector<offset_t> &facestart = faceStartData();
+    std::vector<index_t> &facevert = faceVertData();
+    verts.resize(nE);
+    facestart.resize(firstEdgeFace + edgeFace[nV] + 1);
+    facevert.resize(firstEdgeCorner + 4 * edgeFace[nV]);
+    if (parentFace)
+        parentFace->resize(firstEdgeFace + edgeFace[nV]);
 
-        if (borderVertex[i]) {
-            size_t jstarting = v.size();
-            for (size_t j = 0; j < v.size(); j++) {
-                PolyFace pf = m.face(v[j].oldface);
-                int n = pf.end - pf.begin;
-                int k = 1;
-                for (auto it = pf.begin; it != pf.end; it++, k++)
-                    if (*it == (int)i)
-                        break;
-                k %= n;
-                int is = *(pf.begin + k);
+    /* Shrink old faces. The new point of the corner at half-edge h gets index h */
+    shrinkFaces(m, verts.data(), progress, 3);
+    const std::vector<offset_t> &fs = m.faceStarts();
+    std::copy(fs.begin(), fs.end(), facestart.begin());
+    parallelFor(nE, [&facevert] (size_t begin, size_t end) {
+        for (size_t h = begin; h < end; h++)
+            facevert[h] = static_cast<int>(h);
+    });
+    if (parentFace)
+        parallelFor(nF, [parentFace] (size_t begin, size_t end) {
+            for (size_t f = begin; f < end; f++)
+                (*parentFace)[f] = static_cast<int>(f);
+        });
 
-                bool starting = true;
+    /* New faces at old vertices, walking the fan of each one */
+    parallelFor(nV, [&m, &adj, &he, &vertexFace, &vertexCorner, &facestart, &facevert, parentFace,
+            firstVertexFace, firstVertexCorner, progress] (size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++) {
+            reportProgress(progress, end - begin + i - begin, 3 * (end - begin));
+            if (adj.isOrphan(i))
+                continue;
 
-                for (size_t k = 0; k < v.size(); k++) {
-                    if (k == j)
-                        continue;
-                    PolyFace pfs = m.face(v[k].oldface);
-                    for (auto it = pfs.begin; it != pfs.end; it++)
-                        if (*it == is)
-                            starting = false;
-                }
+            int *out = facevert.data() + firstVertexCorner + vertexCorner[i];
+            int size = 0;
+            int start = he.vertexEdge(i);
+            int h = start;
+            do {
+                if (size < adj.numFaces(i) && !adj.isBorder(i))
+                    out[size] = h;
+                size++;
+                h = he.rotate(h);
+            } while (h >= 0 && h != start);
 
-                if (starting) {
-                    jstarting = j;
-                    break;
+            if (size != adj.numFaces(i)) {
+                std::ostringstream msg;
+                msg << "Vertex " << i << std::endl;
+                for (const int *f = adj.facesBegin(i); f != adj.facesEnd(i); f++) {
+                    PolyFace pf = m.face(*f);
+                    msg << "Face " << *f << ":";
+                    for (auto x = pf.begin; x != pf.end; x++)
+                        msg << " " << *x;
+                    msg << std::endl;
                 }
+                std::cerr << msg.str();
+                throw std::logic_error("Faces do not form a fan around vertex");
             }
-            assert(jstarting != v.size());
-            if (jstarting != 0)
-                std::swap(v[0], v[jstarting]);
+            if (adj.isBorder(i))
+                continue;
+            facestart[firstVertexFace + vertexFace[i] + 1] = firstVertexCorner + vertexCorner[i + 1];
+            if (parentFace)
+                (*parentFace)[firstVertexFace + vertexFace[i]] = he.face(start);
         }
+    }, 1024);
 
-        for (size_t j = 0; j < v.size(); j++) {
-            PolyFace pf = m.face(v[j].oldface);
-            int n = pf.end - pf.begin;
-            int k = n - 1;
-            for (auto it = pf.begin; it != pf.end; it++, k++)
-                if (*it == (int)i)
-                    break;
-            k %= n;
-            int is = *(pf.begin + k);
-            size_t jnext = 0;
-            for (size_t js = j + 1; js < v.size(); js++) {
-                PolyFace pfs = m.face(v[js].oldface);
-                bool found = false;
-                for (auto it = pfs.begin; !found && it != pfs.end; it++)
-                    if (*it == is)
-                        found = true;
-                if (found) {
-                    jnext = js;
-                    break;
-                }
+    /* Faces at old edges, one for every edge with a face on both sides */
+    parallelFor(nV, [&he, &edgeFace, &facestart, &facevert, parentFace, firstEdgeFace, firstEdgeCorner, progress]
+            (size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++) {
+            reportProgress(progress, 2 * (end - begin) + i - begin, 3 * (end - begin));
+            offset_t q = edgeFace[i];
+            for (const int *it = he.edgesBegin(i); it != he.edgesEnd(i); it++) {
+                int h = *it;
+                if (he.origin(h) != static_cast<int>(i) || he.isBoundary(h))
+                    continue;
+                int t = he.twin(h);
+                int *quad = facevert.data() + firstEdgeCorner + 4 * q;
+                quad[0] = h;
+                quad[1] = he.next(t);
+                quad[2] = t;
+                quad[3] = he.next(h);
+                if (parentFace)
+                    (*parentFace)[firstEdgeFace + q] = he.face(h);
+                q++;
+                facestart[firstEdgeFace + q] = firstEdgeCorner + 4 * q;
             }
-            if (j + 1 != v.size()) {
-                if (jnext == 0) {
-                    std::cerr << "Vertex " << i << std::endl;
-                    for (size_t z = 0; z < v.size(); z++) {
-                        PolyFace pf = m.face(v[z].oldface);
-                        std::cout << "Face " << v[z].oldface << ":";
-                        for (auto x = pf.begin; x != pf.end; x++)
-                            std::cout << " " << *x;
-                        std::cout << std::endl;
-                    }
-                    throw std::logic_error("Faces do not form a fan around vertex");
-                }
-                if (jnext != j + 1)
-                    std::swap(v[jnext], v[j + 1]);
-            }
-            vFace.push_back(v[j].vertex);
         }
-        assert(!vFace.empty());
-        if (!borderVertex[i])
-            pushFace(vFace);
-    }
+    }, 1024);
 
-    /* Faces at old edges */
-    for (size_t i = 0; i < origEdges.size(); i++) {
-        for (auto it = origEdges[i].begin(); it != origEdges[i].end(); it++) {
-            size_t j = *it;
-            if (j < i)
-                continue;
-            std::vector<NewPoint> cloud1 = newVertex[i];
-            std::vector<NewPoint> cloud2 = newVertex[j];
-            cloud1.push_back(cloud1.front());
-            cloud2.push_back(cloud2.front());
-            std::reverse(cloud2.begin(), cloud2.end());
-/*
-            std::cout << i << " -> " << j << std::endl;
-            for (auto &z : cloud1)
-                std::cout << z.vertex << "," << z.oldface << " ";
-            std::cout << std::endl;
-            for (auto &z : cloud2)
-                std::cout << z.vertex << "," << z.oldface << " ";
-            std::cout << std::endl;
-*/
-            bool found = false;
-            size_t ii, jj;
-            if (cloud1.size() < 3 || cloud2.size() < 3)
-                continue;
-            for (size_t i1 = 0; !found && i1 < cloud1.size() - 1; i1++)
-                for (size_t i2 = 0; !found && i2 < cloud2.size() - 1; i2++)
-                    if ((cloud1[i1    ].oldface == cloud2[i2    ].oldface) &&
-                        (cloud1[i1 + 1].oldface == cloud2[i2 + 1].oldface))
-                    {
-                        ii = i1;
-                        jj = i2;
-                        found = true;
-                    }
-            if (found) {
-                std::vector<int> quad;
-                quad.push_back(cloud1[ii + 1].vertex);
-                quad.push_back(cloud1[ii    ].vertex);
-                quad.push_back(cloud2[jj    ].vertex);
-                quad.push_back(cloud2[jj + 1].vertex);
-                pushFace(quad);
-            }
-        }
-    }
+    updateSum();
 }
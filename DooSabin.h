@@ -5,19 +5,34 @@
 #
 
 #include "Mesh.h"
+#include "StencilTable.h"
 
 /*
  * Based on https://www.rose-hulman.edu/~finn/CCLI/Notes/day37.pdf
  * */
 
 class DooSabin: public Mesh {
-    static int maxFaceOrder();
-    static std::vector<int> initOffsetTable();
-    static std::vector<float> initCosTable();
-
-    static float a(int n, int i, int j);
 public:
-    DooSabin(const Mesh &m);
+    /*
+     * parentFace, when given, receives for every new face the face of m it
+     * comes from: the shrunk face itself, the first face of a vertex fan,
+     * the face left of an edge. reportBorders = false keeps quiet about open
+     * borders, for pieces cut out of a bigger mesh
+     * */
+    DooSabin(const Mesh &m, Progress *progress = 0, std::vector<int> *parentFace = 0, bool reportBorders = true);
+
+    /*
+     * Shrinks every face of m towards its centroid. Point of the corner at
+     * faceVerts()[h] goes to points[h]. Progress covers the first 1/parts of the bar
+     * */
+    static void shrinkFaces(const Mesh &m, Point *points, Progress *progress = 0, int parts = 1);
+
+    /* Shrinks only the selected faces, the points of face f go to points + firstPoint[f] */
+    static void shrinkFaces(const Mesh &m, const std::vector<char> &selected, const std::vector<int> &firstPoint,
+            Point *points, Progress *progress = 0, int parts = 1);
+
+    /* Same step as a linear map from the vertices of m to the points of shrinkFaces() */
+    static StencilTable stencils(const Mesh &m);
 };
 
 #endif
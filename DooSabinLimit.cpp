@@ -0,0 +1,251 @@
+#include "DooSabinLimit.h"
+#include "DooSabin.h"
+#include "Adjacency.h"
+#include "HalfEdge.h"
+#include "Progress.h"
+#include "Parallel.h"
+
+#include <stdexcept>
+#include <limits>
+
+namespace {
+
+/* Uniform quadratic B-spline segment and its derivative at t in [0, 1] */
+void basis(float t, float b[3], float db[3]) {
+    b[0] = 0.5f * (1 - t) * (1 - t);
+    b[1] = 0.5f + t * (1 - t);
+    b[2] = 0.5f * t * t;
+    db[0] = t - 1;
+    db[1] = 1 - 2 * t;
+    db[2] = t;
+}
+
+Point cross(const Point &a, const Point &b) {
+    return Point(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+/* Diagonal point d of a virtual quad (c, e1, d, e2) whose average is center */
+Point diagonal(const Point &center, const Point &c, const Point &e1, const Point &e2) {
+    Point d(4 * center.x, 4 * center.y, 4 * center.z);
+    d -= c;
+    d -= e1;
+    d -= e2;
+    return d;
+}
+
+/* Reflection of b through a */
+Point mirror(const Point &a, const Point &b) {
+    return Point(2 * a.x - b.x, 2 * a.y - b.y, 2 * a.z - b.z);
+}
+
+/*
+ * Grid points used by the quadrants in mask, numbered in row order, -1 for
+ * the others. Quadrant bit is (u half) + 2 * (w half). Returns the count
+ * */
+int quadrantGrid(int mask, int half, std::vector<int> &local) {
+    const int row = 2 * half + 1;
+    local.assign(row * row, -1);
+    int count = 0;
+    for (int iu = 0; iu < row; iu++)
+        for (int iw = 0; iw < row; iw++) {
+            bool used = false;
+            for (int q = 0; q < 4; q++)
+                if (mask & 1 << q) {
+                    int u0 = (q & 1) * half;
+                    int w0 = (q >> 1) * half;
+                    used = used || (iu >= u0 && iu <= u0 + half && iw >= w0 && iw <= w0 + half);
+                }
+            if (used)
+                local[iu * row + iw] = count++;
+        }
+    return count;
+}
+
+int numQuadrants(int mask) {
+    return (mask & 1) + (mask >> 1 & 1) + (mask >> 2 & 1) + (mask >> 3 & 1);
+}
+
+}
+
+DooSabinLimit::DooSabinLimit(const Mesh &m, int density, Progress *progress) {
+    if (density < 1)
+        throw std::invalid_argument("Tessellation density should be positive");
+
+    const Adjacency adj(m);
+    adj.checkTopology();
+    const HalfEdge he(m);
+
+    const size_t nV = m.numVertices();
+    const size_t nF = m.numFaces();
+    const size_t nE = he.size();
+    const std::vector<offset_t> &fs = m.faceStarts();
+
+    /* One Doo-Sabin step, point of corner h is s[h] */
+    std::vector<Point> s(nE);
+    DooSabin::shrinkFaces(m, s.data(), progress, 2);
+
+    /*
+     * Centroids of the shrunk faces and of the faces at old vertices. A
+     * border vertex has no such face, its virtual one also takes the
+     * ghost points beyond the two boundary edges of the fan
+     * */
+    std::vector<Point> faceCenter(nF);
+    parallelFor(nF, [&fs, &s, &faceCenter] (size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            Point c(0, 0, 0);
+            for (offset_t h = fs[f]; h < fs[f + 1]; h++)
+                c += s[h];
+            faceCenter[f] = (1.f / (fs[f + 1] - fs[f])) * c;
+        }
+    }, 1024);
+    std::vector<Point> vertexCenter(nV);
+    parallelFor(nV, [&adj, &he, &s, &vertexCenter] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            if (adj.isOrphan(v))
+                continue;
+            Point c(0, 0, 0);
+            int count = 0;
+            int start = he.vertexEdge(v);
+            int last = start;
+            int h = start;
+            do {
+                c += s[h];
+                count++;
+                last = h;
+                h = he.rotate(h);
+            } while (h >= 0 && h != start);
+            if ((h < 0) != adj.isBorder(v) || count != adj.numFaces(v))
+                throw std::logic_error("Faces do not form a fan around vertex");
+            if (h < 0) {
+                c += mirror(s[start], s[he.prev(start)]);
+                c += mirror(s[last], s[he.next(last)]);
+                count += 2;
+            }
+            vertexCenter[v] = (1.f / count) * c;
+        }
+    }, 1024);
+
+    /*
+     * Every corner gets a patch. Its quadrants lie on the faces of the
+     * refined mesh around the corner point, those over missing faces are
+     * left out. Prefix sums over faces place the patches
+     * */
+    const int half = (density + 1) / 2;
+    const int row = 2 * half + 1;
+    std::vector<int> grid[16];
+    int gridVerts[16];
+    for (int mask = 0; mask < 16; mask++)
+        gridVerts[mask] = quadrantGrid(mask, half, grid[mask]);
+    auto quadrants = [&he] (int h, bool border) {
+        if (!border)
+            return 15;
+        return 2 | (he.isBoundary(he.prev(h)) ? 0 : 1) | (he.isBoundary(h) ? 0 : 8);
+    };
+    std::vector<offset_t> vertStart(nF + 1), faceStart(nF + 1);
+    vertStart[0] = faceStart[0] = 0;
+    for (size_t f = 0; f < nF; f++) {
+        offset_t verts = 0, faces = 0;
+        for (offset_t h = fs[f]; h < fs[f + 1]; h++) {
+            int mask = quadrants(static_cast<int>(h), adj.isBorder(he.origin(h)));
+            verts += gridVerts[mask];
+            faces += numQuadrants(mask) * 2 * half * half;
+        }
+        vertStart[f + 1] = vertStart[f] + verts;
+        faceStart[f + 1] = faceStart[f] + faces;
+    }
+
+    const size_t numVerts = vertStart[nF];
+    if (numVerts > static_cast<size_t>(std::numeric_limits<int>::max()))
+        throw std::range_error("Too many vertices");
+    std::vector<Point> &verts = vertData();
+    std::vector<Face> &faces = faceData();
+    verts.resize(2 * numVerts);
+    faces.resize(faceStart[nF]);
+
+    std::vector<float> b(3 * row);
+    std::vector<float> db(3 * row);
+    for (int i = 0; i < row; i++)
+        basis(static_cast<float>(i) / (2 * half), &b[3 * i], &db[3 * i]);
+
+    parallelFor(nF, [&] (size_t begin, size_t end) {
+        Point net[3][3];
+        for (size_t f = begin; f < end; f++) {
+            reportProgress(progress, end - begin + f - begin, 2 * (end - begin));
+            size_t base = vertStart[f];
+            Face *out = faces.data() + faceStart[f];
+            for (offset_t h = fs[f]; h < fs[f + 1]; h++) {
+                int v = he.origin(h);
+                /*
+                 * Net around s[h]. First index runs across the old face
+                 * towards the next corner, second one from the old face
+                 * across its edge h. Edge quads give real diagonals. Across
+                 * a boundary edge the rows of the face are mirrored, the
+                 * same ghost points for both patches along the edge, so the
+                 * surface ends on the quadratic B-spline of the border points
+                 * */
+                int p = he.prev(h);
+                int n = he.next(h);
+                net[1][1] = s[h];
+                net[2][1] = s[n];
+                net[1][0] = s[p];
+                if (he.isBoundary(p)) {
+                    net[0][1] = mirror(s[h], s[n]);
+                    net[0][0] = mirror(s[p], s[he.prev(p)]);
+                } else {
+                    net[0][1] = s[he.twin(p)];
+                    net[0][0] = s[he.next(he.twin(p))];
+                }
+                if (he.isBoundary(h)) {
+                    net[1][2] = mirror(s[h], s[p]);
+                    net[2][2] = mirror(s[n], s[he.next(n)]);
+                } else {
+                    net[1][2] = s[he.next(he.twin(h))];
+                    net[2][2] = s[he.twin(h)];
+                }
+                net[2][0] = diagonal(faceCenter[f], net[1][1], net[2][1], net[1][0]);
+                net[0][2] = diagonal(vertexCenter[v], net[1][1], net[0][1], net[1][2]);
+
+                const int mask = quadrants(static_cast<int>(h), adj.isBorder(v));
+                const int *local = grid[mask].data();
+                for (int iu = 0; iu < row; iu++)
+                    for (int iw = 0; iw < row; iw++) {
+                        if (local[iu * row + iw] < 0)
+                            continue;
+                        const float *bu = &b[3 * iu];
+                        const float *bw = &b[3 * iw];
+                        const float *dbu = &db[3 * iu];
+                        const float *dbw = &db[3 * iw];
+                        Point pos(0, 0, 0), du(0, 0, 0), dw(0, 0, 0);
+                        for (int i = 0; i < 3; i++)
+                            for (int j = 0; j < 3; j++) {
+                                pos += (bu[i] * bw[j]) * net[i][j];
+                                du += (dbu[i] * bw[j]) * net[i][j];
+                                dw += (bu[i] * dbw[j]) * net[i][j];
+                            }
+                        /* u runs along edge h with the old face on its left, so w x u points outwards */
+                        Point normal = cross(dw, du);
+                        normal.normalize();
+                        verts[base + local[iu * row + iw]] = pos;
+                        verts[numVerts + base + local[iu * row + iw]] = normal;
+                    }
+
+                for (int q = 0; q < 4; q++) {
+                    if (!(mask & 1 << q))
+                        continue;
+                    int u0 = (q & 1) * half;
+                    int w0 = (q >> 1) * half;
+                    for (int iu = u0; iu < u0 + half; iu++)
+                        for (int iw = w0; iw < w0 + half; iw++) {
+                            int q00 = static_cast<int>(base) + local[iu * row + iw];
+                            int q01 = static_cast<int>(base) + local[iu * row + iw + 1];
+                            int q10 = static_cast<int>(base) + local[(iu + 1) * row + iw];
+                            int q11 = static_cast<int>(base) + local[(iu + 1) * row + iw + 1];
+                            *out++ = Face(q00, q01, q11);
+                            *out++ = Face(q00, q11, q10);
+                        }
+                }
+                base += gridVerts[mask];
+            }
+        }
+    }, 256);
+}
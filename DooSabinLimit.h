@@ -0,0 +1,31 @@
+#ifndef __DOOSABINLIMIT_H__
+#define __DOOSABINLIMIT_H__
+
+#include "Mesh.h"
+
+/*
+ * Tessellated limit surface of Doo-Sabin subdivision.
+ *
+ * After one Doo-Sabin step every interior point has four faces around it
+ * and the limit surface is a biquadratic B-spline patch per point, i.e. per
+ * corner of the original mesh. Each patch is sampled on a (density + 1)^2
+ * grid with exact limit positions and normals, no further levels are built.
+ * Odd densities are rounded up so that every patch splits at its midlines.
+ *
+ * Around faces that are not quads the 3x3 control net has no diagonal point.
+ * One is synthesized so that the patch corner lands on the face centroid,
+ * which is the limit point of such a face. Neighbouring patches then share
+ * boundary curves, the surface has no cracks but is only C0 there.
+ *
+ * Points on the boundary of the refined mesh are missing neighbours. Their
+ * nets take ghost points mirrored across the boundary edges, and only the
+ * quarters of their patches over existing faces are emitted. The surface
+ * then ends on the quadratic B-spline through the boundary points
+ * */
+
+class DooSabinLimit: public TriMesh {
+public:
+    DooSabinLimit(const Mesh &m, int density, Progress *progress = 0);
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "DooSabinStencil.h"
+#include "DooSabin.h"
+#include "Progress.h"
+
+#include <memory>
+#include <stdexcept>
+
+DooSabinStencil::DooSabinStencil(const Mesh &control, int levels, Progress *progress)
+    : Mesh(control.filename() + std::string(levels > 0 ? levels : 0, '*'))
+{
+    if (levels < 1)
+        throw std::invalid_argument("At least one level should be recorded");
+
+    /* Stencils are composed level by level, the refined topology comes from DooSabin itself */
+    std::unique_ptr<Mesh> refined;
+    const Mesh *prev = &control;
+    for (int l = 0; l < levels; l++) {
+        if (progress)
+            progress->update(static_cast<float>(l) / levels);
+        StencilTable step = DooSabin::stencils(*prev);
+        _table = l == 0 ? step : StencilTable(step, _table);
+        refined.reset(new DooSabin(*prev));
+        prev = refined.get();
+    }
+
+    faceStartData() = prev->faceStarts();
+    faceVertData() = prev->faceVerts();
+    vertData().resize(_table.numStencils());
+    refined.reset();
+    update(control.verts());
+}
+
+void DooSabinStencil::update(const std::vector<Point> &control) {
+    if (control.size() != _table.numControl())
+        throw std::invalid_argument("Control points do not match the recorded mesh");
+    _table.apply(control.data(), vertData().data());
+    updateSum();
+}
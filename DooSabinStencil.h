@@ -0,0 +1,25 @@
+#ifndef __DOOSABINSTENCIL_H__
+#define __DOOSABINSTENCIL_H__
+
+#include "Mesh.h"
+#include "StencilTable.h"
+
+#include <vector>
+
+/*
+ * Several Doo-Sabin levels recorded once for a fixed control topology.
+ * Every refined vertex is a weighted sum of control vertices, so moving the
+ * control points only takes one sparse matrix-vector product in update()
+ * */
+
+class DooSabinStencil: public Mesh {
+    StencilTable _table;
+public:
+    DooSabinStencil(const Mesh &control, int levels, Progress *progress = 0);
+
+    /* Re-evaluates the refined vertices, control must match the recorded mesh */
+    void update(const std::vector<Point> &control);
+    const StencilTable &stencils() const { return _table; }
+};
+
+#endif
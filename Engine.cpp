@@ -3,8 +3,17 @@
 #include "Matrix.h"
 
 #include "Mesh.h"
-#include "Box.h"
-#include "DooSabin.h"
+#include "AABBTree.h"
+#include "RayQuery.h"
+#include "Culling.h"
+#include "HiZBuffer.h"
+#include "VertexFormat.h"
+#include "Meshlets.h"
+#include "MeshCache.h"
+#include "Progress.h"
+#include "Subdivision.h"
+#include "DooSabinLimit.h"
+#include "AdaptiveDooSabin.h"
 
 #include "tinyfiledialogs.h"
 
@@ -12,6 +21,7 @@
 #include <memory>
 #include <cstdlib>
 #include <cstdio>
+#include <cstddef>
 
 #ifdef __FREEGLUT_STD_H__
 # include <GL/freeglut_ext.h>
@@ -36,9 +46,33 @@ void Engine::keyboard(unsigned char key, int x, int y) {
         case 'R':
             refine();
             break;
+        case 'a':
+        case 'A':
+            refineVisible();
+            break;
+        case 'm':
+        case 'M':
+            scheme = static_cast<SubdivisionScheme>((scheme + 1) % NUM_SCHEMES);
+            break;
+        case 'e':
+        case 'E':
+            showLimit();
+            break;
+        case '[':
+            if (limitDensity > 1)
+                limitDensity--;
+            break;
+        case ']':
+            if (limitDensity < 64)
+                limitDensity++;
+            break;
         case 's':
         case 'S':
-            saveMesh();
+            saveMesh(false);
+            break;
+        case 'b':
+        case 'B':
+            saveMesh(true);
             break;
         case 'n':
         case 'N':
@@ -58,10 +92,26 @@ void Engine::keyboard(unsigned char key, int x, int y) {
         case 'C':
             cull = !cull;
             break;
+        case 'o':
+        case 'O':
+            occlusion = !occlusion;
+            break;
+        case 'p':
+        case 'P':
+            vertexLayout = vertexLayout == VertexFormat::PACKED ? VertexFormat::FLOAT : VertexFormat::PACKED;
+            if (!rebuildBuffers())
+                vertexLayout = vertexLayout == VertexFormat::PACKED ? VertexFormat::FLOAT : VertexFormat::PACKED;
+            break;
+        case 'v':
+        case 'V':
+            vertexCache = !vertexCache;
+            if (!rebuildBuffers())
+                vertexCache = !vertexCache;
+            break;
         case '+':
             level++;
-            if (level >= maxLevels)
-                level = maxLevels - 1;
+            if (tree && level >= tree->depth())
+                level = tree->depth() - 1;
             break;
         case '-':
             level--;
@@ -82,6 +132,10 @@ void Engine::keyboard(unsigned char key, int x, int y) {
         case 'L':
             loadMesh();
             break;
+        case 'x':
+        case 'X':
+            cancelJob();
+            break;
     }
 }
 
@@ -101,6 +155,8 @@ void Engine::click(int button, int state, int x, int y) {
             starty = y;
         }
     }
+    if (button == RIGHT_MOUSE_BUTTON && state == GLUT_DOWN)
+        pick(x, y);
     /* Whell generates a pair of UP & DOWN events, ignore DOWN */
     if (button == WHEEL_UP && state == GLUT_UP)
         zoom(1);
@@ -108,6 +164,35 @@ void Engine::click(int button, int state, int x, int y) {
         zoom(-1);
 }
 
+void Engine::pick(int x, int y) {
+    pickedTriangle = pickedVertex = -1;
+    if (!m)
+        return;
+    if (!rays)
+        rays.reset(new RayQuery(*m, *tree, mesh->center()));
+
+    /* The segment between the near and far planes under the cursor, in the centered model space of drawModel() */
+    Matrix unproject(getViewMatrix());
+    unproject.multWithLeft(getProjectionMatrix());
+    unproject.inverse();
+    float ndcx = 2.f * x / viewWidth - 1;
+    float ndcy = 1 - 2.f * y / viewHeight;
+    float n[4], f[4];
+    unproject.transform(Point(ndcx, ndcy, -1), n);
+    unproject.transform(Point(ndcx, ndcy, 1), f);
+    Point from(n[0] / n[3], n[1] / n[3], n[2] / n[3]);
+    Point to(f[0] / f[3], f[1] / f[3], f[2] / f[3]);
+    RayHit hit = rays->closest(Ray(from, Point(to, from), 1));
+    if (hit.triangle < 0)
+        return;
+
+    /* Corner with the largest barycentric weight */
+    const Face &t = m->faces()[hit.triangle];
+    float w = 1 - hit.u - hit.v;
+    pickedTriangle = hit.triangle;
+    pickedVertex = w >= hit.u && w >= hit.v ? t.v1 : (hit.u >= hit.v ? t.v2 : t.v3);
+}
+
 void Engine::motion(int x, int y) {
     if (buttonPressed) {
         dragging(x - startx, y - starty);
@@ -156,7 +241,19 @@ Engine::Engine() : rotMatrix(IdentityMatrix()) {
     wireframe = false;
     shading = GOURAUD;
     specularity = 0.3;
-    maxLevels = 15;
+    limitDensity = 4;
+    scheme = DOO_SABIN;
+    trianglesOfMesh = true;
+    pickedTriangle = pickedVertex = -1;
+    drawnTriangles = 0;
+    backFacingTriangles = 0;
+    occlusion = true;
+    occludedTriangles = 0;
+    vertexLayout = VertexFormat::PACKED;
+    vertexCache = true;
+    vertexBytes = indexBytes = 0;
+    indexType = GL_UNSIGNED_INT;
+    indexSize = sizeof(GLuint);
 
     viewWidth = viewHeight = 1;
 
@@ -170,74 +267,157 @@ Engine::Engine() : rotMatrix(IdentityMatrix()) {
     glGenBuffers(1, &treeIbo);
 }
 
-void Engine::refine() {
-    try {
-        mesh = std::move(std::unique_ptr<DooSabin>(new DooSabin(*mesh)));
-        m = std::move(std::unique_ptr<TriMesh>(new TriMesh(*mesh)));
-    } catch (std::exception &e) {
-        std::cerr << "Refine mesh failed: " << e.what() << std::endl;
-        return;
+bool Engine::startJob(const std::string &name, const MeshWorker::Job &job) {
+    if (worker) {
+        std::cerr << "Still busy with " << worker->name() << ", press X to cancel" << std::endl;
+        return false;
     }
-    buildTree();
+    /* Jobs that leave the triangles alone get buffers for the shown ones, which stay until the job is done */
+    const Mesh *current = mesh.get();
+    const TriMesh *shown = m.get();
+    const AABBTree *shownTree = tree.get();
+    VertexFormat::Layout layout = vertexLayout;
+    bool reorder = vertexCache;
+    worker.reset(new MeshWorker(name, [job, current, shown, shownTree, layout, reorder] (Progress &progress, MeshWorker::Result &r) {
+        job(progress, r);
+        const Mesh &centered = r.mesh ? *r.mesh : *current;
+        MeshWorker::prepareBuffers(r, r.tri ? *r.tri : *shown, r.tri ? *r.tree : *shownTree, centered.center(),
+            layout, reorder, progress);
+    }));
+    return true;
 }
 
-void Engine::buildTree() {
-    const std::vector<Point> &vertexData = m->vertsWithNormals();
-    const std::vector<Face> &faceData = m->faces();
-
-    int numVertices = vertexData.size() / 2;
+void Engine::pollWorker() {
+    if (!worker || !worker->done())
+        return;
+    std::unique_ptr<MeshWorker> done(std::move(worker));
+    if (!done->error().empty()) {
+        std::cerr << done->name() << " failed: " << done->error() << std::endl;
+        return;
+    }
+    /* Swap the new mesh in at once, the old one was rendered until now */
+    MeshWorker::Result &r = done->result();
+    if (r.tri) {
+        /* Limit surface jobs only replace the displayed triangles, not the control mesh */
+        trianglesOfMesh = static_cast<bool>(r.mesh);
+        if (r.mesh)
+            mesh = std::move(r.mesh);
+        rays.reset();
+        pickedTriangle = pickedVertex = -1;
+        m = std::move(r.tri);
+        tree = std::move(r.tree);
+    }
+    uploadBuffers(r);
+}
 
-    std::vector<std::vector<Face> > faceTree((1 << maxLevels) - 1);
+void Engine::cancelJob() {
+    if (worker)
+        worker->cancel();
+}
 
-    faceTree[0] = faceData;
+bool Engine::rebuildBuffers() {
+    if (!m)
+        return true;
+    return startJob("Draw buffers", [] (Progress &, MeshWorker::Result &) { });
+}
 
-    std::vector<AABB> tree(faceTree.size());
-    Point center = mesh->center();
+void Engine::refine() {
+    if (!mesh)
+        return;
+    /* The current mesh stays untouched until the worker is done */
+    const Mesh &current = *mesh;
+    SubdivisionScheme chosen = scheme;
+    startJob("Refine mesh", [&current, chosen] (Progress &progress, MeshWorker::Result &r) {
+        progress.stage(schemeName(chosen));
+        r.mesh.reset(subdivide(current, chosen, &progress));
+        progress.stage("Triangulation");
+        r.tri.reset(new TriMesh(*r.mesh, &progress));
+        progress.stage("Tree");
+        /* Refined meshes are not cached, their trees favour build time over quality */
+        r.tree.reset(new AABBTree(*r.tri, r.mesh->center(), &progress, AABBTree::LBVH));
+    });
+}
 
-    for (size_t i = 0; i < faceTree.size(); i++) {
-        AABB box;
-        for (auto f = faceTree[i].begin(); f != faceTree[i].end(); f++) {
-            box.add(Point(vertexData[f->v1], center));
-            box.add(Point(vertexData[f->v2], center));
-            box.add(Point(vertexData[f->v3], center));
-        }
+void Engine::refineVisible() {
+    if (!mesh)
+        return;
+    /* Same transform as drawModel(), faces are measured on the current viewport */
+    Matrix mvp((Translate(-mesh->center())));
+    mvp.multWithLeft(getViewMatrix());
+    mvp.multWithLeft(getProjectionMatrix());
+    float width = viewWidth;
+    float height = viewHeight;
+    const Mesh &current = *mesh;
+    startJob("Adaptive refine", [&current, mvp, width, height] (Progress &progress, MeshWorker::Result &r) {
+        progress.stage("Selecting faces");
+        std::vector<char> selected = AdaptiveDooSabin::selectLarge(current, mvp, width, height, 16);
+        progress.stage("Adaptive Doo-Sabin");
+        r.mesh.reset(new AdaptiveDooSabin(current, selected, &progress));
+        progress.stage("Triangulation");
+        r.tri.reset(new TriMesh(*r.mesh, &progress));
+        progress.stage("Tree");
+        r.tree.reset(new AABBTree(*r.tri, r.mesh->center(), &progress, AABBTree::LBVH));
+    });
+}
 
-        tree[i] = box;
+void Engine::showLimit() {
+    if (!mesh)
+        return;
+    const Mesh &current = *mesh;
+    int density = limitDensity;
+    startJob("Limit surface", [&current, density] (Progress &progress, MeshWorker::Result &r) {
+        progress.stage("Doo-Sabin limit");
+        r.tri.reset(new DooSabinLimit(current, density, &progress));
+        progress.stage("Tree");
+        r.tree.reset(new AABBTree(*r.tri, current.center(), &progress, AABBTree::LBVH));
+    });
+}
 
-        size_t ileft = 2 * i + 1;
-        size_t iright = 2 * i + 2;
+Engine::~Engine() {
+}
 
-        if (ileft >= faceTree.size())
-            continue;
-        for (auto f = faceTree[i].begin(); f != faceTree[i].end(); f++) {
-            if (box.hasOnLeft (*f, vertexData, center))
-                faceTree[ileft ].push_back(*f);
-            if (box.hasOnRight(*f, vertexData, center))
-                faceTree[iright].push_back(*f);
-        }
-    }
+void Engine::uploadBuffers(MeshWorker::Result &r) {
+    radius = tree->radius();
+    if (level >= tree->depth())
+        level = tree->depth() - 1;
 
-    radius = tree[0].radius();
+    ranges = std::move(r.ranges);
+    meshlets = std::move(r.meshlets);
+    positionOffset = r.positionOffset;
+    positionScale = r.positionScale;
+    vertexBytes = r.vertices.size();
+    indexBytes = r.indices.size();
+    indexSize = r.indexSize;
+    indexType = indexSize == sizeof(GLushort) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
 
     glBindVertexArray(modelVao);
     glBindBuffer(GL_ARRAY_BUFFER, modelVbo);
-    glBufferData(GL_ARRAY_BUFFER, 3 * vertexData.size() * sizeof(float), vertexData.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, r.vertices.size(), r.vertices.data(), GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, modelIbo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * faceData.size() * sizeof(GLuint), faceData.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, r.indices.size(), r.indices.data(), GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(0, /*sz*/3, GL_FLOAT, /*normalize*/GL_FALSE, /*stride*/0, /*offset*/0);
-    glVertexAttribPointer(1, /*sz*/3, GL_FLOAT, /*normalize*/GL_FALSE, /*stride*/0, /*offset*/(GLvoid *)(numVertices * 3 * sizeof(float)));
+    GLsizei stride = VertexFormat::stride(r.layout);
+    if (r.layout == VertexFormat::PACKED) {
+        glVertexAttribPointer(0, /*sz*/3, GL_UNSIGNED_SHORT, /*normalize*/GL_TRUE, stride, /*offset*/0);
+        glVertexAttribPointer(1, /*sz*/4, GL_INT_2_10_10_10_REV, /*normalize*/GL_TRUE, stride,
+            /*offset*/(GLvoid *)offsetof(VertexFormat::Packed, normal));
+    } else {
+        glVertexAttribPointer(0, /*sz*/3, GL_FLOAT, /*normalize*/GL_FALSE, stride, /*offset*/0);
+        glVertexAttribPointer(1, /*sz*/3, GL_FLOAT, /*normalize*/GL_FALSE, stride,
+            /*offset*/(GLvoid *)offsetof(VertexFormat::Float, normal));
+    }
 
     glBindVertexArray(wireVao);
-    std::vector<float> boxData(8 * 3 * tree.size());
+    const std::vector<AABBTree::Node> &nodes = tree->nodes();
+    std::vector<float> boxData(8 * 3 * nodes.size());
     std::vector<GLuint> treeIdx;
     GLuint boxIdx[4 * 6] = {
         0, 1, 2, 3, 0, 3, 1, 2,
         7, 6, 5, 4, 4, 7, 5, 6,
         1, 5, 0, 4, 3, 7, 2, 6};
-    for (size_t i = 0; i < tree.size(); i++) {
-        tree[i].writeVertex(&boxData[8 * 3 * i]);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i].box.writeVertex(&boxData[8 * 3 * i]);
         treeIdx.insert(treeIdx.end(), boxIdx, boxIdx + 4 * 6);
         for (int j = 0; j < 4 * 6; j++)
             boxIdx[j] += 8;
@@ -258,12 +438,15 @@ void Engine::buildTree() {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void Engine::saveMesh() {
+void Engine::saveMesh(bool binary) {
     const char *filters[] = {"*.ply", "*.PLY"};
     const char *fn = tinyfd_saveFileDialog("Save PLY file", "", 2, filters);
 
+    if (!fn || !mesh)
+        return;
+
     try {
-        mesh->save(fn);
+        mesh->save(fn, binary);
     } catch (std::exception &e) {
         std::cout << "Exception while saving mesh: " << e.what() << std::endl;
     }
@@ -276,15 +459,24 @@ void Engine::loadMesh() {
     if (!fn)
         return;
 
-    try {
-        mesh = std::move(std::unique_ptr<PLYMesh>(new PLYMesh(fn)));
-        m = std::move(std::unique_ptr<TriMesh>(new TriMesh(*mesh)));
-    } catch (std::exception &e) {
-        std::cerr << "Loading mesh failed: " << e.what() << std::endl;
-        return;
-    }
-
-    buildTree();
+    std::string filename(fn);
+    startJob("Loading mesh", [filename] (Progress &progress, MeshWorker::Result &r) {
+        progress.stage("Hashing");
+        uint64_t size;
+        uint64_t hash = MeshCache::hashFile(filename, size);
+        if (MeshCache::load(filename, hash, size, r.mesh, r.tri, r.tree)) {
+            std::cout << "Using cached mesh for `" << filename << "'" << std::endl;
+            return;
+        }
+        progress.stage("Parsing");
+        r.mesh.reset(new PLYMesh(filename, &progress));
+        progress.stage("Triangulation");
+        r.tri.reset(new TriMesh(*r.mesh, &progress));
+        progress.stage("Tree");
+        r.tree.reset(new AABBTree(*r.tri, r.mesh->center(), &progress));
+        progress.stage("Writing cache");
+        MeshCache::store(filename, hash, size, *r.mesh, *r.tri, *r.tree);
+    });
 }
 
 Matrix Engine::getViewMatrix() {
@@ -298,6 +490,10 @@ Matrix Engine::getViewMatrix() {
     return tmpMatrix;
 }
 
+Matrix Engine::getProjectionMatrix() {
+    return Renderer::perspective(static_cast<float>(viewWidth) / viewHeight);
+}
+
 void Engine::drawModel(Renderer &r) {
     r.useModelShader();
     r.setPerspective();
@@ -312,6 +508,7 @@ void Engine::drawModel(Renderer &r) {
     r.setColor(.8f, .75f, .5f, 1.f);
     r.setLightIntens(.9f);
     r.setModelMatrix(mm);
+    r.setPositionDecoding(positionOffset, positionScale);
 
     if (wireframe)
         glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -327,7 +524,33 @@ void Engine::drawModel(Renderer &r) {
     r.shadePhong(shading == PHONG);
     r.setSpecularity(specularity);
 
-    glDrawElements(GL_TRIANGLES, m->faces().size() * 3, GL_UNSIGNED_INT, 0);
+    /* Tree boxes are already centered */
+    Matrix mvp(getViewMatrix());
+    mvp.multWithLeft(getProjectionMatrix());
+    Frustum frustum(mvp);
+    Matrix toModel(getViewMatrix());
+    toModel.inverse();
+    float e[4];
+    toModel.transform(Point(0, 0, 0), e);
+    const Point eye(e[0] / e[3], e[1] / e[3], e[2] / e[3]);
+    if (occlusion) {
+        /* Occluders are the triangles nearest to the eye, found in the centered space of the tree */
+        const size_t occluderBudget = 16384;
+        if (!hiz)
+            hiz.reset(new HiZBuffer(256, 128));
+        hiz->clear(mvp);
+        hiz->render(*m, mesh->center(), HiZBuffer::occluders(*tree, frustum, eye, occluderBudget));
+    }
+    ranges->cull(frustum, visibleFirst, visibleCount, occlusion ? hiz.get() : 0, &occludedTriangles);
+    drawnTriangles = meshlets->cull(frustum, eye, cull, visibleFirst, visibleCount, &backFacingTriangles);
+    /* Ranges count triangles, the draw counts indices */
+    visibleOffsets.resize(visibleFirst.size());
+    visibleIndices.resize(visibleFirst.size());
+    for (size_t i = 0; i < visibleFirst.size(); i++) {
+        visibleOffsets[i] = (GLvoid *)(indexSize * 3 * visibleFirst[i]);
+        visibleIndices[i] = 3 * visibleCount[i];
+    }
+    glMultiDrawElements(GL_TRIANGLES, visibleIndices.data(), indexType, visibleOffsets.data(), visibleIndices.size());
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
@@ -341,13 +564,14 @@ void Engine::drawBoxes(Renderer &r) {
     glBindVertexArray(wireVao);
     glBindBuffer(GL_ARRAY_BUFFER, treeVbo);
     r.setModelMatrix(IdentityMatrix());
+    r.setPositionDecoding(Point(0, 0, 0), Point(1, 1, 1));
     r.setColor(0, 0, 0, 1);
     r.setLightIntens(0);
 
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-    int beg = (1 << level) - 1;
-    int end = beg + (1 << level);
+    size_t beg = tree->levelBegin(level);
+    size_t end = tree->levelEnd(level);
 
     glDisable(GL_CULL_FACE);
     glDrawElements(GL_LINES, 4 * 6 * (end - beg), GL_UNSIGNED_INT, (GLvoid *)(4 * 6 * beg * sizeof(GLuint)));
@@ -357,6 +581,8 @@ void Engine::drawBoxes(Renderer &r) {
 }
 
 void Engine::showScene(Renderer &r) {
+    pollWorker();
+
     if (!m)
         return;
 
@@ -375,7 +601,7 @@ void Engine::showOverlay(Renderer &r) {
     glColor4f(0, 0, 0, .8f);
 
     float widthpx = 480.f;
-    float heightpx = 260.f;
+    float heightpx = 480.f;
 
     glBegin(GL_QUADS);
     glVertex2f(10.f, 10.f);
@@ -395,6 +621,13 @@ void Engine::showOverlay(Renderer &r) {
 
     putLine(x1, x2, y, "fps:", buf);
     y -= 20.f;
+    if (worker) {
+        const Progress &p = worker->progress();
+        sprintf(buf, "%s: %s %.0f%%", worker->name().c_str(), p.stage().c_str(), 100.f * p.fraction());
+        putLine(x1, x2, y, "working:", buf);
+    } else
+        putLine(x1, x2, y, "working:", "idle");
+    y -= 20.f;
     putLine(x1, x2, y, "mesh:", mesh ? mesh->filename() : std::string("No mesh loaded"));
     y -= 20.f;
     long long numVertices = mesh ? mesh->numVertices() : 0;
@@ -405,8 +638,39 @@ void Engine::showOverlay(Renderer &r) {
     y -= 20.f;
     putLine(x1, x2, y, "tree level:", std::to_string(static_cast<long long>(level)));
     y -= 20.f;
+    long long numTriangles = m ? m->faces().size() : 0;
+    long long drawn = m ? drawnTriangles : 0;
+    long long occluded = m && occlusion ? occludedTriangles : 0;
+    long long backFacing = m && cull ? backFacingTriangles : 0;
+    putLine(x1, x2, y, "triangles:", std::to_string(drawn) + " drawn, " + std::to_string(numTriangles - drawn - occluded - backFacing) +
+        " outside view");
+    y -= 20.f;
+    putLine(x1, x2, y, "culled:", std::to_string(occluded) + " occluded, " + std::to_string(backFacing) + " facing away");
+    y -= 20.f;
+    std::string picked("none");
+    if (pickedTriangle >= 0 && trianglesOfMesh)
+        picked = std::to_string(static_cast<long long>(TriMesh::faceOfTriangle(*mesh, pickedTriangle))) +
+            " (triangle " + std::to_string(static_cast<long long>(pickedTriangle)) + ")";
+    else if (pickedTriangle >= 0)
+        picked = "limit triangle " + std::to_string(static_cast<long long>(pickedTriangle));
+    putLine(x1, x2, y, "picked face:", picked);
+    y -= 20.f;
+    putLine(x1, x2, y, "picked vertex:", pickedVertex < 0 ? std::string("none") : std::to_string(static_cast<long long>(pickedVertex)));
+    y -= 20.f;
+    putLine(x1, x2, y, "scheme:", schemeName(scheme));
+    y -= 20.f;
+    putLine(x1, x2, y, "limit density:", std::to_string(static_cast<long long>(limitDensity)));
+    y -= 20.f;
     putLine(x1, x2, y, "face culling:", cull ? "on" : "off");
     y -= 20.f;
+    putLine(x1, x2, y, "occlusion:", occlusion ? "on" : "off");
+    y -= 20.f;
+    sprintf(buf, "%s, %d B a vertex, %d bit indices, %.1f MB", vertexLayout == VertexFormat::PACKED ? "packed" : "float",
+        static_cast<int>(VertexFormat::stride(vertexLayout)), static_cast<int>(8 * indexSize), (vertexBytes + indexBytes) / 1048576.);
+    putLine(x1, x2, y, "vertices:", buf);
+    y -= 20.f;
+    putLine(x1, x2, y, "vertex cache:", vertexCache ? "on" : "off");
+    y -= 20.f;
     putLine(x1, x2, y, "wireframe:", wireframe ? "on" : "off");
     y -= 20.f;
     putLine(x1, x2, y, "shading:", shading == FLAT ? "flat" : (shading == PHONG ? "Phong" : "Gouraud"));
@@ -414,9 +678,11 @@ void Engine::showOverlay(Renderer &r) {
     sprintf(buf, "%.2f", specularity);
     putLine(x1, x2, y, "specularity:", buf);
     y -= 30.f;
-    putLine(x1, x1, y, "", "Drag to rotate model, rotate wheel to zoom");
+    putLine(x1, x1, y, "", "Drag to rotate model, rotate wheel to zoom, right click to pick");
+    y -= 20.f;
+    putLine(x1, x1, y, "", "Esc, Q : quit,  +,-: AABB level, *,/ specularity, L: load, R: refine, S/B: save ASCII/binary");
     y -= 20.f;
-    putLine(x1, x1, y, "", "Esc, Q : quit,  +,-: AABB level, *,/ specularity, L: load, R: refine, S: save mesh");
+    putLine(x1, x1, y, "", "M: subdivision scheme, A: refine faces larger than 16 px, E: show Doo-Sabin limit surface, [,]: limit density");
     y -= 20.f;
-    putLine(x1, x1, y, "", "Togglers: W : wireframe mode,  C: face culling, N: shading");
+    putLine(x1, x1, y, "", "Togglers: W : wireframe mode,  C: face culling, O: occlusion culling, P: packed vertices, V: vertex cache order, N: shading,  X: cancel job");
 }
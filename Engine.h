@@ -6,11 +6,18 @@
 
 #include "Matrix.h"
 #include "Mesh.h"
+#include "MeshWorker.h"
+#include "Subdivision.h"
+#include "VertexFormat.h"
 
 #include <vector>
 #include <memory>
 
 struct Renderer;
+class RayQuery;
+class DrawRanges;
+class HiZBuffer;
+class Meshlets;
 
 struct Engine {
     bool buttonPressed;
@@ -26,11 +33,45 @@ struct Engine {
 
     Matrix rotMatrix;
     int level;
-    int maxLevels;
+    int limitDensity;
+    SubdivisionScheme scheme;
     float radius;
 
     std::unique_ptr<Mesh> mesh;
     std::unique_ptr<TriMesh> m;
+    std::unique_ptr<AABBTree> tree;
+    std::unique_ptr<MeshWorker> worker;
+    /* Built on the first pick after the triangles change */
+    std::unique_ptr<RayQuery> rays;
+    /* False while m shows the limit surface instead of triangulating mesh */
+    bool trianglesOfMesh;
+    int pickedTriangle;
+    int pickedVertex;
+    /* The index buffer holds the triangles in tree order, drawModel() only draws the ranges in view */
+    std::unique_ptr<DrawRanges> ranges;
+    std::vector<int> visibleFirst;
+    std::vector<int> visibleCount;
+    std::vector<const GLvoid *> visibleOffsets;
+    std::vector<GLsizei> visibleIndices;
+    size_t drawnTriangles;
+    /* Visible ranges are narrowed to meshlets in view, and with face culling on to those not facing away */
+    std::unique_ptr<Meshlets> meshlets;
+    size_t backFacingTriangles;
+    /* Nodes hidden behind the nearest triangles in a software depth buffer are not drawn either */
+    bool occlusion;
+    std::unique_ptr<HiZBuffer> hiz;
+    size_t occludedTriangles;
+    /* Layout of the uploaded vertices, positions decode as positionOffset + positionScale * p */
+    VertexFormat::Layout vertexLayout;
+    /* Triangles and vertices are uploaded in vertex cache order */
+    bool vertexCache;
+    Point positionOffset;
+    Point positionScale;
+    size_t vertexBytes;
+    size_t indexBytes;
+    /* GL_UNSIGNED_SHORT below 65536 vertices, GL_UNSIGNED_INT otherwise */
+    GLenum indexType;
+    size_t indexSize;
 
     GLuint modelVao;
     GLuint wireVao;
@@ -40,17 +81,29 @@ struct Engine {
     GLuint treeIbo;
 
     Engine();
+    ~Engine();
     void refine();
-    void saveMesh();
+    void refineVisible();
+    void showLimit();
+    void saveMesh(bool binary);
     void loadMesh();
-    void buildTree();
+    /* Returns false while another job runs */
+    bool startJob(const std::string &name, const MeshWorker::Job &job);
+    void pollWorker();
+    void cancelJob();
+    /* Prepares the draw buffers of the current triangles again, after their layout or order changed */
+    bool rebuildBuffers();
+    void uploadBuffers(MeshWorker::Result &r);
     Matrix getViewMatrix();
+    /* Same projection as Renderer::setPerspective(), for picking and culling */
+    Matrix getProjectionMatrix();
     void showScene(Renderer &r);
     void drawModel(Renderer &r);
     void drawBoxes(Renderer &r);
     void showOverlay(Renderer &r);
     void keyboard(unsigned char key, int x, int y);
     void click(int button, int state, int x, int y);
+    void pick(int x, int y);
     void motion(int x, int y);
     void reshape(int w, int h);
     void dragging(int dx, int dy);
@@ -0,0 +1,159 @@
+#include "HalfEdge.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <limits>
+
+int HalfEdge::low(int h) const {
+    return std::min(origin(h), target(h));
+}
+
+int HalfEdge::high(int h) const {
+    return std::max(origin(h), target(h));
+}
+
+bool HalfEdge::preferred(int h, int e) const {
+    if (e < 0)
+        return true;
+    if (isBoundary(h) != isBoundary(e))
+        return isBoundary(h);
+    return h < e;
+}
+
+int HalfEdge::find(int from, int to) const {
+    int lo = std::min(from, to);
+    int hi = std::max(from, to);
+    const int *b = edgesBegin(lo);
+    const int *e = edgesEnd(lo);
+    b = std::lower_bound(b, e, hi, [this] (int h, int v) { return high(h) < v; });
+    for (; b != e && high(*b) == hi; b++)
+        if (origin(*b) == from)
+            return *b;
+    return -1;
+}
+
+size_t HalfEdge::numberEdges(std::vector<int> &edgeId, std::vector<int> &edgeHalf) const {
+    const size_t nV = _bucketStart.size() - 1;
+    /* Twins are neighbours within a bucket, an edge starts wherever the previous entry is not our twin */
+    auto startsEdge = [this] (const int *p, const int *b) {
+        return p == b || _twin[*p] != p[-1];
+    };
+    std::vector<int> first(nV + 1);
+    first[0] = 0;
+    parallelFor(nV, [this, &first, &startsEdge] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            int count = 0;
+            for (const int *p = edgesBegin(v); p != edgesEnd(v); p++)
+                count += startsEdge(p, edgesBegin(v));
+            first[v + 1] = count;
+        }
+    }, 1024);
+    for (size_t v = 0; v < nV; v++)
+        first[v + 1] += first[v];
+
+    edgeId.resize(size());
+    edgeHalf.resize(first[nV]);
+    parallelFor(nV, [this, &first, &edgeId, &edgeHalf, &startsEdge] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            int e = first[v] - 1;
+            for (const int *p = edgesBegin(v); p != edgesEnd(v); p++) {
+                if (startsEdge(p, edgesBegin(v)))
+                    edgeHalf[++e] = *p;
+                edgeId[*p] = e;
+            }
+        }
+    }, 1024);
+    return first[nV];
+}
+
+HalfEdge::HalfEdge(const Mesh &m) : _fs(m.faceStarts()), _fv(m.faceVerts()) {
+    const size_t nV = m.numVertices();
+    const size_t nF = m.numFaces();
+    const size_t nE = _fv.size();
+    if (nE > static_cast<size_t>(std::numeric_limits<int>::max()))
+        throw std::range_error("Too many face corners");
+
+    _face.resize(nE);
+    parallelFor(nF, [this] (size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++)
+            for (offset_t h = _fs[f]; h < _fs[f + 1]; h++)
+                _face[h] = static_cast<int>(f);
+    }, 1024);
+
+    /* Counting sort of half-edges by their lower vertex */
+    std::unique_ptr<std::atomic<int>[]> counter(new std::atomic<int>[nV + 1]);
+    parallelFor(nV + 1, [&counter] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++)
+            counter[v].store(0, std::memory_order_relaxed);
+    });
+    parallelFor(nE, [this, &counter] (size_t begin, size_t end) {
+        for (size_t h = begin; h < end; h++)
+            counter[low(h) + 1].fetch_add(1, std::memory_order_relaxed);
+    });
+    _bucketStart.resize(nV + 1);
+    _bucketStart[0] = 0;
+    for (size_t v = 0; v < nV; v++)
+        _bucketStart[v + 1] = _bucketStart[v] + counter[v + 1].load(std::memory_order_relaxed);
+    parallelFor(nV, [this, &counter] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++)
+            counter[v].store(_bucketStart[v], std::memory_order_relaxed);
+    });
+    _bucket.resize(nE);
+    parallelFor(nE, [this, &counter] (size_t begin, size_t end) {
+        for (size_t h = begin; h < end; h++)
+            _bucket[counter[low(h)].fetch_add(1, std::memory_order_relaxed)] = static_cast<int>(h);
+    });
+
+    /*
+     * Buckets are as small as the vertex valence. Sorting them makes the
+     * layout independent of the fill order. Then pair up the two directions of every edge
+     * */
+    _twin.resize(nE);
+    parallelFor(nV, [this] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            int *b = _bucket.data() + _bucketStart[v];
+            int *e = _bucket.data() + _bucketStart[v + 1];
+            std::sort(b, e, [this, v] (int g, int h) {
+                int hg = high(g);
+                int hh = high(h);
+                if (hg != hh)
+                    return hg < hh;
+                if (origin(g) != origin(h))
+                    return origin(g) == static_cast<int>(v);
+                return g < h;
+            });
+            for (int *p = b; p != e; p++) {
+                _twin[*p] = -1;
+                if (p + 1 == e || high(p[1]) != high(p[0]))
+                    continue;
+                if (origin(p[1]) == origin(p[0]) || (p + 2 != e && high(p[2]) == high(p[0])))
+                    throw std::logic_error("Edge is used twice in the same direction, mesh is not oriented");
+                _twin[p[0]] = p[1];
+                _twin[p[1]] = p[0];
+                p++;
+            }
+        }
+    }, 1024);
+
+    /* The boundary half-edge if there is one, otherwise the one in the lowest face */
+    parallelFor(nV, [&counter] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++)
+            counter[v].store(-1, std::memory_order_relaxed);
+    });
+    parallelFor(nE, [this, &counter] (size_t begin, size_t end) {
+        for (size_t h = begin; h < end; h++) {
+            std::atomic<int> &best = counter[origin(h)];
+            int cur = best.load(std::memory_order_relaxed);
+            while (preferred(h, cur) && !best.compare_exchange_weak(cur, static_cast<int>(h), std::memory_order_relaxed))
+                ;
+        }
+    });
+    _vertexEdge.resize(nV);
+    parallelFor(nV, [this, &counter] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++)
+            _vertexEdge[v] = counter[v].load(std::memory_order_relaxed);
+    });
+}
@@ -0,0 +1,121 @@
+#ifndef __HALFEDGE_H__
+#define __HALFEDGE_H__
+
+#include "Mesh.h"
+
+#include <vector>
+#include <cstddef>
+
+/*
+ * Directed edge structure over the face arrays of a Mesh. Half-edge h is
+ * the face corner stored at position h of faceVerts(), going from that
+ * corner's vertex to the next vertex of the same face. Half-edges are
+ * numbered in 32 bits, meshes with more than 2^31 corners are refused. The
+ * mesh must outlive this structure and must not change meanwhile
+ * */
+
+class HalfEdge {
+    const std::vector<offset_t> &_fs;
+    const std::vector<index_t> &_fv;
+    std::vector<int> _face;
+    std::vector<int> _twin;
+    std::vector<int> _vertexEdge;
+
+    /*
+     * Edge hash: the half-edges of every edge are bucketed by its lower
+     * vertex and sorted by the higher one, the lower to higher direction first
+     * */
+    std::vector<int> _bucketStart;
+    std::vector<int> _bucket;
+
+    int low(int h) const;
+    int high(int h) const;
+    /* Whether h is a better fan start than e for their common origin */
+    bool preferred(int h, int e) const;
+public:
+    HalfEdge(const Mesh &m);
+
+    size_t size() const { return _fv.size(); }
+
+    int face(int h) const { return _face[h]; }
+    int origin(int h) const { return _fv[h]; }
+    int target(int h) const { return _fv[next(h)]; }
+    int next(int h) const { return h + 1 == _fs[_face[h] + 1] ? static_cast<int>(_fs[_face[h]]) : h + 1; }
+    int prev(int h) const { return h == _fs[_face[h]] ? static_cast<int>(_fs[_face[h] + 1]) - 1 : h - 1; }
+
+    /* Oppositely directed half-edge of the neighbour face, -1 on the boundary */
+    int twin(int h) const { return _twin[h]; }
+    bool isBoundary(int h) const { return _twin[h] < 0; }
+
+    /* Next outgoing half-edge around origin(h), -1 when the fan ends at the boundary */
+    int rotate(int h) const { return _twin[prev(h)]; }
+
+    /*
+     * Outgoing half-edge a fan walk around v starts from: the one without
+     * a twin for boundary vertices, the one in the lowest numbered face
+     * otherwise. -1 for orphan vertices
+     * */
+    int vertexEdge(size_t v) const { return _vertexEdge[v]; }
+
+    /* Half-edge from -> to or -1 */
+    int find(int from, int to) const;
+
+    /*
+     * Numbers undirected edges, a half-edge and its twin share the number.
+     * edgeHalf[e] is the first half-edge of edge e. Returns the number of edges
+     * */
+    size_t numberEdges(std::vector<int> &edgeId, std::vector<int> &edgeHalf) const;
+
+    /* Half-edges of the edges (v, w) with w > v, ordered by w */
+    const int *edgesBegin(size_t v) const { return _bucket.data() + _bucketStart[v]; }
+    const int *edgesEnd(size_t v) const { return _bucket.data() + _bucketStart[v + 1]; }
+
+    /*
+     * Calls emit(first, count, closed) for every run of consecutive faces
+     * around v in rotate order that inside(face) accepts. first is the
+     * outgoing half-edge in the first face of the run, closed is set when the
+     * run is the whole fan of an interior vertex. Interior walks start at a
+     * rejected face so no other run wraps around. Returns the fan size
+     * */
+    template<class P, class F>
+    int forEachRun(int v, P inside, F emit) const;
+};
+
+template<class P, class F>
+int HalfEdge::forEachRun(int v, P inside, F emit) const {
+    int start = vertexEdge(v);
+    if (start < 0)
+        return 0;
+    bool closed = !isBoundary(start);
+    if (closed) {
+        int h = start;
+        do {
+            if (!inside(face(h))) {
+                start = h;
+                closed = false;
+                break;
+            }
+            h = rotate(h);
+        } while (h >= 0 && h != start);
+    }
+    int size = 0;
+    int first = -1;
+    int count = 0;
+    int h = start;
+    do {
+        if (inside(face(h))) {
+            if (!count++)
+                first = h;
+        } else if (count) {
+            emit(first, count, false);
+            count = 0;
+        }
+        size++;
+        h = rotate(h);
+    } while (h >= 0 && h != start);
+    if (count)
+        emit(first, count, closed);
+    return size;
+}
+
+#endif
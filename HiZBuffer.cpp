@@ -0,0 +1,318 @@
+#include "HiZBuffer.h"
+#include "Culling.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <utility>
+#include <cstdint>
+
+namespace {
+
+/* Triangle on screen. Edge i runs from corner i + 1 to corner i + 2 and is positive inside */
+struct Screen {
+    float x[3], y[3];
+    float e[3][3];
+    float z[3];
+    bool valid;
+};
+
+/*
+ * Evaluated at a pixel center, a pixel is written when all edge functions
+ * e[i][0] x + e[i][1] y + e[i][2] are >= 0 and takes the largest of the
+ * depths z[j][0] x + z[j][1] y + z[j][2]. Unused slots repeat used ones
+ * */
+struct Setup {
+    float e[9][3];
+    float z[4][3];
+    /* Pixels whose centers may be covered, empty if x1 < x0 */
+    int x0, x1, y0, y1;
+};
+
+/* Linear functions reach their extremes over a pixel at its corners, half a pixel away per axis */
+inline void shrink(const float in[3], float out[3]) {
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2] - 0.5f * (std::fabs(in[0]) + std::fabs(in[1]));
+}
+
+inline void farthest(const float in[3], float out[3]) {
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2] + 0.5f * (std::fabs(in[0]) + std::fabs(in[1]));
+}
+
+}
+
+HiZBuffer::HiZBuffer(int width, int height) : _width(width), _height(height), _mvp(IdentityMatrix()) {
+    if (width < 1 || height < 1)
+        throw std::invalid_argument("Empty depth buffer");
+    int w = width;
+    int h = height;
+    for (;;) {
+        _levelWidth.push_back(w);
+        _levelHeight.push_back(h);
+        _levels.push_back(std::vector<float>(static_cast<size_t>(w) * h, 1.f));
+        if (w == 1 && h == 1)
+            break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+}
+
+void HiZBuffer::clear(const Matrix &mvp) {
+    _mvp = mvp;
+    for (size_t l = 0; l < _levels.size(); l++)
+        std::fill(_levels[l].begin(), _levels[l].end(), 1.f);
+}
+
+void HiZBuffer::render(const TriMesh &m, const Point &center, const std::vector<int> &triangles) {
+    const std::vector<Point> &vertexData = m.vertsWithNormals();
+    const std::vector<Face> &faceData = m.faces();
+    const float w = static_cast<float>(_width);
+    const float h = static_cast<float>(_height);
+
+    std::vector<Screen> screens(triangles.size());
+    parallelFor(triangles.size(), [this, &screens, &triangles, &vertexData, &faceData, &center, w, h] (size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            Screen &s = screens[k];
+            s.valid = false;
+            const Face &f = faceData[triangles[k]];
+            const int corner[3] = {f.v1, f.v2, f.v3};
+            float sz[3];
+            bool clipped = false;
+            for (int i = 0; i < 3; i++) {
+                float c[4];
+                _mvp.transform(Point(vertexData[corner[i]], center), c);
+                /* Triangles reaching in front of the near plane are left out rather than clipped */
+                if (c[3] <= 0 || c[2] < -c[3])
+                    clipped = true;
+                s.x[i] = (0.5f * c[0] / c[3] + 0.5f) * w;
+                s.y[i] = (0.5f * c[1] / c[3] + 0.5f) * h;
+                sz[i] = c[2] / c[3];
+            }
+            if (clipped)
+                continue;
+
+            /* Edge i is zero at corners i + 1 and i + 2 and area at corner i */
+            float area = 0;
+            for (int i = 0; i < 3; i++) {
+                int a = (i + 1) % 3;
+                int b = (i + 2) % 3;
+                s.e[i][0] = s.y[a] - s.y[b];
+                s.e[i][1] = s.x[b] - s.x[a];
+                s.e[i][2] = s.x[a] * s.y[b] - s.x[b] * s.y[a];
+                area = s.e[i][0] * s.x[i] + s.e[i][1] * s.y[i] + s.e[i][2];
+            }
+            if (!(area != 0))
+                continue;
+            for (int j = 0; j < 3; j++)
+                s.z[j] = (sz[0] * s.e[0][j] + sz[1] * s.e[1][j] + sz[2] * s.e[2][j]) / area;
+            if (area < 0)
+                for (int i = 0; i < 3; i++)
+                    for (int j = 0; j < 3; j++)
+                        s.e[i][j] = -s.e[i][j];
+            s.valid = true;
+        }
+    }, 1024);
+
+    /*
+     * Edges shared by exactly two of the triangles. Slot 3 k + i is edge i
+     * of triangle k and holds the slot of the same edge in the other one
+     * */
+    std::vector<std::pair<uint64_t, int> > edges(3 * triangles.size());
+    for (size_t k = 0; k < triangles.size(); k++) {
+        const Face &f = faceData[triangles[k]];
+        const int corner[3] = {f.v1, f.v2, f.v3};
+        for (int i = 0; i < 3; i++) {
+            uint64_t a = static_cast<uint32_t>(corner[(i + 1) % 3]);
+            uint64_t b = static_cast<uint32_t>(corner[(i + 2) % 3]);
+            edges[3 * k + i] = std::make_pair(std::min(a, b) << 32 | std::max(a, b), static_cast<int>(3 * k + i));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    std::vector<int> twin(edges.size(), -1);
+    for (size_t i = 0; i < edges.size(); ) {
+        size_t j = i + 1;
+        while (j < edges.size() && edges[j].first == edges[i].first)
+            j++;
+        if (j == i + 2) {
+            twin[edges[i].second] = edges[i + 1].second;
+            twin[edges[i + 1].second] = edges[i].second;
+        }
+        i = j;
+    }
+
+    /*
+     * A triangle writes the pixels it covers whole. Across an edge shared
+     * with a neighbour on its other side the pixel only has to lie within
+     * the two outer edges of the neighbour, the pair covers it then. Its
+     * depth is the farthest of both over the pixel, so the buffer never
+     * claims more than the occluders hide, through gaps of any width
+     * */
+    std::vector<Setup> setups(triangles.size());
+    parallelFor(triangles.size(), [this, &setups, &screens, &twin] (size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            Setup &s = setups[k];
+            const Screen &t = screens[k];
+            s.x0 = s.y0 = 0;
+            s.x1 = s.y1 = -1;
+            if (!t.valid)
+                continue;
+            int edges = 0;
+            int planes = 0;
+            farthest(t.z, s.z[planes++]);
+            for (int i = 0; i < 3; i++) {
+                const int other = twin[3 * k + i];
+                const Screen *n = other >= 0 ? &screens[other / 3] : 0;
+                const int j = other % 3;
+                if (n && n->valid && t.e[i][0] * n->x[j] + t.e[i][1] * n->y[j] + t.e[i][2] < 0) {
+                    for (int c = 0; c < 3; c++)
+                        s.e[edges][c] = t.e[i][c];
+                    edges++;
+                    shrink(n->e[(j + 1) % 3], s.e[edges++]);
+                    shrink(n->e[(j + 2) % 3], s.e[edges++]);
+                    farthest(n->z, s.z[planes++]);
+                } else {
+                    shrink(t.e[i], s.e[edges++]);
+                }
+            }
+            for (; edges < 9; edges++)
+                for (int c = 0; c < 3; c++)
+                    s.e[edges][c] = s.e[0][c];
+            for (; planes < 4; planes++)
+                for (int c = 0; c < 3; c++)
+                    s.z[planes][c] = s.z[0][c];
+
+            s.x0 = std::max(0, static_cast<int>(std::ceil(std::min(std::min(t.x[0], t.x[1]), t.x[2]) - 0.5f)));
+            s.x1 = std::min(_width - 1, static_cast<int>(std::floor(std::max(std::max(t.x[0], t.x[1]), t.x[2]) - 0.5f)));
+            s.y0 = std::max(0, static_cast<int>(std::ceil(std::min(std::min(t.y[0], t.y[1]), t.y[2]) - 0.5f)));
+            s.y1 = std::min(_height - 1, static_cast<int>(std::floor(std::max(std::max(t.y[0], t.y[1]), t.y[2]) - 0.5f)));
+        }
+    }, 1024);
+
+    /* Every thread owns a band of rows and goes through all triangles */
+    std::vector<float> &depth = _levels[0];
+    parallelFor(_height, [this, &setups, &depth] (size_t begin, size_t end) {
+        for (size_t k = 0; k < setups.size(); k++) {
+            const Setup &s = setups[k];
+            int y0 = std::max(s.y0, static_cast<int>(begin));
+            int y1 = std::min(s.y1, static_cast<int>(end) - 1);
+            for (int y = y0; y <= y1; y++) {
+                /* Copies, so the compiler need not reload them after every store to the row */
+                const float fy = y + 0.5f;
+                float a[9], b[9], az[4], bz[4];
+                for (int i = 0; i < 9; i++) {
+                    a[i] = s.e[i][0];
+                    b[i] = s.e[i][1] * fy + s.e[i][2];
+                }
+                for (int j = 0; j < 4; j++) {
+                    az[j] = s.z[j][0];
+                    bz[j] = s.z[j][1] * fy + s.z[j][2];
+                }
+                float *row = &depth[static_cast<size_t>(y) * _width];
+                for (int x = s.x0; x <= s.x1; x++) {
+                    /* One select on the whole condition, nested ones turn into branches */
+                    const float fx = x + 0.5f;
+                    int inside = 1;
+                    for (int i = 0; i < 9; i++)
+                        inside &= a[i] * fx + b[i] >= 0;
+                    float z = az[0] * fx + bz[0];
+                    for (int j = 1; j < 4; j++)
+                        z = std::max(z, az[j] * fx + bz[j]);
+                    const float r = row[x];
+                    row[x] = inside & (z < r) ? z : r;
+                }
+            }
+        }
+    }, 8);
+
+    buildPyramid();
+}
+
+void HiZBuffer::buildPyramid() {
+    for (size_t l = 1; l < _levels.size(); l++) {
+        const std::vector<float> &below = _levels[l - 1];
+        std::vector<float> &level = _levels[l];
+        const int bw = _levelWidth[l - 1];
+        const int bh = _levelHeight[l - 1];
+        const int lw = _levelWidth[l];
+        for (int y = 0; y < _levelHeight[l]; y++) {
+            /* Odd sizes repeat the last row or column */
+            const float *r0 = &below[static_cast<size_t>(2 * y) * bw];
+            const float *r1 = &below[static_cast<size_t>(std::min(2 * y + 1, bh - 1)) * bw];
+            for (int x = 0; x < lw; x++) {
+                int x1 = std::min(2 * x + 1, bw - 1);
+                level[static_cast<size_t>(y) * lw + x] = std::max(std::max(r0[2 * x], r0[x1]), std::max(r1[2 * x], r1[x1]));
+            }
+        }
+    }
+}
+
+bool HiZBuffer::occluded(const AABB &b) const {
+    if (b.isEmpty())
+        return true;
+    float xmin = _width, xmax = 0, ymin = _height, ymax = 0, zmin = 1;
+    for (int i = 0; i < 8; i++) {
+        float c[4];
+        _mvp.transform(Point(i & 1 ? b.x2 : b.x1, i & 2 ? b.y2 : b.y1, i & 4 ? b.z2 : b.z1), c);
+        if (c[3] <= 0 || c[2] < -c[3])
+            return false;
+        float x = (0.5f * c[0] / c[3] + 0.5f) * _width;
+        float y = (0.5f * c[1] / c[3] + 0.5f) * _height;
+        xmin = std::min(xmin, x);
+        xmax = std::max(xmax, x);
+        ymin = std::min(ymin, y);
+        ymax = std::max(ymax, y);
+        zmin = std::min(zmin, c[2] / c[3]);
+    }
+
+    /* Samples around the box as well, it may show between them */
+    int x0 = std::max(0, static_cast<int>(std::floor(xmin - 0.5f)));
+    int x1 = std::min(_width - 1, static_cast<int>(std::ceil(xmax - 0.5f)));
+    int y0 = std::max(0, static_cast<int>(std::floor(ymin - 0.5f)));
+    int y1 = std::min(_height - 1, static_cast<int>(std::ceil(ymax - 0.5f)));
+    if (x1 < x0 || y1 < y0)
+        return false;
+
+    int l = 0;
+    while (l + 1 < levels() && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1))
+        l++;
+    for (int y = y0 >> l; y <= y1 >> l; y++)
+        for (int x = x0 >> l; x <= x1 >> l; x++)
+            if (depth(l, x, y) >= zmin)
+                return false;
+    return true;
+}
+
+std::vector<int> HiZBuffer::occluders(const AABBTree &tree, const Frustum &f, const Point &eye, size_t budget) {
+    const std::vector<AABBTree::Node> &nodes = tree.nodes();
+    const std::vector<int> &order = tree.faces();
+    std::vector<int> result;
+    if (nodes[0].box.isEmpty())
+        return result;
+
+    /* Depth first with the child nearer to eye on top */
+    std::vector<std::pair<int, int> > stack(1, std::make_pair(0, static_cast<int>(Frustum::ALL_PLANES)));
+    while (!stack.empty() && result.size() < budget) {
+        int i = stack.back().first;
+        int planes = f.classify(nodes[i].box, stack.back().second);
+        stack.pop_back();
+        if (planes < 0)
+            continue;
+        const AABBTree::Node &n = nodes[i];
+        if (n.isLeaf()) {
+            result.insert(result.end(), order.begin() + n.first, order.begin() + n.first + n.count);
+            continue;
+        }
+        const AABB &l = nodes[n.first].box;
+        const AABB &r = nodes[n.first + 1].box;
+        Point dl(0.5f * (l.x1 + l.x2) - eye.x, 0.5f * (l.y1 + l.y2) - eye.y, 0.5f * (l.z1 + l.z2) - eye.z);
+        Point dr(0.5f * (r.x1 + r.x2) - eye.x, 0.5f * (r.y1 + r.y2) - eye.y, 0.5f * (r.z1 + r.z2) - eye.z);
+        bool leftNearer = dl.x * dl.x + dl.y * dl.y + dl.z * dl.z < dr.x * dr.x + dr.y * dr.y + dr.z * dr.z;
+        stack.push_back(std::make_pair(leftNearer ? n.first + 1 : n.first, planes));
+        stack.push_back(std::make_pair(leftNearer ? n.first : n.first + 1, planes));
+    }
+    return result;
+}
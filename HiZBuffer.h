@@ -0,0 +1,57 @@
+#ifndef __HIZBUFFER_H__
+#define __HIZBUFFER_H__
+
+#include "AABBTree.h"
+#include "Matrix.h"
+
+#include <vector>
+
+struct Frustum;
+
+/*
+ * Low resolution depth buffer for occlusion culling on the CPU. A few
+ * occluder triangles are rasterized into it, then every level of a mip
+ * pyramid keeps the farthest depth of four texels below. A box is hidden
+ * when its nearest depth lies behind the farthest depth of every texel it
+ * covers on a level where it spans at most two texels per axis, which
+ * costs a handful of reads for boxes of any size.
+ *
+ * Depths are normalized device z. Pixels are only written where the
+ * occluders cover them whole, with their farthest depth over the pixel,
+ * so boxes seen through gaps narrower than a pixel are never culled.
+ * Rows are rasterized in parallel bands, the span loop tests all pixels
+ * of a row without branches so the compiler vectorizes it
+ * */
+
+class HiZBuffer {
+    int _width, _height;
+    Matrix _mvp;
+    /* Level 0 is the full buffer, rows from the bottom of the viewport */
+    std::vector<std::vector<float> > _levels;
+    std::vector<int> _levelWidth;
+    std::vector<int> _levelHeight;
+
+    void buildPyramid();
+public:
+    HiZBuffer(int width, int height);
+
+    /* Empties the buffer for a frame seen through mvp, from the centered space of the tree to clip space */
+    void clear(const Matrix &mvp);
+    /* Rasterizes the given triangles of m, moved by -center like the tree, and rebuilds the pyramid */
+    void render(const TriMesh &m, const Point &center, const std::vector<int> &triangles);
+    /* True if b is behind the occluders, boxes reaching in front of the near plane never are */
+    bool occluded(const AABB &b) const;
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    int levels() const { return static_cast<int>(_levels.size()); }
+    float depth(int level, int x, int y) const { return _levels[level][y * _levelWidth[level] + x]; }
+
+    /*
+     * Triangles of leaves touching f, nearest to eye first, until at least
+     * budget of them are taken. Eye is in the centered space of the tree
+     * */
+    static std::vector<int> occluders(const AABBTree &tree, const Frustum &f, const Point &eye, size_t budget);
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "HiZBuffer.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+/*
+ * Checks the software depth buffer without a GL context:
+ *   hizbuffertest
+ * Returns the number of failed checks
+ * */
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string &what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+/* Rectangle [x1, x2] x [y1, y2] at depth z in front of a camera looking down -z */
+struct Quad {
+    float x1, y1, x2, y2, z;
+
+    /* Whether the ray from the eye to p passes the quad before reaching p */
+    bool hides(const Point &p) const {
+        if (!(p.z < z))
+            return false;
+        float s = z / p.z;
+        return p.x * s >= x1 && p.x * s <= x2 && p.y * s >= y1 && p.y * s <= y2;
+    }
+};
+
+TriMesh quads(const std::vector<Quad> &q) {
+    std::vector<Point> v;
+    std::vector<Face> f;
+    for (size_t i = 0; i < q.size(); i++) {
+        int k = static_cast<int>(v.size());
+        v.push_back(Point(q[i].x1, q[i].y1, q[i].z));
+        v.push_back(Point(q[i].x2, q[i].y1, q[i].z));
+        v.push_back(Point(q[i].x2, q[i].y2, q[i].z));
+        v.push_back(Point(q[i].x1, q[i].y2, q[i].z));
+        f.push_back(Face(k, k + 1, k + 2));
+        f.push_back(Face(k, k + 2, k + 3));
+    }
+    /* Normals are not used */
+    v.resize(2 * v.size(), Point(0, 0, 1));
+    return TriMesh(v.data(), v.size() / 2, f.data(), f.size());
+}
+
+std::vector<int> all(const TriMesh &m) {
+    std::vector<int> t(m.faces().size());
+    for (size_t i = 0; i < t.size(); i++)
+        t[i] = static_cast<int>(i);
+    return t;
+}
+
+AABB box(const Point &center, const Point &half) {
+    AABB b;
+    b.add(Point(center.x - half.x, center.y - half.y, center.z - half.z));
+    b.add(Point(center.x + half.x, center.y + half.y, center.z + half.z));
+    return b;
+}
+
+/* Every texel of a level is at least as far as the pixels of level 0 below it */
+void pyramid(const HiZBuffer &hiz, const std::string &what) {
+    bool ok = true;
+    for (int l = 1; l < hiz.levels(); l++) {
+        int w = ((hiz.width() - 1) >> l) + 1;
+        int h = ((hiz.height() - 1) >> l) + 1;
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++) {
+                float farthest = -1;
+                for (int py = y << l; py < std::min((y + 1) << l, hiz.height()); py++)
+                    for (int px = x << l; px < std::min((x + 1) << l, hiz.width()); px++)
+                        farthest = std::max(farthest, hiz.depth(0, px, py));
+                ok = ok && hiz.depth(l, x, y) >= farthest;
+            }
+    }
+    check(ok, what + "pyramid keeps the farthest depth below every texel");
+    check(hiz.depth(hiz.levels() - 1, 0, 0) <= 1, what + "top level holds a depth");
+}
+
+void knownOccluders() {
+    /* An odd size exercises the repeated last row and column of every level */
+    HiZBuffer hiz(101, 75);
+    const Matrix projection = PerspectiveMatrix(0.5f, 4.5f, 30, 101.f / 75);
+    const std::vector<Quad> wall = {{-.6f, -.5f, .6f, .5f, -2}, {.4f, -1, 1.2f, 0, -3}};
+    TriMesh m = quads(wall);
+    hiz.clear(projection);
+    hiz.render(m, Point(0, 0, 0), all(m));
+    pyramid(hiz, "quads: ");
+
+    /* Pixels well inside the near quad have its depth, those outside both are empty */
+    float c[4];
+    projection.transform(Point(0, 0, -2), c);
+    const float nearDepth = c[2] / c[3];
+    Matrix unproject(projection);
+    unproject.inverse();
+    bool inside = true, empty = true;
+    for (int y = 0; y < hiz.height(); y++)
+        for (int x = 0; x < hiz.width(); x++) {
+            float ndcx = 2 * (x + 0.5f) / hiz.width() - 1;
+            float ndcy = 2 * (y + 0.5f) / hiz.height() - 1;
+            /* The point on the far plane under the pixel center */
+            unproject.transform(Point(ndcx, ndcy, 1), c);
+            const Point p(c[0] / c[3], c[1] / c[3], c[2] / c[3]);
+            Quad shrunk = {wall[0].x1 + .05f, wall[0].y1 + .05f, wall[0].x2 - .05f, wall[0].y2 - .05f, wall[0].z};
+            if (shrunk.hides(p))
+                inside = inside && std::fabs(hiz.depth(0, x, y) - nearDepth) < 1e-4f;
+            Quad grown[2];
+            for (int q = 0; q < 2; q++)
+                grown[q] = {wall[q].x1 - .05f, wall[q].y1 - .05f, wall[q].x2 + .05f, wall[q].y2 + .05f, wall[q].z};
+            if (!grown[0].hides(p) && !grown[1].hides(p))
+                empty = empty && hiz.depth(0, x, y) == 1;
+        }
+    check(inside, "quads: depth of the near quad");
+    check(empty, "quads: no depth outside the quads");
+
+    check(hiz.occluded(box(Point(0, 0, -3), Point(.1f, .1f, .1f))), "box right behind the near quad");
+    check(!hiz.occluded(box(Point(0, 0, -1.5f), Point(.1f, .1f, .1f))), "box in front of the near quad");
+    check(!hiz.occluded(box(Point(0, 0, -2), Point(.1f, .1f, .1f))), "box through the near quad");
+    check(!hiz.occluded(box(Point(-1.1f, 0, -3), Point(.1f, .1f, .1f))), "box next to the near quad");
+    check(!hiz.occluded(box(Point(-.9f, 0, -3), Point(.1f, .1f, .1f))), "box behind the edge of the near quad");
+    check(!hiz.occluded(box(Point(0, 0, .5f), Point(.1f, .1f, .1f))), "box behind the eye");
+    check(!hiz.occluded(box(Point(0, 0, -.45f), Point(.1f, .1f, .1f))), "box before the near plane");
+
+    /* Random boxes, every one reported hidden has all corners behind one quad */
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(-1, 1), size(.01f, .3f), depth(-4.4f, -.6f);
+    int hidden = 0, wrong = 0;
+    for (int i = 0; i < 20000; i++) {
+        float z = depth(random);
+        Point center(unit(random) * -z * .7f, unit(random) * -z * .55f, z);
+        AABB b = box(center, Point(size(random), size(random), size(random)));
+        if (!hiz.occluded(b))
+            continue;
+        hidden++;
+        bool covered = false;
+        for (size_t q = 0; q < wall.size() && !covered; q++) {
+            covered = true;
+            for (int k = 0; k < 8; k++)
+                covered = covered && wall[q].hides(Point(k & 1 ? b.x2 : b.x1, k & 2 ? b.y2 : b.y1, k & 4 ? b.z2 : b.z1));
+        }
+        wrong += !covered;
+    }
+    check(hidden > 0, "some random boxes are hidden");
+    check(wrong == 0, "random boxes reported hidden are behind a quad");
+}
+
+/* Two quads a third of a pixel apart, between the pixel centers */
+void subPixelGap() {
+    HiZBuffer hiz(64, 64);
+    const Matrix projection = PerspectiveMatrix(0.5f, 4.5f, 30, 1);
+    /* x = 0 is the border between pixel columns 31 and 32, a pixel is about 0.04 wide at z = -2 */
+    const std::vector<Quad> wall = {{-1.2f, -1, -.0025f, 1, -2}, {.0025f, -1, 1.2f, 1, -2}};
+    TriMesh m = quads(wall);
+    hiz.clear(projection);
+    hiz.render(m, Point(0, 0, 0), all(m));
+    pyramid(hiz, "gap: ");
+
+    bool open = true;
+    for (int y = 0; y < hiz.height(); y++)
+        open = open && hiz.depth(0, 31, y) == 1 && hiz.depth(0, 32, y) == 1;
+    check(open, "gap: pixels over the gap stay empty");
+    check(hiz.depth(0, 25, 32) < 1 && hiz.depth(0, 38, 32) < 1, "gap: pixels inside the quads are written");
+    check(!hiz.occluded(box(Point(0, 0, -3), Point(.001f, .1f, .1f))), "gap: box seen through the gap");
+    check(hiz.occluded(box(Point(-.9f, 0, -3), Point(.15f, .3f, .1f))), "gap: box behind a quad");
+
+    /* A tilted quad keeps its farthest depth over every pixel it writes */
+    std::vector<Point> v = {Point(-.5f, -.5f, -1.5f), Point(.5f, -.5f, -3), Point(.5f, .5f, -3), Point(-.5f, .5f, -1.5f)};
+    std::vector<Face> f = {Face(0, 1, 2), Face(0, 2, 3)};
+    v.resize(8, Point(0, 0, 1));
+    TriMesh tilted(v.data(), 4, f.data(), f.size());
+    hiz.clear(projection);
+    hiz.render(tilted, Point(0, 0, 0), all(tilted));
+    Matrix unproject(projection);
+    unproject.inverse();
+    bool farthest = true;
+    for (int y = 0; y < hiz.height(); y++)
+        for (int x = 0; x < hiz.width(); x++) {
+            if (hiz.depth(0, x, y) == 1)
+                continue;
+            /* Depth of the plane z = -1.5 - 1.5 (x + .5) along the rays through the pixel corners */
+            for (int k = 0; k < 4; k++) {
+                float c[4];
+                unproject.transform(Point(2.f * (x + (k & 1)) / hiz.width() - 1, 2.f * (y + (k >> 1)) / hiz.height() - 1, 1), c);
+                const Point dir(c[0] / c[3], c[1] / c[3], c[2] / c[3]);
+                const float t = (-1.5f - 1.5f * .5f) / (dir.z + 1.5f * dir.x);
+                projection.transform(Point(t * dir.x, t * dir.y, t * dir.z), c);
+                farthest = farthest && hiz.depth(0, x, y) >= c[2] / c[3] - 1e-5f;
+            }
+        }
+    check(farthest, "tilted: pixels hold the farthest depth over them");
+}
+
+/* Random triangles, only the pyramid is checked */
+void soup() {
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> unit(-1, 1), depth(-4.4f, -.6f);
+    std::vector<Point> v;
+    std::vector<Face> f;
+    for (int t = 0; t < 300; t++) {
+        float z = depth(random);
+        Point c(unit(random) * -z * .6f, unit(random) * -z * .6f, z);
+        for (int k = 0; k < 3; k++)
+            v.push_back(Point(c.x + .3f * unit(random), c.y + .3f * unit(random), c.z + .3f * unit(random)));
+        f.push_back(Face(3 * t, 3 * t + 1, 3 * t + 2));
+    }
+    v.resize(2 * v.size(), Point(0, 0, 1));
+    TriMesh m(v.data(), v.size() / 2, f.data(), f.size());
+    const int sizes[][2] = {{256, 128}, {97, 33}, {1, 1}};
+    for (int s = 0; s < 3; s++) {
+        HiZBuffer hiz(sizes[s][0], sizes[s][1]);
+        hiz.clear(PerspectiveMatrix(0.5f, 4.5f, 30, static_cast<float>(sizes[s][0]) / sizes[s][1]));
+        hiz.render(m, Point(0, 0, 0), all(m));
+        pyramid(hiz, "soup " + std::to_string(sizes[s][0]) + "x" + std::to_string(sizes[s][1]) + ": ");
+    }
+}
+
+}
+
+int main() {
+    knownOccluders();
+    subPixelGap();
+    soup();
+    if (failures)
+        std::cerr << failures << " checks failed" << std::endl;
+    return failures;
+}
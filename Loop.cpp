@@ -0,0 +1,159 @@
+#include "Loop.h"
+#include "Adjacency.h"
+#include "HalfEdge.h"
+#include "Progress.h"
+#include "Parallel.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <limits>
+
+namespace {
+
+/* Fan triangulation of a polygonal mesh, same fans as TriMesh uses */
+class FanMesh : public Mesh {
+public:
+    FanMesh(const Mesh &m) : Mesh(m.filename()) {
+        const std::vector<offset_t> &fs = m.faceStarts();
+        const std::vector<index_t> &fv = m.faceVerts();
+        const size_t nF = m.numFaces();
+        const size_t nT = fv.size() - 2 * nF;
+        vertData() = m.verts();
+        std::vector<offset_t> &facestart = faceStartData();
+        std::vector<index_t> &facevert = faceVertData();
+        facestart.resize(nT + 1);
+        facevert.resize(3 * nT);
+        parallelFor(nF, [&fs, &fv, &facestart, &facevert] (size_t begin, size_t end) {
+            for (size_t f = begin; f < end; f++) {
+                offset_t b = fs[f];
+                offset_t t = b - 2 * static_cast<offset_t>(f);
+                for (offset_t j = 1; j < fs[f + 1] - b - 1; j++, t++) {
+                    facevert[3 * t] = fv[b];
+                    facevert[3 * t + 1] = fv[b + j];
+                    facevert[3 * t + 2] = fv[b + j + 1];
+                    facestart[t + 1] = 3 * (t + 1);
+                }
+            }
+        }, 1024);
+        facestart[0] = 0;
+        updateSum();
+    }
+};
+
+/* Loop's original weight of every neighbour of an interior vertex of valence n */
+float beta(int n) {
+    const float pi = 4 * atan(1.f);
+    float c = 0.375f + 0.25f * cos(2 * pi / n);
+    return (0.625f - c * c) / n;
+}
+
+}
+
+Loop::Loop(const Mesh &m, Progress *progress) : Mesh(m.filename() + "*") {
+    for (size_t f = 0; f < m.numFaces(); f++)
+        if (m.faceStarts()[f + 1] - m.faceStarts()[f] != 3) {
+            FanMesh t(m);
+            build(t, progress);
+            return;
+        }
+    build(m, progress);
+}
+
+void Loop::build(const Mesh &m, Progress *progress) {
+    const Adjacency adj(m);
+    adj.checkTopology();
+    const HalfEdge he(m);
+
+    const size_t nV = m.numVertices();
+    const size_t nF = m.numFaces();
+
+    std::vector<int> edgeId;
+    std::vector<int> edgeHalf;
+    const size_t numEdges = he.numberEdges(edgeId, edgeHalf);
+
+    const size_t firstEdge = nV;
+    if (nV + numEdges > static_cast<size_t>(std::numeric_limits<int>::max()))
+        throw std::range_error("Too many vertices");
+    std::vector<Point> &verts = vertData();
+    std::vector<offset_t> &facestart = faceStartData();
+    std::vector<index_t> &facevert = faceVertData();
+    verts.resize(nV + numEdges);
+    facestart.resize(4 * nF + 1);
+    facevert.resize(12 * nF);
+
+    /* Vertex points */
+    parallelFor(nV, [&m, &adj, &he, &verts, progress] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            reportProgress(progress, v - begin, 3 * (end - begin));
+            const Point &p = m.vert(v);
+            if (adj.isOrphan(v)) {
+                verts[v] = p;
+                continue;
+            }
+            if (adj.isBorder(v)) {
+                int h = he.vertexEdge(v);
+                Point q = m.vert(he.target(h));
+                while (he.rotate(h) >= 0)
+                    h = he.rotate(h);
+                q += m.vert(he.origin(he.prev(h)));
+                Point r = 0.125f * q;
+                r += 0.75f * p;
+                verts[v] = r;
+                continue;
+            }
+            int n = adj.numEdges(v);
+            float b = beta(n);
+            Point q(0, 0, 0);
+            for (const int *it = adj.edgesBegin(v); it != adj.edgesEnd(v); it++)
+                q += m.vert(*it);
+            Point r = b * q;
+            r += (1 - n * b) * p;
+            verts[v] = r;
+        }
+    }, 1024);
+
+    /* Edge points, 3/8 of the ends and 1/8 of the opposite corners. Midpoints on the boundary */
+    parallelFor(numEdges, [&m, &he, &edgeHalf, &verts, firstEdge, progress] (size_t begin, size_t end) {
+        for (size_t e = begin; e < end; e++) {
+            reportProgress(progress, end - begin + e - begin, 3 * (end - begin));
+            int h = edgeHalf[e];
+            int t = he.twin(h);
+            Point p = m.vert(he.origin(h));
+            p += m.vert(he.target(h));
+            if (t < 0) {
+                verts[firstEdge + e] = 0.5f * p;
+                continue;
+            }
+            Point q = m.vert(he.origin(he.prev(h)));
+            q += m.vert(he.origin(he.prev(t)));
+            Point r = 0.375f * p;
+            r += 0.125f * q;
+            verts[firstEdge + e] = r;
+        }
+    }, 1024);
+
+    /* Three corner triangles and the middle one per old triangle */
+    parallelFor(nF, [&m, &edgeId, &facestart, &facevert, firstEdge, progress] (size_t begin, size_t end) {
+        const std::vector<index_t> &fv = m.faceVerts();
+        for (size_t f = begin; f < end; f++) {
+            reportProgress(progress, 2 * (end - begin) + f - begin, 3 * (end - begin));
+            int h = 3 * f;
+            int e0 = static_cast<int>(firstEdge + edgeId[h]);
+            int e1 = static_cast<int>(firstEdge + edgeId[h + 1]);
+            int e2 = static_cast<int>(firstEdge + edgeId[h + 2]);
+            int tri[12] = {
+                fv[h], e0, e2,
+                fv[h + 1], e1, e0,
+                fv[h + 2], e2, e1,
+                e0, e1, e2
+            };
+            for (int k = 0; k < 12; k++)
+                facevert[12 * f + k] = tri[k];
+            for (int k = 1; k <= 4; k++)
+                facestart[4 * f + k] = static_cast<offset_t>(12 * f + 3 * k);
+        }
+    }, 1024);
+    facestart[0] = 0;
+
+    updateSum();
+}
@@ -0,0 +1,18 @@
+#ifndef __LOOP_H__
+#define __LOOP_H__
+
+#include "Mesh.h"
+
+/*
+ * Loop subdivision, every triangle is split into four. Faces with more
+ * corners are fan triangulated first. New vertices are the old vertex
+ * points followed by edge points. Boundaries follow the cubic B-spline curve rules
+ * */
+
+class Loop: public Mesh {
+    void build(const Mesh &m, Progress *progress);
+public:
+    Loop(const Mesh &m, Progress *progress = 0);
+};
+
+#endif
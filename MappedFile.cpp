@@ -0,0 +1,76 @@
+#include "MappedFile.h"
+
+#include <stdexcept>
+
+#ifdef _WINDOWS
+# include <windows.h>
+#else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#ifdef _WINDOWS
+
+MappedFile::MappedFile(const std::string &filename) : _data(0), _size(0), _file(0), _mapping(0) {
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::invalid_argument("Could not open file `" + filename + "'");
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        throw std::invalid_argument("Could not map empty file `" + filename + "'");
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        throw std::runtime_error("Could not map file `" + filename + "'");
+    }
+    const void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("Could not map file `" + filename + "'");
+    }
+    _file = file;
+    _mapping = mapping;
+    _data = static_cast<const char *>(view);
+    _size = static_cast<size_t>(size.QuadPart);
+}
+
+MappedFile::~MappedFile() {
+    UnmapViewOfFile(_data);
+    CloseHandle(_mapping);
+    CloseHandle(_file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &filename) : _data(0), _size(0), _fd(-1) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::invalid_argument("Could not open file `" + filename + "'");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::invalid_argument("Could not map empty file `" + filename + "'");
+    }
+    void *view = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Could not map file `" + filename + "'");
+    }
+    madvise(view, st.st_size, MADV_SEQUENTIAL);
+    _fd = fd;
+    _data = static_cast<const char *>(view);
+    _size = static_cast<size_t>(st.st_size);
+}
+
+MappedFile::~MappedFile() {
+    munmap(const_cast<char *>(_data), _size);
+    close(_fd);
+}
+
+#endif
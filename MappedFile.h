@@ -0,0 +1,30 @@
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include <string>
+#include <cstddef>
+
+/*
+ * Read-only view of a whole file mapped into memory
+ * */
+
+class MappedFile {
+    const char *_data;
+    size_t _size;
+#ifdef _WINDOWS
+    void *_file;
+    void *_mapping;
+#else
+    int _fd;
+#endif
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+public:
+    MappedFile(const std::string &filename);
+    ~MappedFile();
+    const char *data() const { return _data; }
+    const char *end() const { return _data + _size; }
+    size_t size() const { return _size; }
+};
+
+#endif
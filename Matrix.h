@@ -103,6 +103,11 @@ public:
     const float *data() const {
         return reinterpret_cast<const float *>(m);
     }
+    /* out = this * (p, 1) */
+    void transform(const Point &p, float out[4]) const {
+        for (int i = 0; i < 4; i++)
+            out[i] = m[i][0] * p.x + m[i][1] * p.y + m[i][2] * p.z + m[i][3];
+    }
 };
 
 struct IdentityMatrix : public Matrix {
@@ -1,6 +1,10 @@
 #include "Mesh.h"
 
 #include "Point.h"
+#include "Parallel.h"
+#include "Progress.h"
+#include "Adjacency.h"
+#include "PLY.h"
 
 #include <fstream>
 #include <stdexcept>
@@ -9,6 +13,12 @@
 #include <vector>
 #include <limits>
 #include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
 
 void Mesh::pushVertex(const Point &p) {
     _vert.push_back(p);
@@ -16,117 +26,172 @@ void Mesh::pushVertex(const Point &p) {
 }
 
 void Mesh::pushFace(const std::vector<int> &vs) {
-    int lastEnd = _facestart.back() + vs.size();
+    offset_t lastEnd = _facestart.back() + vs.size();
     _facestart.push_back(lastEnd);
     _facevert.insert(_facevert.end(), vs.begin(), vs.end());
     assert(_facevert.size() == (size_t)_facestart.back());
 }
 
-PLYMesh::PLYMesh(const std::string &filename) : Mesh(filename) {
-    std::string line;
-    std::fstream f(filename, std::ios::in);
-    if (!f)
-        throw std::invalid_argument("Could not read mesh file");
-    getline(f, line);
-    if (!startsWith(line, "ply"))
-        throw std::invalid_argument("Invalid PLY header");
-    getline(f, line);
-    if (!startsWith(line, "format ascii 1.0"))
-        throw std::invalid_argument("Only `format ascii 1.0' meshes are supported");
-    int nV, nF;
-    nV = nF = -1;
-    while (getline(f, line)) {
-        if (startsWith(line, "element")) {
-            std::stringstream ss(line);
-            std::string elem, type, count;
-            ss >> elem >> type >> count;
-            if (type == "vertex")
-                nV = atoi(count.c_str());
-            else if (type == "face")
-                nF = atoi(count.c_str());
-            else
-                throw std::invalid_argument(std::string("Unknown element type `") + type + "'");
+void Mesh::updateSum() {
+    _sum = Point(0, 0, 0);
+    for (auto p = _vert.begin(); p != _vert.end(); p++)
+        _sum += *p;
+}
+
+TriMesh::TriMesh(const Mesh &m, Progress *progress) : _v(m.verts()) {
+    const std::vector<offset_t> &fs = m.faceStarts();
+    const std::vector<index_t> &fv = m.faceVerts();
+    const size_t nF = m.numFaces();
+    /* Also checks that every face refers to existing vertices, before any of them is read */
+    const Adjacency adj(m);
+
+    /* Fan triangulation, triangles of face i start at fs[i] - 2i */
+    _f.resize(fv.size() - 2 * nF);
+    std::vector<Point> triNormal(_f.size());
+    parallelFor(nF, [this, &fs, &fv, &triNormal, progress] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            reportProgress(progress, i - begin, 2 * (end - begin));
+            offset_t b = fs[i];
+            int n = static_cast<int>(fs[i + 1] - b);
+            offset_t t = b - 2 * static_cast<offset_t>(i);
+            for (int j = 1; j < n - 1; j++, t++) {
+                _f[t] = Face(fv[b], fv[b + j], fv[b + j + 1]);
+                triNormal[t] = _f[t].normal(_v);
+            }
         }
-        /* TODO: parse properties properly */
-        if (startsWith(line, "end_header"))
-            break;
-    }
-    if (nV < 0 || nF < 0)
-        throw std::invalid_argument("No vertex or face element in mesh");
-    std::stringstream ss;
-    ss.exceptions(std::ios::failbit);
-    for (int i = 0; i < nV; i++) {
-        getline(f, line);
-        ss.str(line);
-        float x, y, z;
-        ss >> x >> y >> z;
-        ss.clear();
-        pushVertex(Point(x, y, z));
-    }
-    for (int i = 0; i < nF; i++) {
-        getline(f, line);
-        ss.str(line);
-        int n;
-        ss >> n;
-        if (n < 3)
-            throw std::invalid_argument("Face has less than 3 vertices");
-        std::vector<int> fs;
-        for (int j = 0; j < n; j++) {
-            int p;
-            ss >> p;
-            fs.push_back(p);
+    }, 1024);
+
+    /* Every vertex gathers the normals of its triangles, in the same order they were scattered before */
+    std::vector<Point> _n(_v.size());
+    parallelFor(_v.size(), [&adj, &fs, &fv, &triNormal, &_n, progress] (size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            reportProgress(progress, end - begin + v - begin, 2 * (end - begin));
+            Point sum(0, 0, 0);
+            for (const int *f = adj.facesBegin(v); f != adj.facesEnd(v); f++) {
+                offset_t b = fs[*f];
+                int n = static_cast<int>(fs[*f + 1] - b);
+                offset_t t0 = b - 2 * static_cast<offset_t>(*f);
+                for (int j = 0; j < n; j++) {
+                    if (fv[b + j] != static_cast<int>(v))
+                        continue;
+                    if (j == 0) {
+                        for (int t = 0; t < n - 2; t++)
+                            sum += triNormal[t0 + t];
+                        continue;
+                    }
+                    if (j >= 2)
+                        sum += triNormal[t0 + j - 2];
+                    if (j <= n - 2)
+                        sum += triNormal[t0 + j - 1];
+                }
+            }
+            sum.normalize();
+            _n[v] = sum;
         }
-        pushFace(fs);
-        ss.clear();
-    }
+    }, 1024);
+    _v.insert(_v.end(), _n.begin(), _n.end());
 }
 
-TriMesh::TriMesh(const Mesh &m) : _v(m.verts()) {
-    std::vector<Point> _n(_v.size(), Point(0, 0, 0));
-    for (size_t i = 0; i < m.numFaces(); i++) {
-        const PolyFace &pf = m.face(i);
-        std::vector<int> face(pf.begin, pf.end);
-        int p1 = face[0];
-        for (size_t j = 1; j < face.size() - 1; j++) {
-            int p2 = face[j];
-            int p3 = face[j + 1];
-            const Face &f = Face(p1, p2, p3);
-            _f.push_back(f);
-            const Point norm = f.normal(_v);
-            _n[p1] += norm;
-            _n[p2] += norm;
-            _n[p3] += norm;
-        }
+size_t TriMesh::faceOfTriangle(const Mesh &m, size_t t) {
+    /* Triangles of face i start at fs[i] - 2i, which never decreases */
+    const std::vector<offset_t> &fs = m.faceStarts();
+    size_t lo = 0;
+    size_t hi = m.numFaces();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (static_cast<size_t>(fs[mid]) - 2 * mid <= t)
+            lo = mid;
+        else
+            hi = mid;
     }
-    for (size_t i = 0; i < _n.size(); i++) {
-        _n[i].normalize();
+    return lo;
+}
+
+namespace {
+
+/*
+ * Formats items [0, n) in blocks of fixed size on all cores and writes the
+ * blocks in order. Block boundaries do not depend on the thread count, so
+ * neither does the output
+ * */
+template<class F>
+void writeBlocks(std::ostream &f, size_t n, size_t blockSize, F format) {
+    const size_t numBlocks = (n + blockSize - 1) / blockSize;
+    const size_t batch = 4 * numThreads();
+    std::vector<std::string> bufs(std::min(batch, numBlocks));
+    for (size_t first = 0; first < numBlocks; first += batch) {
+        size_t count = std::min(batch, numBlocks - first);
+        parallelFor(count, [&bufs, &format, first, n, blockSize] (size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++) {
+                size_t from = (first + k) * blockSize;
+                bufs[k].clear();
+                format(from, std::min(from + blockSize, n), bufs[k]);
+            }
+        }, 1);
+        for (size_t k = 0; k < count; k++)
+            f.write(bufs[k].data(), bufs[k].size());
     }
-    _v.insert(_v.end(), _n.begin(), _n.end());
 }
 
-void Mesh::save(const std::string &fn) const {
-    std::fstream f(fn, std::ios::out);
+}
+
+void Mesh::save(const std::string &fn, bool binary) const {
+    std::fstream f(fn, std::ios::out | std::ios::binary);
     if (!f)
         throw std::invalid_argument("Open file `" + fn + "' failed");
 
-    f << "ply\n";
-    f << "format ascii 1.0\n";
-    f << "comment Mesh::save()\n";
-    f << "element vertex " << numVertices() << std::endl;
-    f << "property float x\n";
-    f << "property float y\n";
-    f << "property float z\n";
-    f << "element face " << numFaces() << std::endl;
-    f << "property list uchar int vertex_indices\n";
-    f << "end_header\n";
-    for (auto p = verts().begin(); p != verts().end(); p++)
-        f << p->x << " " << p->y << " " << p->z << std::endl;
-    for (size_t i = 0; i < numFaces(); i++) {
-        PolyFace pf = face(i);
-        int n = pf.end - pf.begin;
-        f << n;
-        for (int j = 0; j < n; j++)
-            f << " " << *(pf.begin + j);
-        f << std::endl;
+    size_t maxOrder = 0;
+    for (size_t i = 0; i < numFaces(); i++)
+        maxOrder = std::max(maxOrder, static_cast<size_t>(_facestart[i + 1] - _facestart[i]));
+    const bool byteCount = maxOrder <= std::numeric_limits<unsigned char>::max();
+
+    f << plyMeshHeader(binary, numVertices(), numFaces(), byteCount, "Mesh::save()");
+
+    const size_t blockSize = 1 << 14;
+    if (binary) {
+        if (!hostIsBigEndian())
+            f.write(reinterpret_cast<const char *>(_vert.data()), _vert.size() * sizeof(Point));
+        else
+            writeBlocks(f, numVertices(), blockSize, [this] (size_t begin, size_t end, std::string &out) {
+                for (size_t i = begin; i < end; i++) {
+                    plyAppendLittleEndian(out, _vert[i].x);
+                    plyAppendLittleEndian(out, _vert[i].y);
+                    plyAppendLittleEndian(out, _vert[i].z);
+                }
+            });
+        writeBlocks(f, numFaces(), blockSize, [this, byteCount] (size_t begin, size_t end, std::string &out) {
+            for (size_t i = begin; i < end; i++) {
+                int n = static_cast<int>(_facestart[i + 1] - _facestart[i]);
+                if (byteCount)
+                    out.push_back(static_cast<char>(n));
+                else
+                    plyAppendLittleEndian(out, n);
+                for (offset_t j = _facestart[i]; j < _facestart[i + 1]; j++)
+                    plyAppendLittleEndian(out, _facevert[j]);
+            }
+        });
+    } else {
+        writeBlocks(f, numVertices(), blockSize, [this] (size_t begin, size_t end, std::string &out) {
+            for (size_t i = begin; i < end; i++) {
+                plyAppendFloat(out, _vert[i].x);
+                out.push_back(' ');
+                plyAppendFloat(out, _vert[i].y);
+                out.push_back(' ');
+                plyAppendFloat(out, _vert[i].z);
+                out.push_back('\n');
+            }
+        });
+        writeBlocks(f, numFaces(), blockSize, [this] (size_t begin, size_t end, std::string &out) {
+            for (size_t i = begin; i < end; i++) {
+                plyAppendInt(out, static_cast<int>(_facestart[i + 1] - _facestart[i]));
+                for (offset_t j = _facestart[i]; j < _facestart[i + 1]; j++) {
+                    out.push_back(' ');
+                    plyAppendInt(out, _facevert[j]);
+                }
+                out.push_back('\n');
+            }
+        });
     }
+    if (!f)
+        throw std::runtime_error("Writing file `" + fn + "' failed");
 }
@@ -5,11 +5,26 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
+
+/*
+ * Vertex numbers take 32 bits, enough for the about 2G vertices of a
+ * closed mesh with 4G triangles. Positions in the face corner arrays
+ * outgrow that first, a few refinements of a large scan pass 2^31 corners,
+ * so they take 64 bits.
+ *
+ * Triangles of a TriMesh are numbered in 32 bits like vertices. Trees,
+ * draw ranges, meshlets and ray hits refer to them by int, the width GL
+ * takes for draw offsets and counts anyway, and throw past 2^31 triangles.
+ * Larger refinements are streamed to disk by StreamingDooSabin
+ * */
+typedef int32_t index_t;
+typedef int64_t offset_t;
 
 struct Face {
-    int v1, v2, v3;
+    index_t v1, v2, v3;
     Face() { }
-    Face(int v1, int v2, int v3) : v1(v1), v2(v2), v3(v3) { }
+    Face(index_t v1, index_t v2, index_t v3) : v1(v1), v2(v2), v3(v3) { }
     Point normal(const std::vector<Point> &ps) const {
         const Point &p1 = ps[v1];
         const Point &p2 = ps[v2];
@@ -23,9 +38,9 @@ struct Face {
 };
 
 struct PolyFace {
-    std::vector<int>::const_iterator begin;
-    std::vector<int>::const_iterator end;
-    PolyFace(const size_t f, const std::vector<int> &fs, const std::vector<int> &fv) {
+    std::vector<index_t>::const_iterator begin;
+    std::vector<index_t>::const_iterator end;
+    PolyFace(const size_t f, const std::vector<offset_t> &fs, const std::vector<index_t> &fv) {
         begin = fv.begin() + fs[f];
         end   = fv.begin() + fs[f + 1];
     }
@@ -33,8 +48,8 @@ struct PolyFace {
 
 class Mesh {
     std::vector<Point> _vert;
-    std::vector<int> _facestart;
-    std::vector<int> _facevert;
+    std::vector<offset_t> _facestart;
+    std::vector<index_t> _facevert;
 
     Point _sum;
 
@@ -43,7 +58,7 @@ public:
     Mesh(const std::string &filename) : _sum(0, 0, 0), _filename(filename) {
         _facestart.push_back(0);
     }
-    void save(const std::string &fn) const;
+    void save(const std::string &fn, bool binary = false) const;
     std::string filename() const { return _filename; }
     size_t numVertices() const { return _vert.size(); }
     size_t numFaces() const { return _facestart.size() - 1; }
@@ -54,19 +69,29 @@ public:
 
     const std::vector<Point> &verts() const { return _vert; }
     const Point &vert(size_t idx) const { return verts()[idx]; }
+    const std::vector<offset_t> &faceStarts() const { return _facestart; }
+    const std::vector<index_t> &faceVerts() const { return _facevert; }
     PolyFace face(size_t idx) const { return PolyFace(idx, _facestart, _facevert); }
 
 protected:
     void pushVertex(const Point &p);
     void pushFace(const std::vector<int> &vs);
+
+    /* Direct access for loaders filling the arrays in bulk. Call updateSum() afterwards */
+    std::vector<Point> &vertData() { return _vert; }
+    std::vector<offset_t> &faceStartData() { return _facestart; }
+    std::vector<index_t> &faceVertData() { return _facevert; }
+    void updateSum();
 };
 
+struct PLYSchema;
+class Progress;
+
 class PLYMesh : public Mesh {
-    bool startsWith(const std::string &line, const std::string &prefix) {
-        return 0 == line.compare(0, prefix.size(), prefix);
-    }
+    void readAscii(const PLYSchema &schema, const char *p, const char *end, Progress *progress);
+    void readBinary(const PLYSchema &schema, const char *p, const char *end, Progress *progress);
 public:
-    PLYMesh(const std::string &filename);
+    PLYMesh(const std::string &filename, Progress *progress = 0);
 };
 
 class TriMesh {
@@ -75,7 +100,19 @@ class TriMesh {
 public:
     const std::vector<Point> &vertsWithNormals() const { return _v; }
     const std::vector<Face> &faces() const { return _f; }
-    TriMesh(const Mesh &m);
+    TriMesh(const Mesh &m, Progress *progress = 0);
+    TriMesh(const Point *vertsWithNormals, size_t numVertices, const Face *faces, size_t numFaces)
+        : _v(vertsWithNormals, vertsWithNormals + 2 * numVertices), _f(faces, faces + numFaces) { }
+    size_t numVertices() const { return _v.size() / 2; }
+
+    /* Face of m whose fan holds triangle t of TriMesh(m) */
+    static size_t faceOfTriangle(const Mesh &m, size_t t);
+
+protected:
+    TriMesh() { }
+    /* Direct access for tessellators filling the arrays in bulk. Positions go first, then normals */
+    std::vector<Point> &vertData() { return _v; }
+    std::vector<Face> &faceData() { return _f; }
 };
 
 #endif
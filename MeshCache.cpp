@@ -0,0 +1,266 @@
+#include "MeshCache.h"
+
+#include "AABBTree.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+const char cacheMagic[8] = {'M', 'E', 'S', 'H', 'C', 'A', 'C', 'H'};
+const uint32_t cacheVersion = 3;
+const uint32_t byteOrderMark = 0x01020304;
+const size_t sectionAlign = 64;
+const size_t hashBlock = 1 << 20;
+
+enum Section {
+    VERTS, FACESTART, FACEVERT, TRIVERTS, TRIFACES, NODES, TREEFACES, NUM_SECTIONS
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    uint64_t count[NUM_SECTIONS];
+    uint64_t offset[NUM_SECTIONS];
+};
+
+const size_t itemSize[NUM_SECTIONS] = {
+    sizeof(Point), sizeof(offset_t), sizeof(index_t), sizeof(Point), sizeof(Face), sizeof(AABBTree::Node), sizeof(int)
+};
+
+inline uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hashBytes(const char *p, size_t n, uint64_t seed) {
+    uint64_t h = mix(seed ^ n);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ mix(w)) * 0x9e3779b97f4a7c15ULL;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + i, n - i);
+    return mix(h ^ tail);
+}
+
+/* Whether all n values lie in [0, limit) */
+template<class T>
+bool allBelow(const T *v, size_t n, uint64_t limit) {
+    std::atomic<bool> ok(true);
+    parallelFor(n, [v, limit, &ok] (size_t begin, size_t end) {
+        bool good = true;
+        for (size_t i = begin; i < end; i++)
+            good &= v[i] >= 0 && static_cast<uint64_t>(v[i]) < limit;
+        if (!good)
+            ok = false;
+    });
+    return ok;
+}
+
+/* Whether v[0 .. n) never decreases */
+bool ascending(const offset_t *v, size_t n) {
+    std::atomic<bool> ok(true);
+    parallelFor(n > 0 ? n - 1 : 0, [v, &ok] (size_t begin, size_t end) {
+        bool good = true;
+        for (size_t i = begin; i < end; i++)
+            good &= v[i] <= v[i + 1];
+        if (!good)
+            ok = false;
+    });
+    return ok;
+}
+
+/*
+ * Copies the sections out of the mapping. Mesh, TriMesh and AABBTree own
+ * their arrays, which outlive the file and are used by the viewer and the
+ * subdivision schemes alike, so they are not served from the mapping
+ * */
+class CachedMesh : public Mesh {
+public:
+    CachedMesh(const std::string &filename, const Header &h, const char *data) : Mesh(filename) {
+        const Point *verts = reinterpret_cast<const Point *>(data + h.offset[VERTS]);
+        const offset_t *facestart = reinterpret_cast<const offset_t *>(data + h.offset[FACESTART]);
+        const index_t *facevert = reinterpret_cast<const index_t *>(data + h.offset[FACEVERT]);
+        vertData().assign(verts, verts + h.count[VERTS]);
+        faceStartData().assign(facestart, facestart + h.count[FACESTART]);
+        faceVertData().assign(facevert, facevert + h.count[FACEVERT]);
+        updateSum();
+    }
+};
+
+}
+
+uint64_t MeshCache::hashFile(const std::string &source, uint64_t &size) {
+    MappedFile file(source);
+    size = file.size();
+    /* Fixed block size keeps the hash independent of the thread count */
+    size_t numBlocks = (file.size() + hashBlock - 1) / hashBlock;
+    std::vector<uint64_t> blockHash(numBlocks);
+    parallelFor(numBlocks, [&file, &blockHash] (size_t begin, size_t end) {
+        for (size_t b = begin; b < end; b++) {
+            size_t from = b * hashBlock;
+            size_t len = std::min(hashBlock, file.size() - from);
+            blockHash[b] = hashBytes(file.data() + from, len, b);
+        }
+    }, 1);
+    return hashBytes(reinterpret_cast<const char *>(blockHash.data()), numBlocks * sizeof(uint64_t), size);
+}
+
+std::string MeshCache::localPath(const std::string &source) {
+    return source + ".meshcache";
+}
+
+std::string MeshCache::sharedPath(const std::string &source, uint64_t hash) {
+    const char *dir = getenv("MESHVIEW_CACHE_DIR");
+    if (!dir || !*dir)
+        return std::string();
+    size_t slash = source.find_last_of("/\\");
+    std::string base = slash == std::string::npos ? source : source.substr(slash + 1);
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return std::string(dir) + "/" + base + "." + hex + ".meshcache";
+}
+
+bool MeshCache::load(const std::string &source, uint64_t hash, uint64_t size,
+        std::unique_ptr<Mesh> &mesh, std::unique_ptr<TriMesh> &tri, std::unique_ptr<AABBTree> &tree)
+{
+    std::string shared = sharedPath(source, hash);
+    return tryLoad(localPath(source), source, hash, size, mesh, tri, tree) ||
+        (!shared.empty() && tryLoad(shared, source, hash, size, mesh, tri, tree));
+}
+
+void MeshCache::store(const std::string &source, uint64_t hash, uint64_t size,
+        const Mesh &mesh, const TriMesh &tri, const AABBTree &tree)
+{
+    if (tryStore(localPath(source), hash, size, mesh, tri, tree))
+        return;
+    std::string shared = sharedPath(source, hash);
+    if (shared.empty() || !tryStore(shared, hash, size, mesh, tri, tree))
+        std::cerr << "Could not write mesh cache for `" << source << "'" << std::endl;
+}
+
+bool MeshCache::tryLoad(const std::string &path, const std::string &source, uint64_t hash, uint64_t size,
+        std::unique_ptr<Mesh> &mesh, std::unique_ptr<TriMesh> &tri, std::unique_ptr<AABBTree> &tree)
+{
+    std::unique_ptr<MappedFile> file;
+    try {
+        file.reset(new MappedFile(path));
+    } catch (std::exception &) {
+        return false;
+    }
+    if (file->size() < sizeof(Header))
+        return false;
+    Header h;
+    memcpy(&h, file->data(), sizeof(Header));
+    if (memcmp(h.magic, cacheMagic, sizeof(cacheMagic)) || h.version != cacheVersion ||
+            h.byteOrder != byteOrderMark || h.sourceHash != hash || h.sourceSize != size)
+        return false;
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        if (h.offset[s] % sectionAlign || h.offset[s] > file->size() ||
+                h.count[s] > (file->size() - h.offset[s]) / itemSize[s])
+            return false;
+    }
+    const offset_t *facestart = reinterpret_cast<const offset_t *>(file->data() + h.offset[FACESTART]);
+    if (h.count[FACESTART] == 0 || facestart[0] != 0 ||
+            static_cast<uint64_t>(facestart[h.count[FACESTART] - 1]) != h.count[FACEVERT] ||
+            h.count[TRIVERTS] != 2 * h.count[VERTS] ||
+            h.count[TREEFACES] != h.count[TRIFACES])
+        return false;
+    /* A corrupt or stale file must not make the mesh read outside its arrays */
+    if (!ascending(facestart, h.count[FACESTART]) ||
+            !allBelow(reinterpret_cast<const index_t *>(file->data() + h.offset[FACEVERT]), h.count[FACEVERT], h.count[VERTS]) ||
+            !allBelow(reinterpret_cast<const index_t *>(file->data() + h.offset[TRIFACES]), 3 * h.count[TRIFACES], h.count[VERTS]) ||
+            !allBelow(reinterpret_cast<const int *>(file->data() + h.offset[TREEFACES]), h.count[TREEFACES], h.count[TRIFACES]))
+        return false;
+
+    try {
+        tree.reset(new AABBTree(reinterpret_cast<const AABBTree::Node *>(file->data() + h.offset[NODES]), h.count[NODES],
+                    reinterpret_cast<const int *>(file->data() + h.offset[TREEFACES]), h.count[TREEFACES]));
+    } catch (std::invalid_argument &) {
+        return false;
+    }
+    mesh.reset(new CachedMesh(source, h, file->data()));
+    tri.reset(new TriMesh(reinterpret_cast<const Point *>(file->data() + h.offset[TRIVERTS]), h.count[VERTS],
+                reinterpret_cast<const Face *>(file->data() + h.offset[TRIFACES]), h.count[TRIFACES]));
+    return true;
+}
+
+bool MeshCache::tryStore(const std::string &path, uint64_t hash, uint64_t size,
+        const Mesh &mesh, const TriMesh &tri, const AABBTree &tree)
+{
+    const char *data[NUM_SECTIONS] = {
+        reinterpret_cast<const char *>(mesh.verts().data()),
+        reinterpret_cast<const char *>(mesh.faceStarts().data()),
+        reinterpret_cast<const char *>(mesh.faceVerts().data()),
+        reinterpret_cast<const char *>(tri.vertsWithNormals().data()),
+        reinterpret_cast<const char *>(tri.faces().data()),
+        reinterpret_cast<const char *>(tree.nodes().data()),
+        reinterpret_cast<const char *>(tree.faces().data())
+    };
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, cacheMagic, sizeof(cacheMagic));
+    h.version = cacheVersion;
+    h.byteOrder = byteOrderMark;
+    h.sourceHash = hash;
+    h.sourceSize = size;
+    h.count[VERTS] = mesh.verts().size();
+    h.count[FACESTART] = mesh.faceStarts().size();
+    h.count[FACEVERT] = mesh.faceVerts().size();
+    h.count[TRIVERTS] = tri.vertsWithNormals().size();
+    h.count[TRIFACES] = tri.faces().size();
+    h.count[NODES] = tree.nodes().size();
+    h.count[TREEFACES] = tree.faces().size();
+    uint64_t offset = sizeof(Header);
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        offset = (offset + sectionAlign - 1) / sectionAlign * sectionAlign;
+        h.offset[s] = offset;
+        offset += h.count[s] * itemSize[s];
+    }
+
+    /* Write to a temporary file first, so readers never see a partial cache */
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::out | std::ios::binary);
+        if (!f)
+            return false;
+        const char zeros[sectionAlign] = {0};
+        f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        uint64_t pos = sizeof(Header);
+        for (int s = 0; s < NUM_SECTIONS; s++) {
+            f.write(zeros, h.offset[s] - pos);
+            f.write(data[s], h.count[s] * itemSize[s]);
+            pos = h.offset[s] + h.count[s] * itemSize[s];
+        }
+        if (!f) {
+            f.close();
+            remove(tmp.c_str());
+            return false;
+        }
+    }
+    remove(path.c_str());
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
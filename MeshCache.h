@@ -0,0 +1,34 @@
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include "Mesh.h"
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+class AABBTree;
+
+/*
+ * Preprocessed mesh, triangulation and bounding box tree stored in a
+ * native binary file. The cache goes next to the source file as
+ * <source>.meshcache, or to $MESHVIEW_CACHE_DIR if that one is not writable.
+ * A cache is valid only for the source with the same size and content hash
+ * */
+
+class MeshCache {
+    static std::string localPath(const std::string &source);
+    static std::string sharedPath(const std::string &source, uint64_t hash);
+    static bool tryLoad(const std::string &path, const std::string &source, uint64_t hash, uint64_t size,
+            std::unique_ptr<Mesh> &mesh, std::unique_ptr<TriMesh> &tri, std::unique_ptr<AABBTree> &tree);
+    static bool tryStore(const std::string &path, uint64_t hash, uint64_t size,
+            const Mesh &mesh, const TriMesh &tri, const AABBTree &tree);
+public:
+    static uint64_t hashFile(const std::string &source, uint64_t &size);
+    static bool load(const std::string &source, uint64_t hash, uint64_t size,
+            std::unique_ptr<Mesh> &mesh, std::unique_ptr<TriMesh> &tri, std::unique_ptr<AABBTree> &tree);
+    static void store(const std::string &source, uint64_t hash, uint64_t size,
+            const Mesh &mesh, const TriMesh &tri, const AABBTree &tree);
+};
+
+#endif
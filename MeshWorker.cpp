@@ -0,0 +1,82 @@
+#include "MeshWorker.h"
+#include "VertexCache.h"
+#include "Parallel.h"
+
+#include <cstdint>
+#include <cstring>
+
+MeshWorker::MeshWorker(const std::string &name, const Job &job) : _name(name), _done(false) {
+    _thread = std::thread([this, job] () {
+        try {
+            job(_progress, _result);
+        } catch (Progress::Cancelled &) {
+            _error = "cancelled";
+        } catch (std::exception &e) {
+            _error = e.what();
+        }
+        if (!_error.empty())
+            _result = Result();
+        _done = true;
+    });
+}
+
+MeshWorker::~MeshWorker() {
+    cancel();
+    _thread.join();
+}
+
+void MeshWorker::prepareBuffers(Result &r, const TriMesh &m, const AABBTree &tree, const Point &center,
+        VertexFormat::Layout layout, bool vertexCache, Progress &progress) {
+    const std::vector<Face> &faceData = m.faces();
+    const size_t numVertices = m.vertsWithNormals().size() / 2;
+
+    /* Every subtree of the tree becomes one contiguous range of indices */
+    progress.stage("Draw ranges");
+    const std::vector<int> &order = tree.faces();
+    std::vector<Face> treeOrder(order.size());
+    parallelFor(order.size(), [&treeOrder, &faceData, &order] (size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++)
+            treeOrder[k] = faceData[order[k]];
+    });
+    r.ranges.reset(new DrawRanges(tree));
+
+    /* Clusters are drawn whole, reordering inside them for the vertex cache keeps every drawn range intact */
+    std::vector<int> clusterFirst, clusterCount;
+    r.ranges->clusters(clusterFirst, clusterCount);
+    if (vertexCache) {
+        progress.stage("Vertex cache order");
+        VertexCache::optimizeRanges(treeOrder.data(), clusterFirst, clusterCount);
+    }
+    progress.stage("Meshlets");
+    r.meshlets.reset(new Meshlets(m, center, treeOrder.data(), clusterFirst, clusterCount, &progress));
+    std::vector<int> fetchOrder;
+    if (vertexCache) {
+        fetchOrder = VertexCache::orderVertices(treeOrder.data(), treeOrder.size(), numVertices);
+    } else {
+        fetchOrder.resize(numVertices);
+        for (size_t v = 0; v < numVertices; v++)
+            fetchOrder[v] = static_cast<int>(v);
+    }
+    progress.stage("Vertex buffer");
+    r.layout = layout;
+    VertexFormat::pack(layout, m, fetchOrder, r.vertices, r.positionOffset, r.positionScale);
+
+    /* Small meshes get 16 bit indices, half the index memory and fetch bandwidth */
+    if (numVertices < 65536) {
+        r.indexSize = sizeof(uint16_t);
+        r.indices.resize(3 * treeOrder.size() * r.indexSize);
+        uint16_t *shortOrder = reinterpret_cast<uint16_t *>(r.indices.data());
+        parallelFor(treeOrder.size(), [shortOrder, &treeOrder] (size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++) {
+                shortOrder[3 * k] = static_cast<uint16_t>(treeOrder[k].v1);
+                shortOrder[3 * k + 1] = static_cast<uint16_t>(treeOrder[k].v2);
+                shortOrder[3 * k + 2] = static_cast<uint16_t>(treeOrder[k].v3);
+            }
+        });
+    } else {
+        r.indexSize = sizeof(uint32_t);
+        r.indices.resize(3 * treeOrder.size() * r.indexSize);
+        if (!treeOrder.empty())
+            std::memcpy(r.indices.data(), treeOrder.data(), r.indices.size());
+    }
+}
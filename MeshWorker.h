@@ -0,0 +1,71 @@
+#ifndef __MESHWORKER_H__
+#define __MESHWORKER_H__
+
+#include "Mesh.h"
+#include "AABBTree.h"
+#include "Culling.h"
+#include "Meshlets.h"
+#include "VertexFormat.h"
+#include "Progress.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Runs mesh loading or refinement on a background thread. The result is
+ * picked up by the render thread once done() turns true, with the draw
+ * buffers of its triangles ready for upload
+ * */
+
+class MeshWorker {
+public:
+    struct Result {
+        std::unique_ptr<Mesh> mesh;
+        std::unique_ptr<TriMesh> tri;
+        std::unique_ptr<AABBTree> tree;
+
+        /* Triangles in tree order, the index buffer holds 16 bit indices below 65536 vertices */
+        std::unique_ptr<DrawRanges> ranges;
+        std::unique_ptr<Meshlets> meshlets;
+        VertexFormat::Layout layout;
+        std::vector<char> vertices;
+        Point positionOffset;
+        Point positionScale;
+        std::vector<char> indices;
+        size_t indexSize;
+    };
+    typedef std::function<void(Progress &, Result &)> Job;
+
+    /*
+     * Fills the draw buffers of r for the triangles m and their tree. With
+     * vertexCache, triangles and vertices are reordered for the GPU caches
+     * */
+    static void prepareBuffers(Result &r, const TriMesh &m, const AABBTree &tree, const Point &center,
+        VertexFormat::Layout layout, bool vertexCache, Progress &progress);
+private:
+    std::string _name;
+    Progress _progress;
+    Result _result;
+    std::string _error;
+    std::atomic<bool> _done;
+    std::thread _thread;
+
+    MeshWorker(const MeshWorker &) = delete;
+    MeshWorker &operator=(const MeshWorker &) = delete;
+public:
+    MeshWorker(const std::string &name, const Job &job);
+    ~MeshWorker();
+    const std::string &name() const { return _name; }
+    bool done() const { return _done; }
+    void cancel() { _progress.cancel(); }
+    const Progress &progress() const { return _progress; }
+    /* Valid after done() */
+    const std::string &error() const { return _error; }
+    Result &result() { return _result; }
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "Meshlets.h"
+#include "Culling.h"
+#include "Parallel.h"
+#include "Box.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+inline float dot(const Point &a, const Point &b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+/* Whether corner i repeats a vertex of an earlier corner of its triangle */
+inline bool repeats(const int *corner, int i) {
+    const int *c = corner + i / 3 * 3;
+    return (i % 3 >= 1 && corner[i] == c[0]) || (i % 3 == 2 && corner[i] == c[1]);
+}
+
+inline int distinct(const int *c) {
+    return 1 + (c[1] != c[0]) + (c[2] != c[0] && c[2] != c[1]);
+}
+
+/* Sphere and normal cone of faces [0, n), which use the numUsed vertices in used */
+Meshlets::Meshlet bound(const std::vector<Point> &vertexData, const Point &center,
+        const Face *faces, int n, const int *used, int numUsed)
+{
+    Meshlets::Meshlet m;
+    m.count = n;
+    m.numVertices = numUsed;
+
+    /* Centered on the box, the radius reaches the farthest vertex */
+    AABB box;
+    for (int i = 0; i < numUsed; i++)
+        box.add(Point(vertexData[used[i]], center));
+    m.center = Point(0.5f * (box.x1 + box.x2), 0.5f * (box.y1 + box.y2), 0.5f * (box.z1 + box.z2));
+    float r2 = 0;
+    for (int i = 0; i < numUsed; i++) {
+        Point d(Point(vertexData[used[i]], center), m.center);
+        r2 = std::max(r2, dot(d, d));
+    }
+    m.radius = std::sqrt(r2);
+
+    /* Axis along the mean unit normal, degenerate triangles have none and are left out */
+    Point normal[Meshlets::MAX_TRIANGLES];
+    int numNormals = 0;
+    Point sum(0, 0, 0);
+    for (int i = 0; i < n; i++) {
+        Point q = faces[i].normal(vertexData);
+        float len = std::sqrt(dot(q, q));
+        if (!(len > 0))
+            continue;
+        q = (1 / len) * q;
+        normal[numNormals++] = q;
+        sum += q;
+    }
+    float len = std::sqrt(dot(sum, sum));
+    float minDot = 0;
+    if (len > 0) {
+        sum = (1 / len) * sum;
+        minDot = 1;
+        for (int i = 0; i < numNormals; i++)
+            minDot = std::min(minDot, dot(normal[i], sum));
+    }
+    if (minDot <= 0) {
+        m.axis = Point(0, 0, 0);
+        m.cutoff = 1;
+    } else {
+        m.axis = sum;
+        m.cutoff = std::sqrt(1 - minDot * minDot);
+    }
+    return m;
+}
+
+}
+
+Meshlets::Meshlets(const TriMesh &m, const Point &center, Face *faces,
+        const std::vector<int> &first, const std::vector<int> &count, Progress *progress)
+{
+    const std::vector<Point> &vertexData = m.vertsWithNormals();
+    std::vector<std::vector<Meshlet> > parts(first.size());
+    parallelFor(first.size(), [&vertexData, &center, faces, &first, &count, &parts, progress] (size_t begin, size_t end) {
+        std::vector<int> local, corner, start, fill, around, missing, candidates, members;
+        std::vector<char> joined, taken, seen;
+        std::vector<Face> grouped;
+        int used[MAX_VERTICES];
+        for (size_t r = begin; r < end; r++) {
+            reportProgress(progress, r - begin, end - begin);
+            Face *f = faces + first[r];
+            const int n = count[r];
+
+            /* Range local vertex numbers and the triangles around each of them */
+            local.clear();
+            for (int i = 0; i < n; i++) {
+                local.push_back(f[i].v1);
+                local.push_back(f[i].v2);
+                local.push_back(f[i].v3);
+            }
+            corner.assign(local.begin(), local.end());
+            std::sort(local.begin(), local.end());
+            local.erase(std::unique(local.begin(), local.end()), local.end());
+            const int nV = static_cast<int>(local.size());
+            /* Corners repeating a vertex of their triangle are left out of the lists */
+            start.assign(nV + 1, 0);
+            for (int i = 0; i < 3 * n; i++) {
+                corner[i] = static_cast<int>(std::lower_bound(local.begin(), local.end(), corner[i]) - local.begin());
+                if (!repeats(corner.data(), i))
+                    start[corner[i] + 1]++;
+            }
+            for (int v = 0; v < nV; v++)
+                start[v + 1] += start[v];
+            fill.assign(start.begin(), start.end() - 1);
+            around.resize(start[nV]);
+            for (int i = 0; i < 3 * n; i++)
+                if (!repeats(corner.data(), i))
+                    around[fill[corner[i]]++] = i / 3;
+
+            /* Distinct vertices of every triangle not in the current meshlet yet */
+            missing.resize(n);
+            for (int i = 0; i < n; i++)
+                missing[i] = distinct(corner.data() + 3 * i);
+            joined.assign(nV, 0);
+            taken.assign(n, 0);
+            seen.assign(n, 0);
+            grouped.clear();
+
+            /*
+             * Every meshlet grows from the first triangle left, taking the triangle
+             * next to it with the fewest new vertices, the earlier one on ties.
+             * Inside a meshlet triangles keep their order
+             * */
+            for (int seed = 0; seed < n; seed++) {
+                if (taken[seed])
+                    continue;
+                members.clear();
+                candidates.clear();
+                int numUsed = 0;
+                for (int t = seed; t >= 0;) {
+                    taken[t] = 1;
+                    members.push_back(t);
+                    for (int j = 0; j < 3; j++) {
+                        const int v = corner[3 * t + j];
+                        if (joined[v])
+                            continue;
+                        joined[v] = 1;
+                        used[numUsed++] = v;
+                        for (int k = start[v]; k < start[v + 1]; k++) {
+                            const int a = around[k];
+                            if (taken[a])
+                                continue;
+                            missing[a]--;
+                            if (!seen[a]) {
+                                seen[a] = 1;
+                                candidates.push_back(a);
+                            }
+                        }
+                    }
+                    t = -1;
+                    if (static_cast<int>(members.size()) == MAX_TRIANGLES)
+                        break;
+                    for (size_t k = 0; k < candidates.size(); k++) {
+                        const int a = candidates[k];
+                        if (!taken[a] && numUsed + missing[a] <= MAX_VERTICES &&
+                                (t < 0 || missing[a] < missing[t] || (missing[a] == missing[t] && a < t)))
+                            t = a;
+                    }
+                }
+
+                /* Triangles left out see the vertices of this meshlet as missing again */
+                for (size_t k = 0; k < candidates.size(); k++) {
+                    const int a = candidates[k];
+                    seen[a] = 0;
+                    if (!taken[a])
+                        missing[a] = distinct(corner.data() + 3 * a);
+                }
+                for (int i = 0; i < numUsed; i++) {
+                    joined[used[i]] = 0;
+                    used[i] = local[used[i]];
+                }
+
+                std::sort(members.begin(), members.end());
+                const size_t firstGrouped = grouped.size();
+                for (size_t k = 0; k < members.size(); k++)
+                    grouped.push_back(f[members[k]]);
+                parts[r].push_back(bound(vertexData, center, grouped.data() + firstGrouped,
+                    static_cast<int>(members.size()), used, numUsed));
+                parts[r].back().first = first[r] + static_cast<int>(firstGrouped);
+            }
+            std::copy(grouped.begin(), grouped.end(), f);
+        }
+    }, 16);
+
+    size_t total = 0;
+    for (size_t r = 0; r < parts.size(); r++)
+        total += parts[r].size();
+    _meshlets.reserve(total);
+    for (size_t r = 0; r < parts.size(); r++)
+        _meshlets.insert(_meshlets.end(), parts[r].begin(), parts[r].end());
+}
+
+bool Meshlets::facesAway(const Meshlet &m, const Point &eye) {
+    Point d(m.center, eye);
+    return dot(d, m.axis) >= m.cutoff * std::sqrt(dot(d, d)) + m.radius;
+}
+
+size_t Meshlets::cull(const Frustum &f, const Point &eye, bool cones, std::vector<int> &first, std::vector<int> &count,
+        size_t *backFacing) const {
+    std::vector<int> keptFirst, keptCount;
+    size_t visible = 0;
+    if (backFacing)
+        *backFacing = 0;
+
+    /* Ranges ascend, so the meshlets of each one start where the last one left off */
+    auto k = _meshlets.begin();
+    for (size_t r = 0; r < first.size(); r++) {
+        const int e = first[r] + count[r];
+        k = std::lower_bound(k, _meshlets.end(), first[r], [] (const Meshlet &m, int t) { return m.first < t; });
+        for (; k != _meshlets.end() && k->first < e; k++) {
+            if (f.classify(k->center, k->radius) < 0)
+                continue;
+            if (cones && facesAway(*k, eye)) {
+                if (backFacing)
+                    *backFacing += k->count;
+                continue;
+            }
+            visible += k->count;
+            if (!keptFirst.empty() && keptFirst.back() + keptCount.back() == k->first)
+                keptCount.back() += k->count;
+            else {
+                keptFirst.push_back(k->first);
+                keptCount.push_back(k->count);
+            }
+        }
+    }
+    first.swap(keptFirst);
+    count.swap(keptCount);
+    return visible;
+}
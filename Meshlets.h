@@ -0,0 +1,66 @@
+#ifndef __MESHLETS_H__
+#define __MESHLETS_H__
+
+#include "Mesh.h"
+#include "Progress.h"
+
+#include <vector>
+#include <cstddef>
+
+struct Frustum;
+
+/*
+ * Small clusters of triangles with at most MAX_VERTICES distinct vertices
+ * and MAX_TRIANGLES triangles, the limits mesh shaders work with. They grow
+ * over connected triangles inside each of the given ranges, which are
+ * regrouped so every meshlet is consecutive and every range a union of
+ * meshlets. Inside a meshlet triangles keep their order, so most of an
+ * order optimized for the vertex cache survives.
+ *
+ * Every meshlet has a bounding sphere and a cone around the normals of its
+ * triangles, both relative to a center like the boxes of AABBTree. It
+ * faces away from an eye at e when dot(c - e, axis) >= cutoff |c - e| + r,
+ * with c and r its sphere and cutoff the sine of the cone's half angle.
+ * Cones of 90 degrees and wider have a zero axis and never face away
+ * */
+
+class Meshlets {
+public:
+    enum { MAX_VERTICES = 64, MAX_TRIANGLES = 124 };
+
+    struct Meshlet {
+        int first;
+        int count;
+        int numVertices;
+        Point center;
+        float radius;
+        Point axis;
+        float cutoff;
+    };
+private:
+    std::vector<Meshlet> _meshlets;
+public:
+    /*
+     * Meshlets of faces [first[i], first[i] + count[i]), numbered by vertices
+     * of m. Regroups the faces of each range in place. Built in worker
+     * jobs, progress is reported and may cancel the build
+     * */
+    Meshlets(const TriMesh &m, const Point &center, Face *faces,
+        const std::vector<int> &first, const std::vector<int> &count, Progress *progress = 0);
+
+    const std::vector<Meshlet> &meshlets() const { return _meshlets; }
+    size_t size() const { return _meshlets.size(); }
+
+    static bool facesAway(const Meshlet &m, const Point &eye);
+
+    /*
+     * Narrows the ascending ranges in first and count, unions of meshlets
+     * like the ranges of DrawRanges::cull, to the meshlets touching f and,
+     * with cones set, not facing away from eye. Touching ranges are merged.
+     * Returns the triangles left, those facing away are counted in backFacing
+     * */
+    size_t cull(const Frustum &f, const Point &eye, bool cones, std::vector<int> &first, std::vector<int> &count,
+        size_t *backFacing = 0) const;
+};
+
+#endif
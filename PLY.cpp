@@ -0,0 +1,466 @@
+#include "PLY.h"
+
+#include <stdexcept>
+#include <sstream>
+#include <limits>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+const double plyPow10[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+namespace {
+
+template<typename T>
+inline T load(const char *p, bool swap) {
+    char buf[sizeof(T)];
+    memcpy(buf, p, sizeof(T));
+    if (swap)
+        std::reverse(buf, buf + sizeof(T));
+    T v;
+    memcpy(&v, buf, sizeof(T));
+    return v;
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline const char *skipBlanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+/* Fallback for numbers the fast path can not convert exactly (nan, inf, long mantissas) */
+const char *parseFloatSlow(const char *p, const char *end, float &v) {
+    char buf[64];
+    size_t len = 0;
+    while (p + len < end && len + 1 < sizeof(buf) && !isspace(static_cast<unsigned char>(p[len])))
+        len++;
+    memcpy(buf, p, len);
+    buf[len] = 0;
+    char *stop;
+    v = strtof(buf, &stop);
+    if (stop == buf)
+        throw std::invalid_argument("Malformed number `" + std::string(buf) + "'");
+    return p + (stop - buf);
+}
+
+inline double scale10(double v, int e) {
+    return e >= 0 ? v * plyPow10[e] : v / plyPow10[-e];
+}
+
+/* Shortest %g representation that reads back as the same float, via snprintf only */
+void appendFloatSlow(std::string &out, float v) {
+    char buf[32];
+    int lo = 1, hi = std::numeric_limits<float>::max_digits10;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        snprintf(buf, sizeof(buf), "%.*g", mid, v);
+        if (strtof(buf, 0) == v)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    out.append(buf, snprintf(buf, sizeof(buf), "%.*g", lo, v));
+}
+
+}
+
+size_t plySizeOf(PLYType t) {
+    switch (t) {
+        case PLY_INT8:
+        case PLY_UINT8:
+            return 1;
+        case PLY_INT16:
+        case PLY_UINT16:
+            return 2;
+        case PLY_INT32:
+        case PLY_UINT32:
+        case PLY_FLOAT32:
+            return 4;
+        case PLY_FLOAT64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+PLYType plyTypeByName(const std::string &name) {
+    if (name == "char" || name == "int8")
+        return PLY_INT8;
+    if (name == "uchar" || name == "uint8")
+        return PLY_UINT8;
+    if (name == "short" || name == "int16")
+        return PLY_INT16;
+    if (name == "ushort" || name == "uint16")
+        return PLY_UINT16;
+    if (name == "int" || name == "int32")
+        return PLY_INT32;
+    if (name == "uint" || name == "uint32")
+        return PLY_UINT32;
+    if (name == "float" || name == "float32")
+        return PLY_FLOAT32;
+    if (name == "double" || name == "float64")
+        return PLY_FLOAT64;
+    throw std::invalid_argument("Unknown PLY property type `" + name + "'");
+}
+
+int PLYElement::find(const std::string &prop) const {
+    for (size_t i = 0; i < props.size(); i++)
+        if (props[i].name == prop)
+            return static_cast<int>(i);
+    return -1;
+}
+
+size_t PLYElement::stride() const {
+    size_t size = 0;
+    for (auto p = props.begin(); p != props.end(); p++) {
+        if (p->isList())
+            return 0;
+        size += plySizeOf(p->type);
+    }
+    return size;
+}
+
+PLYSchema::PLYSchema(const char *data, size_t size) : format(ASCII), headerSize(0) {
+    const char *p = data;
+    const char *end = data + size;
+    std::string line;
+    auto nextLine = [&p, end, &line] () {
+        if (p == end)
+            return false;
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (!eol)
+            eol = end;
+        line.assign(p, eol);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        p = eol == end ? end : eol + 1;
+        return true;
+    };
+
+    if (!nextLine() || line != "ply")
+        throw std::invalid_argument("Invalid PLY header");
+    bool hasFormat = false;
+    bool headerDone = false;
+    while (!headerDone && nextLine()) {
+        std::stringstream ss(line);
+        std::string word;
+        if (!(ss >> word))
+            continue;
+        if (word == "format") {
+            std::string fmt, version;
+            ss >> fmt >> version;
+            if (version != "1.0")
+                throw std::invalid_argument("Unsupported PLY version `" + version + "'");
+            if (fmt == "ascii")
+                format = ASCII;
+            else if (fmt == "binary_little_endian")
+                format = BINARY_LITTLE_ENDIAN;
+            else if (fmt == "binary_big_endian")
+                format = BINARY_BIG_ENDIAN;
+            else
+                throw std::invalid_argument("Unknown PLY format `" + fmt + "'");
+            hasFormat = true;
+        } else if (word == "element") {
+            PLYElement elem;
+            long long count = -1;
+            ss >> elem.name >> count;
+            if (elem.name.empty() || count < 0)
+                throw std::invalid_argument("Malformed element declaration `" + line + "'");
+            elem.count = static_cast<size_t>(count);
+            elements.push_back(elem);
+        } else if (word == "property") {
+            if (elements.empty())
+                throw std::invalid_argument("Property declared before any element");
+            PLYProperty prop;
+            std::string type;
+            ss >> type;
+            if (type == "list") {
+                std::string countType, itemType;
+                ss >> countType >> itemType;
+                prop.countType = plyTypeByName(countType);
+                prop.type = plyTypeByName(itemType);
+                if (prop.countType == PLY_FLOAT32 || prop.countType == PLY_FLOAT64)
+                    throw std::invalid_argument("List count should have an integer type");
+            } else {
+                prop.countType = PLY_NONE;
+                prop.type = plyTypeByName(type);
+            }
+            ss >> prop.name;
+            elements.back().props.push_back(prop);
+        } else if (word == "end_header")
+            headerDone = true;
+        else if (word != "comment" && word != "obj_info")
+            throw std::invalid_argument("Unexpected PLY header line `" + line + "'");
+    }
+    if (!headerDone)
+        throw std::invalid_argument("Unterminated PLY header");
+    if (!hasFormat)
+        throw std::invalid_argument("PLY header has no format line");
+    headerSize = p - data;
+}
+
+int PLYSchema::find(const std::string &element) const {
+    for (size_t i = 0; i < elements.size(); i++)
+        if (elements[i].name == element)
+            return static_cast<int>(i);
+    return -1;
+}
+
+bool PLYSchema::swapBytes() const {
+    return binary() && (format == BINARY_BIG_ENDIAN) != hostIsBigEndian();
+}
+
+PLYDecodePlan::PLYDecodePlan(const PLYElement &elem, const std::vector<std::string> &wanted, bool binary)
+    : stride(binary ? elem.stride() : 0), numSlots(static_cast<int>(wanted.size()))
+{
+    size_t offset = 0;
+    for (auto p = elem.props.begin(); p != elem.props.end(); p++) {
+        int slot = -1;
+        for (size_t i = 0; i < wanted.size(); i++)
+            if (wanted[i] == p->name)
+                slot = static_cast<int>(i);
+        PLYStep step;
+        step.type = p->type;
+        step.countType = p->countType;
+        step.skip = 0;
+        step.offset = offset;
+        step.slot = slot;
+        if (slot >= 0)
+            step.kind = p->isList() ? PLYStep::READ_LIST : PLYStep::READ_SCALAR;
+        else if (p->isList())
+            step.kind = PLYStep::SKIP_LIST;
+        else {
+            step.kind = PLYStep::SKIP;
+            step.skip = binary ? plySizeOf(p->type) : 1;
+            if (!steps.empty() && steps.back().kind == PLYStep::SKIP) {
+                steps.back().skip += step.skip;
+                offset += plySizeOf(p->type);
+                continue;
+            }
+        }
+        steps.push_back(step);
+        offset += plySizeOf(p->type);
+    }
+    for (size_t i = 0; i < wanted.size(); i++)
+        if (elem.find(wanted[i]) < 0)
+            throw std::invalid_argument("Element `" + elem.name + "' has no property `" + wanted[i] + "'");
+}
+
+double plyReadReal(const char *p, PLYType t, bool swap) {
+    switch (t) {
+        case PLY_FLOAT32: return load<float>(p, swap);
+        case PLY_FLOAT64: return load<double>(p, swap);
+        default: return static_cast<double>(plyReadInteger(p, t, swap));
+    }
+}
+
+int64_t plyReadInteger(const char *p, PLYType t, bool swap) {
+    switch (t) {
+        case PLY_INT8:    return load<int8_t>(p, swap);
+        case PLY_UINT8:   return load<uint8_t>(p, swap);
+        case PLY_INT16:   return load<int16_t>(p, swap);
+        case PLY_UINT16:  return load<uint16_t>(p, swap);
+        case PLY_INT32:   return load<int32_t>(p, swap);
+        case PLY_UINT32:  return load<uint32_t>(p, swap);
+        case PLY_FLOAT32: return static_cast<int64_t>(load<float>(p, swap));
+        case PLY_FLOAT64: return static_cast<int64_t>(load<double>(p, swap));
+        default: throw std::invalid_argument("Bad PLY type");
+    }
+}
+
+const char *plyParseFloat(const char *p, const char *end, float &v) {
+    p = skipBlanks(p, end);
+    const char *start = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+    uint64_t mant = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool any = false;
+    for (; p < end && isDigit(*p); p++, any = true) {
+        if (digits < 19) {
+            mant = 10 * mant + (*p - '0');
+            digits += mant != 0;
+        } else
+            exp10++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isDigit(*p); p++, any = true) {
+            if (digits < 19) {
+                mant = 10 * mant + (*p - '0');
+                digits += mant != 0;
+                exp10--;
+            }
+        }
+    }
+    if (!any)
+        return parseFloatSlow(start, end, v);
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool eneg = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            eneg = *p++ == '-';
+        if (p == end || !isDigit(*p))
+            throw std::invalid_argument("Malformed exponent");
+        int e = 0;
+        for (; p < end && isDigit(*p); p++)
+            if (e < 10000)
+                e = 10 * e + (*p - '0');
+        exp10 += eneg ? -e : e;
+    }
+    if (mant >= (uint64_t(1) << 53) || exp10 < -22 || exp10 > 22)
+        return parseFloatSlow(start, end, v);
+    double d = static_cast<double>(mant);
+    d = exp10 < 0 ? d / plyPow10[-exp10] : d * plyPow10[exp10];
+    v = static_cast<float>(neg ? -d : d);
+    return p;
+}
+
+const char *plyParseInt(const char *p, const char *end, int &v) {
+    p = skipBlanks(p, end);
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+    if (p == end || !isDigit(*p))
+        throw std::invalid_argument("Malformed integer");
+    int64_t r = 0;
+    for (; p < end && isDigit(*p); p++) {
+        r = 10 * r + (*p - '0');
+        if (r > std::numeric_limits<int>::max())
+            throw std::range_error("Integer is too large");
+    }
+    v = static_cast<int>(neg ? -r : r);
+    return p;
+}
+
+const char *plySkipToken(const char *p, const char *end) {
+    p = skipBlanks(p, end);
+    if (p == end || *p == '\n')
+        throw std::invalid_argument("Unexpected end of line");
+    while (p < end && !isspace(static_cast<unsigned char>(*p)))
+        p++;
+    return p;
+}
+
+/*
+ * Shortest %g representation that reads back as the same float.
+ * The digits are searched with exact double arithmetic, the result is
+ * checked with strtof and the slow path takes over if the check fails
+ * */
+void plyAppendFloat(std::string &out, float v) {
+    const double d = std::fabs(static_cast<double>(v));
+    if (!std::isfinite(v) || v == 0 || d < 1e-30 || d > 1e30)
+        return appendFloatSlow(out, v);
+    int e10 = static_cast<int>(std::floor(std::log10(d)));
+    uint64_t digits = 0;
+    int p = 1;
+    bool found = false;
+    for (; !found && p <= std::numeric_limits<float>::max_digits10; p++) {
+        int shift = p - 1 - e10;
+        if (shift > 22 || shift < -22)
+            return appendFloatSlow(out, v);
+        double scaled = scale10(d, shift);
+        double lo = std::floor(scaled);
+        /* Try the closer of the two neighbouring candidates first, ties go to even like printf does */
+        double frac = scaled - lo;
+        double first = frac < 0.5 || (frac == 0.5 && std::fmod(lo, 2) == 0) ? lo : lo + 1;
+        double second = first == lo ? lo + 1 : lo;
+        double cands[2] = {first, second};
+        for (int k = 0; !found && k < 2; k++)
+            if (static_cast<float>(scale10(cands[k], -shift)) == static_cast<float>(d)) {
+                digits = static_cast<uint64_t>(cands[k]);
+                found = true;
+            }
+    }
+    if (!found)
+        return appendFloatSlow(out, v);
+    p--;
+    if (digits >= static_cast<uint64_t>(plyPow10[p])) {
+        /* Rounded up to the next power of ten */
+        digits /= 10;
+        e10++;
+    }
+    while (p > 1 && digits % 10 == 0) {
+        digits /= 10;
+        p--;
+    }
+
+    char num[24];
+    for (int i = p - 1; i >= 0; i--, digits /= 10)
+        num[i] = static_cast<char>('0' + digits % 10);
+    char buf[40];
+    char *q = buf;
+    if (v < 0)
+        *q++ = '-';
+    if (e10 < -4 || e10 >= p) {
+        /* %g picks the exponent form when the exponent is below -4 or not below the precision */
+        *q++ = num[0];
+        if (p > 1) {
+            *q++ = '.';
+            for (int i = 1; i < p; i++)
+                *q++ = num[i];
+        }
+        q += snprintf(q, 8, "e%c%02d", e10 < 0 ? '-' : '+', e10 < 0 ? -e10 : e10);
+    } else if (e10 >= 0) {
+        for (int i = 0; i < p; i++) {
+            if (i == e10 + 1)
+                *q++ = '.';
+            *q++ = num[i];
+        }
+    } else {
+        *q++ = '0';
+        *q++ = '.';
+        for (int i = -1; i > e10; i--)
+            *q++ = '0';
+        for (int i = 0; i < p; i++)
+            *q++ = num[i];
+    }
+    *q = 0;
+    if (strtof(buf, 0) != v)
+        return appendFloatSlow(out, v);
+    out.append(buf, q);
+}
+
+void plyAppendInt(std::string &out, int v) {
+    char buf[16];
+    char *p = buf + sizeof(buf);
+    unsigned int u = v < 0 ? 0u - static_cast<unsigned int>(v) : static_cast<unsigned int>(v);
+    do {
+        *--p = static_cast<char>('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--p = '-';
+    out.append(p, buf + sizeof(buf) - p);
+}
+
+std::string plyMeshHeader(bool binary, uint64_t numVertices, uint64_t numFaces, bool byteCount,
+        const std::string &comment, int countWidth)
+{
+    char counts[2][24];
+    snprintf(counts[0], sizeof(counts[0]), "%0*llu", countWidth, static_cast<unsigned long long>(numVertices));
+    snprintf(counts[1], sizeof(counts[1]), "%0*llu", countWidth, static_cast<unsigned long long>(numFaces));
+    std::string h;
+    h += "ply\n";
+    h += binary ? "format binary_little_endian 1.0\n" : "format ascii 1.0\n";
+    h += "comment " + comment + "\n";
+    h += "element vertex " + std::string(counts[0]) + "\n";
+    h += "property float x\n";
+    h += "property float y\n";
+    h += "property float z\n";
+    h += "element face " + std::string(counts[1]) + "\n";
+    h += byteCount ? "property list uchar int vertex_indices\n" : "property list int int vertex_indices\n";
+    h += "end_header\n";
+    return h;
+}
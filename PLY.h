@@ -0,0 +1,120 @@
+#ifndef __PLY_H__
+#define __PLY_H__
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+/*
+ * PLY header schema and per-element decode plans
+ * See http://paulbourke.net/dataformats/ply/
+ * */
+
+enum PLYType {
+    PLY_NONE, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64
+};
+
+size_t plySizeOf(PLYType t);
+PLYType plyTypeByName(const std::string &name);
+
+struct PLYProperty {
+    std::string name;
+    PLYType type;      /* Item type for list properties */
+    PLYType countType; /* PLY_NONE for scalar properties */
+    bool isList() const { return countType != PLY_NONE; }
+};
+
+struct PLYElement {
+    std::string name;
+    size_t count;
+    std::vector<PLYProperty> props;
+    int find(const std::string &prop) const;
+    /* Size of a binary record, 0 if the element has list properties */
+    size_t stride() const;
+};
+
+struct PLYSchema {
+    enum Format {
+        ASCII, BINARY_LITTLE_ENDIAN, BINARY_BIG_ENDIAN
+    } format;
+    std::vector<PLYElement> elements;
+    size_t headerSize;
+
+    PLYSchema(const char *data, size_t size);
+    int find(const std::string &element) const;
+    bool binary() const { return format != ASCII; }
+    /* True if binary values have to be byte swapped on this host */
+    bool swapBytes() const;
+};
+
+/*
+ * Compiled decoding of a single element record. Wanted properties are read
+ * into numbered slots, the rest are skipped. Adjacent skipped scalars are
+ * merged into one step, measured in bytes for binary and in tokens for ASCII files
+ * */
+struct PLYStep {
+    enum Kind {
+        SKIP, SKIP_LIST, READ_SCALAR, READ_LIST
+    } kind;
+    PLYType type;
+    PLYType countType;
+    size_t skip;
+    size_t offset; /* Byte offset in a fixed size binary record */
+    int slot;
+};
+
+struct PLYDecodePlan {
+    std::vector<PLYStep> steps;
+    size_t stride;
+    int numSlots;
+
+    /* wanted[i] is the name of the property going to slot i */
+    PLYDecodePlan(const PLYElement &elem, const std::vector<std::string> &wanted, bool binary);
+    bool fixedSize() const { return stride != 0; }
+};
+
+/* Binary value readers. p may be unaligned */
+double plyReadReal(const char *p, PLYType t, bool swap);
+int64_t plyReadInteger(const char *p, PLYType t, bool swap);
+
+/* ASCII token scanners. Blanks before the token are skipped, line ends are not */
+const char *plyParseFloat(const char *p, const char *end, float &v);
+const char *plyParseInt(const char *p, const char *end, int &v);
+const char *plySkipToken(const char *p, const char *end);
+
+inline bool hostIsBigEndian() {
+    const uint16_t one = 1;
+    unsigned char first;
+    memcpy(&first, &one, 1);
+    return first == 0;
+}
+
+/* Powers of ten up to 1e22, all exact in double */
+extern const double plyPow10[23];
+
+/* Writers for PLY bodies, binary ones are little endian */
+template<typename T>
+void plyAppendLittleEndian(std::string &out, T v) {
+    char buf[sizeof(T)];
+    memcpy(buf, &v, sizeof(T));
+    if (hostIsBigEndian())
+        std::reverse(buf, buf + sizeof(T));
+    out.append(buf, sizeof(T));
+}
+
+/* Shortest %g representation that reads back as the same float */
+void plyAppendFloat(std::string &out, float v);
+void plyAppendInt(std::string &out, int v);
+
+/*
+ * Header of a mesh with float x, y, z vertices and vertex_indices lists
+ * counted by uchar or int. Counts are zero padded to countWidth digits, so
+ * a header can be rewritten in place once they are known
+ * */
+std::string plyMeshHeader(bool binary, uint64_t numVertices, uint64_t numFaces, bool byteCount,
+        const std::string &comment, int countWidth = 0);
+
+#endif
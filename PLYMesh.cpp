@@ -0,0 +1,369 @@
+#include "Mesh.h"
+
+#include "PLY.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+#include "Progress.h"
+
+#include <stdexcept>
+#include <vector>
+#include <limits>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+inline const char *nextLine(const char *q, const char *e) {
+    const char *eol = static_cast<const char *>(memchr(q, '\n', e - q));
+    return eol ? eol + 1 : e;
+}
+
+std::vector<std::string> faceIndexProperty(const PLYElement &face) {
+    if (face.find("vertex_indices") >= 0)
+        return std::vector<std::string>(1, "vertex_indices");
+    return std::vector<std::string>(1, "vertex_index");
+}
+
+std::vector<std::string> vertexCoordProperties() {
+    std::vector<std::string> xyz;
+    xyz.push_back("x");
+    xyz.push_back("y");
+    xyz.push_back("z");
+    return xyz;
+}
+
+/*
+ * Decodes one binary record. Scalars go to slots, list items to dst.
+ * With dst == 0 list items are only counted
+ * */
+const char *decodeRecord(const char *p, const char *end, const PLYDecodePlan &plan, bool swap,
+        float *slots, int *dst, size_t &listSize)
+{
+    listSize = 0;
+    for (auto s = plan.steps.begin(); s != plan.steps.end(); s++) {
+        switch (s->kind) {
+            case PLYStep::SKIP:
+                if (static_cast<size_t>(end - p) < s->skip)
+                    throw std::invalid_argument("Unexpected end of file");
+                p += s->skip;
+                break;
+            case PLYStep::READ_SCALAR:
+                if (static_cast<size_t>(end - p) < plySizeOf(s->type))
+                    throw std::invalid_argument("Unexpected end of file");
+                slots[s->slot] = static_cast<float>(plyReadReal(p, s->type, swap));
+                p += plySizeOf(s->type);
+                break;
+            case PLYStep::SKIP_LIST:
+            case PLYStep::READ_LIST: {
+                size_t countSize = plySizeOf(s->countType);
+                size_t itemSize = plySizeOf(s->type);
+                if (static_cast<size_t>(end - p) < countSize)
+                    throw std::invalid_argument("Unexpected end of file");
+                int64_t n = plyReadInteger(p, s->countType, swap);
+                p += countSize;
+                if (n < 0 || static_cast<uint64_t>(end - p) < n * itemSize)
+                    throw std::invalid_argument("Unexpected end of file");
+                if (s->kind == PLYStep::READ_LIST) {
+                    if (dst)
+                        for (int64_t j = 0; j < n; j++)
+                            dst[j] = static_cast<int>(plyReadInteger(p + j * itemSize, s->type, swap));
+                    listSize = static_cast<size_t>(n);
+                }
+                p += n * itemSize;
+                break;
+            }
+        }
+    }
+    return p;
+}
+
+/* ASCII counterpart of decodeRecord, list items are appended to list */
+const char *decodeLine(const char *p, const char *end, const PLYDecodePlan &plan,
+        float *slots, std::vector<int> *list, int &listSize)
+{
+    listSize = 0;
+    for (auto s = plan.steps.begin(); s != plan.steps.end(); s++) {
+        switch (s->kind) {
+            case PLYStep::SKIP:
+                for (size_t j = 0; j < s->skip; j++)
+                    p = plySkipToken(p, end);
+                break;
+            case PLYStep::READ_SCALAR:
+                p = plyParseFloat(p, end, slots[s->slot]);
+                break;
+            case PLYStep::SKIP_LIST:
+            case PLYStep::READ_LIST: {
+                int n;
+                p = plyParseInt(p, end, n);
+                if (n < 0)
+                    throw std::invalid_argument("Negative list size");
+                if (s->kind == PLYStep::SKIP_LIST) {
+                    for (int j = 0; j < n; j++)
+                        p = plySkipToken(p, end);
+                    break;
+                }
+                for (int j = 0; j < n; j++) {
+                    int idx;
+                    p = plyParseInt(p, end, idx);
+                    list->push_back(idx);
+                }
+                listSize = n;
+                break;
+            }
+        }
+    }
+    return p;
+}
+
+}
+
+PLYMesh::PLYMesh(const std::string &filename, Progress *progress) : Mesh(filename) {
+    MappedFile file(filename);
+    PLYSchema schema(file.data(), file.size());
+
+    if (schema.find("vertex") < 0 || schema.find("face") < 0)
+        throw std::invalid_argument("No vertex or face element in mesh");
+
+    const char *body = file.data() + schema.headerSize;
+    if (schema.binary())
+        readBinary(schema, body, file.end(), progress);
+    else
+        readAscii(schema, body, file.end(), progress);
+}
+
+void PLYMesh::readAscii(const PLYSchema &schema, const char *p, const char *end, Progress *progress) {
+    const int vertexElem = schema.find("vertex");
+    const int faceElem = schema.find("face");
+    const PLYDecodePlan vertexPlan(schema.elements[vertexElem], vertexCoordProperties(), false);
+    const PLYDecodePlan facePlan(schema.elements[faceElem], faceIndexProperty(schema.elements[faceElem]), false);
+
+    /* Every element occupies a range of lines */
+    const size_t numElems = schema.elements.size();
+    std::vector<size_t> elemLine(numElems + 1, 0);
+    for (size_t i = 0; i < numElems; i++)
+        elemLine[i + 1] = elemLine[i] + schema.elements[i].count;
+    const size_t numLines = elemLine[numElems];
+    const size_t vertexLine = elemLine[vertexElem];
+    const size_t faceLine = elemLine[faceElem];
+    const size_t nV = schema.elements[vertexElem].count;
+    const size_t nF = schema.elements[faceElem].count;
+    if (nV > static_cast<size_t>(std::numeric_limits<int>::max()) ||
+            nF > static_cast<size_t>(std::numeric_limits<int>::max()))
+        throw std::range_error("Too many elements");
+
+    /* Split the body into chunks starting at line boundaries */
+    const size_t bytes = end - p;
+    unsigned int numChunks = bytes < (1 << 16) ? 1 : numThreads();
+    std::vector<const char *> bounds(numChunks + 1);
+    bounds[0] = p;
+    bounds[numChunks] = end;
+    for (unsigned int c = 1; c < numChunks; c++)
+        bounds[c] = nextLine(std::max(p + bytes * c / numChunks, bounds[c - 1]), end);
+
+    /* Number the lines so every chunk knows which element it starts with */
+    std::vector<size_t> firstLine(numChunks + 1, 0);
+    parallelChunks(numChunks, [&bounds, &firstLine] (unsigned int c) {
+        size_t lines = 0;
+        const char *e = bounds[c + 1];
+        for (const char *q = bounds[c]; q < e; q = nextLine(q, e))
+            lines++;
+        firstLine[c + 1] = lines;
+    });
+    for (unsigned int c = 0; c < numChunks; c++)
+        firstLine[c + 1] += firstLine[c];
+    if (firstLine[numChunks] < numLines)
+        throw std::invalid_argument("Unexpected end of file");
+
+    std::vector<Point> &vert = vertData();
+    std::vector<offset_t> &facestart = faceStartData();
+    std::vector<index_t> &facevert = faceVertData();
+    vert.resize(nV);
+    facestart.assign(nF + 1, 0);
+
+    /* Vertices go straight to their place, face indices to per-chunk storage.
+     * Lines of other elements are not looked at */
+    std::vector<std::vector<int> > chunkIndices(numChunks);
+    parallelChunks(numChunks, [&] (unsigned int c) {
+        std::vector<int> &indices = chunkIndices[c];
+        const char *q = bounds[c];
+        const char *e = bounds[c + 1];
+        size_t lineBegin = firstLine[c];
+        size_t lineEnd = std::min(firstLine[c + 1], numLines);
+        float slots[3];
+        for (size_t line = lineBegin; line < lineEnd; line++, q = nextLine(q, e)) {
+            int n;
+            if (progress && ((line - lineBegin) & 4095) == 0) {
+                if (c == 0)
+                    progress->update(static_cast<float>(line - lineBegin) / (lineEnd - lineBegin));
+                progress->check();
+            }
+            if (line - vertexLine < nV) {
+                decodeLine(q, e, vertexPlan, slots, 0, n);
+                vert[line - vertexLine] = Point(slots[0], slots[1], slots[2]);
+            } else if (line - faceLine < nF) {
+                decodeLine(q, e, facePlan, slots, &indices, n);
+                if (n < 3)
+                    throw std::invalid_argument("Face has less than 3 vertices");
+                facestart[line - faceLine + 1] = n;
+            }
+        }
+    });
+
+    /* Prefix sum over chunk sizes gives every chunk its place in the CSR arrays */
+    std::vector<size_t> chunkOffset(numChunks + 1, 0);
+    for (unsigned int c = 0; c < numChunks; c++)
+        chunkOffset[c + 1] = chunkOffset[c] + chunkIndices[c].size();
+    facevert.resize(chunkOffset[numChunks]);
+    parallelChunks(numChunks, [&] (unsigned int c) {
+        size_t faceBegin = std::min(std::max(firstLine[c], faceLine), faceLine + nF) - faceLine;
+        size_t faceEnd = std::min(std::max(firstLine[c + 1], faceLine), faceLine + nF) - faceLine;
+        offset_t offset = static_cast<offset_t>(chunkOffset[c]);
+        for (size_t f = faceBegin; f < faceEnd; f++) {
+            offset += facestart[f + 1];
+            facestart[f + 1] = offset;
+        }
+        std::vector<int> &indices = chunkIndices[c];
+        if (!indices.empty())
+            memcpy(facevert.data() + chunkOffset[c], indices.data(), indices.size() * sizeof(int));
+        std::vector<int>().swap(indices);
+    });
+    updateSum();
+}
+
+void PLYMesh::readBinary(const PLYSchema &schema, const char *p, const char *end, Progress *progress) {
+    static_assert(sizeof(Point) == 3 * sizeof(float), "Point should be tightly packed");
+
+    const bool swap = schema.swapBytes();
+    const int vertexElem = schema.find("vertex");
+    const int faceElem = schema.find("face");
+
+    for (int e = 0; e < static_cast<int>(schema.elements.size()); e++) {
+        const PLYElement &elem = schema.elements[e];
+        const size_t count = elem.count;
+        float slots[3];
+        size_t n;
+
+        if (e == vertexElem) {
+            const PLYDecodePlan plan(elem, vertexCoordProperties(), true);
+            if (count > static_cast<size_t>(std::numeric_limits<int>::max()))
+                throw std::range_error("Too many vertices");
+            std::vector<Point> &vert = vertData();
+            vert.resize(count);
+            bool packed = plan.stride == sizeof(Point) && plan.steps.size() == 3;
+            for (int j = 0; packed && j < 3; j++)
+                packed = plan.steps[j].type == PLY_FLOAT32 && plan.steps[j].slot == j;
+            if (plan.fixedSize()) {
+                if (static_cast<size_t>(end - p) / plan.stride < count)
+                    throw std::invalid_argument("Unexpected end of file in vertex data");
+                if (packed && !swap) {
+                    /* Layout matches Point exactly */
+                    memcpy(vert.data(), p, count * sizeof(Point));
+                } else {
+                    /* Pick the coordinates out of fixed size records */
+                    const char *base = p;
+                    parallelFor(count, [&plan, &vert, base, swap] (size_t begin, size_t end) {
+                        float xyz[3];
+                        for (size_t i = begin; i < end; i++) {
+                            const char *rec = base + i * plan.stride;
+                            for (auto s = plan.steps.begin(); s != plan.steps.end(); s++)
+                                if (s->kind == PLYStep::READ_SCALAR)
+                                    xyz[s->slot] = static_cast<float>(plyReadReal(rec + s->offset, s->type, swap));
+                            vert[i] = Point(xyz[0], xyz[1], xyz[2]);
+                        }
+                    });
+                }
+                p += count * plan.stride;
+            } else {
+                for (size_t i = 0; i < count; i++) {
+                    p = decodeRecord(p, end, plan, swap, slots, 0, n);
+                    vert[i] = Point(slots[0], slots[1], slots[2]);
+                }
+            }
+            updateSum();
+        } else if (e == faceElem) {
+            const PLYDecodePlan plan(elem, faceIndexProperty(elem), true);
+            if (count > static_cast<size_t>(std::numeric_limits<int>::max()))
+                throw std::range_error("Too many faces");
+
+            std::vector<offset_t> &facestart = faceStartData();
+            std::vector<index_t> &facevert = faceVertData();
+            const PLYStep *list = plan.steps.size() == 1 ? &plan.steps[0] : 0;
+            if (list && list->kind == PLYStep::READ_LIST && !swap &&
+                    (list->countType == PLY_UINT8 || list->countType == PLY_INT8) &&
+                    (list->type == PLY_INT32 || list->type == PLY_UINT32)) {
+                /*
+                 * The common `list uchar int' layout. Face i starts i + 4 facestart[i]
+                 * bytes into the element, so one scan over the counts places every
+                 * record and the indices are copied in parallel
+                 * */
+                facestart.resize(count + 1);
+                offset_t total = 0;
+                for (size_t i = 0; i < count; i++) {
+                    reportProgress(progress, i, 2 * count);
+                    const char *rec = p + i + 4 * total;
+                    if (rec >= end)
+                        throw std::invalid_argument("Unexpected end of file in face data");
+                    int n = list->countType == PLY_UINT8 ? static_cast<uint8_t>(*rec) : static_cast<int8_t>(*rec);
+                    if (n < 3)
+                        throw std::invalid_argument("Face has less than 3 vertices");
+                    facestart[i] = total;
+                    total += n;
+                }
+                facestart[count] = total;
+                if (static_cast<uint64_t>(end - p) < count + 4 * static_cast<uint64_t>(total))
+                    throw std::invalid_argument("Unexpected end of file in face data");
+                facevert.resize(total);
+                /* Unsigned indices past INT_MAX turn negative in the copy, the range check catches them too */
+                const char *base = p;
+                const uint64_t nV = vertexElem >= 0 ? schema.elements[vertexElem].count : 0;
+                parallelFor(count, [&facestart, &facevert, base, nV, progress] (size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++) {
+                        reportProgress(progress, end - begin + i - begin, 2 * (end - begin));
+                        const offset_t first = facestart[i];
+                        const offset_t last = facestart[i + 1];
+                        memcpy(facevert.data() + first, base + i + 4 * first + 1, 4 * (last - first));
+                        for (offset_t j = first; j < last; j++)
+                            if (facevert[j] < 0 || static_cast<uint64_t>(facevert[j]) >= nV)
+                                throw std::out_of_range("Face refers to a missing vertex");
+                    }
+                });
+                p += count + 4 * total;
+                continue;
+            }
+
+            /* First pass validates the records and sizes the index array */
+            const char *q = p;
+            size_t total = 0;
+            for (size_t i = 0; i < count; i++) {
+                reportProgress(progress, i, 2 * count);
+                q = decodeRecord(q, end, plan, swap, slots, 0, n);
+                if (n < 3)
+                    throw std::invalid_argument("Face has less than 3 vertices");
+                total += n;
+            }
+
+            facestart.resize(count + 1);
+            facevert.resize(total);
+            offset_t offset = 0;
+            for (size_t i = 0; i < count; i++) {
+                reportProgress(progress, count + i, 2 * count);
+                p = decodeRecord(p, end, plan, swap, slots, facevert.data() + offset, n);
+                facestart[i] = offset;
+                offset += static_cast<offset_t>(n);
+            }
+            facestart[count] = offset;
+        } else {
+            /* Not ours, skip it whole */
+            const size_t stride = elem.stride();
+            if (stride) {
+                if (static_cast<size_t>(end - p) / stride < count)
+                    throw std::invalid_argument("Unexpected end of file");
+                p += count * stride;
+            } else {
+                const PLYDecodePlan plan(elem, std::vector<std::string>(), true);
+                for (size_t i = 0; i < count; i++)
+                    p = decodeRecord(p, end, plan, swap, slots, 0, n);
+            }
+        }
+    }
+}
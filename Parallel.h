@@ -0,0 +1,67 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <thread>
+#include <vector>
+#include <exception>
+#include <cstddef>
+
+inline unsigned int numThreads() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+/*
+ * Runs f(chunk) for chunk = 0 .. numChunks - 1, each on its own thread.
+ * The first exception thrown by any chunk is rethrown to the caller
+ * */
+template<class F>
+void parallelChunks(unsigned int numChunks, F f) {
+    if (numChunks <= 1) {
+        if (numChunks == 1)
+            f(0u);
+        return;
+    }
+    std::vector<std::exception_ptr> errors(numChunks);
+    std::vector<std::thread> threads;
+    threads.reserve(numChunks - 1);
+    for (unsigned int c = 1; c < numChunks; c++)
+        threads.push_back(std::thread([&f, &errors, c] () {
+            try {
+                f(c);
+            } catch (...) {
+                errors[c] = std::current_exception();
+            }
+        }));
+    try {
+        f(0u);
+    } catch (...) {
+        errors[0] = std::current_exception();
+    }
+    for (auto t = threads.begin(); t != threads.end(); t++)
+        t->join();
+    for (auto e = errors.begin(); e != errors.end(); e++)
+        if (*e)
+            std::rethrow_exception(*e);
+}
+
+/*
+ * Splits [0, n) into contiguous ranges and runs f(begin, end) on each of them.
+ * Ranges never get smaller than minChunk elements
+ * */
+template<class F>
+void parallelFor(size_t n, F f, size_t minChunk = 4096) {
+    size_t chunks = n / (minChunk ? minChunk : 1);
+    if (chunks > numThreads())
+        chunks = numThreads();
+    if (chunks < 1)
+        chunks = 1;
+    parallelChunks(static_cast<unsigned int>(chunks), [n, chunks, &f] (unsigned int c) {
+        size_t begin = n * c / chunks;
+        size_t end = n * (c + 1) / chunks;
+        if (begin < end)
+            f(begin, end);
+    });
+}
+
+#endif
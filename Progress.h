@@ -0,0 +1,58 @@
+#ifndef __PROGRESS_H__
+#define __PROGRESS_H__
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <stdexcept>
+#include <cstddef>
+
+/*
+ * Progress of a background job. The worker reports stages and fractions
+ * and polls for cancellation, the render thread reads them and may cancel
+ * */
+
+class Progress {
+    mutable std::mutex _lock;
+    std::string _stage;
+    std::atomic<float> _fraction;
+    std::atomic<bool> _cancelled;
+public:
+    class Cancelled : public std::runtime_error {
+    public:
+        Cancelled() : std::runtime_error("Cancelled") { }
+    };
+
+    Progress() : _fraction(0), _cancelled(false) { }
+    void stage(const std::string &name) {
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _stage = name;
+        }
+        _fraction = 0;
+        check();
+    }
+    void update(float fraction) {
+        _fraction = fraction;
+        check();
+    }
+    void check() const {
+        if (_cancelled)
+            throw Cancelled();
+    }
+    void cancel() { _cancelled = true; }
+    bool cancelled() const { return _cancelled; }
+    float fraction() const { return _fraction; }
+    std::string stage() const {
+        std::lock_guard<std::mutex> guard(_lock);
+        return _stage;
+    }
+};
+
+/* Cheap enough for hot loops, touches the atomics once per 4096 iterations */
+inline void reportProgress(Progress *progress, size_t i, size_t n) {
+    if (progress && (i & 4095) == 0)
+        progress->update(static_cast<float>(i) / n);
+}
+
+#endif
@@ -0,0 +1,270 @@
+#include "RayQuery.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+
+namespace {
+
+/* Every level of the tree pushes at most one node */
+const int maxStack = 128;
+
+}
+
+RayQuery::RayQuery(const TriMesh &m, const AABBTree &tree, const Point &center) : _tree(tree) {
+    if (tree.depth() >= maxStack)
+        throw std::invalid_argument("Tree too deep for ray queries");
+    const std::vector<Point> &vertexData = m.vertsWithNormals();
+    const std::vector<Face> &faceData = m.faces();
+    const std::vector<int> &order = tree.faces();
+    _tris.resize(order.size());
+    parallelFor(order.size(), [this, &vertexData, &faceData, &order, &center] (size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            const Face &f = faceData[order[k]];
+            Triangle &t = _tris[k];
+            t.v0 = Point(vertexData[f.v1], center);
+            t.e1 = Point(vertexData[f.v2], vertexData[f.v1]);
+            t.e2 = Point(vertexData[f.v3], vertexData[f.v1]);
+        }
+    });
+}
+
+template<int N, bool any>
+void RayQuery::trace(const Ray *rays, RayHit *hits) const {
+    float ox[N], oy[N], oz[N];
+    float dx[N], dy[N], dz[N];
+    float ix[N], iy[N], iz[N];
+    /*
+     * Hits shorten their lane, finished any hit lanes are closed with tmax = 0.
+     * Only the nearest triangle is kept while tracing, lane updates are
+     * written unconditionally since masked stores keep the loop scalar
+     * */
+    float tmax[N];
+    int best[N];
+    for (int j = 0; j < N; j++) {
+        ox[j] = rays[j].origin.x;
+        oy[j] = rays[j].origin.y;
+        oz[j] = rays[j].origin.z;
+        dx[j] = rays[j].dir.x;
+        dy[j] = rays[j].dir.y;
+        dz[j] = rays[j].dir.z;
+        ix[j] = 1 / dx[j];
+        iy[j] = 1 / dy[j];
+        iz[j] = 1 / dz[j];
+        tmax[j] = rays[j].tmax;
+        best[j] = -1;
+    }
+    int open = N;
+
+    const std::vector<AABBTree::Node> &nodes = _tree.nodes();
+    int stack[maxStack];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const AABBTree::Node &n = nodes[stack[--sp]];
+
+        /* Slab test of all lanes, boxes are tested when taken from the stack so earlier hits prune them */
+        const AABB &b = n.box;
+        int entered = 0;
+        for (int j = 0; j < N; j++) {
+            float x1 = (b.x1 - ox[j]) * ix[j], x2 = (b.x2 - ox[j]) * ix[j];
+            float y1 = (b.y1 - oy[j]) * iy[j], y2 = (b.y2 - oy[j]) * iy[j];
+            float z1 = (b.z1 - oz[j]) * iz[j], z2 = (b.z2 - oz[j]) * iz[j];
+            float tnear = std::max(std::max(std::min(x1, x2), std::min(y1, y2)), std::max(std::min(z1, z2), 0.f));
+            float tfar = std::min(std::min(std::max(x1, x2), std::max(y1, y2)), std::max(z1, z2));
+            entered |= (tnear <= tfar) & (tnear < tmax[j]);
+        }
+        if (!entered)
+            continue;
+
+        if (!n.isLeaf()) {
+            /* Nearer child along the first lane goes on top */
+            const AABB &l = nodes[n.first].box;
+            const AABB &r = nodes[n.first + 1].box;
+            float ahead = dx[0] * (r.x1 + r.x2 - l.x1 - l.x2) + dy[0] * (r.y1 + r.y2 - l.y1 - l.y2) +
+                dz[0] * (r.z1 + r.z2 - l.z1 - l.z2);
+            stack[sp++] = ahead > 0 ? n.first + 1 : n.first;
+            stack[sp++] = ahead > 0 ? n.first : n.first + 1;
+            continue;
+        }
+
+        for (int k = n.first; k < n.first + n.count; k++) {
+            const Triangle &tri = _tris[k];
+            int found = 0;
+            /* Moller-Trumbore, both sides of the triangle */
+            for (int j = 0; j < N; j++) {
+                float px = dy[j] * tri.e2.z - dz[j] * tri.e2.y;
+                float py = dz[j] * tri.e2.x - dx[j] * tri.e2.z;
+                float pz = dx[j] * tri.e2.y - dy[j] * tri.e2.x;
+                float det = tri.e1.x * px + tri.e1.y * py + tri.e1.z * pz;
+                float inv = 1 / det;
+                float tx = ox[j] - tri.v0.x;
+                float ty = oy[j] - tri.v0.y;
+                float tz = oz[j] - tri.v0.z;
+                float u = (tx * px + ty * py + tz * pz) * inv;
+                float qx = ty * tri.e1.z - tz * tri.e1.y;
+                float qy = tz * tri.e1.x - tx * tri.e1.z;
+                float qz = tx * tri.e1.y - ty * tri.e1.x;
+                float v = (dx[j] * qx + dy[j] * qy + dz[j] * qz) * inv;
+                float t = (tri.e2.x * qx + tri.e2.y * qy + tri.e2.z * qz) * inv;
+                /* No short circuits, they would keep the loop from being vectorized */
+                int hit = (det != 0) & (u >= 0) & (v >= 0) & (u + v <= 1) & (t > 0) & (t < tmax[j]);
+                best[j] = (best[j] & (hit - 1)) | (k & -hit);
+                tmax[j] = std::min(tmax[j], hit ? (any ? 0 : t) : std::numeric_limits<float>::max());
+                found += hit;
+            }
+            if (any && (open -= found) == 0) {
+                sp = 0;
+                break;
+            }
+        }
+    }
+
+    for (int j = 0; j < N; j++)
+        hits[j] = best[j] < 0 ? RayHit() : hitOf(rays[j], best[j]);
+}
+
+template<int W, bool any>
+RayHit RayQuery::traceWide(const Ray &ray, const WideBVH<W> &wide) const {
+    const float o[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+    const float d[3] = {ray.dir.x, ray.dir.y, ray.dir.z};
+    const float inv[3] = {1 / d[0], 1 / d[1], 1 / d[2]};
+    float tmax = ray.tmax;
+    int best = -1;
+
+    /*
+     * Entries are wide nodes, or leaves as their first triangle with a
+     * count, each with the distance its box is entered at. A node pushes at
+     * most W entries, one of which is taken right away at the next level
+     * */
+    typedef typename WideBVH<W>::Node Node;
+    const Node *nodes = wide.nodes();
+    int stackItem[maxStack * W];
+    int stackCount[maxStack * W];
+    float stackNear[maxStack * W];
+    int sp = 0;
+    stackItem[sp] = 0;
+    stackCount[sp] = 0;
+    stackNear[sp++] = 0;
+    while (sp > 0) {
+        sp--;
+        if (stackNear[sp] >= tmax)
+            continue;
+        const int item = stackItem[sp];
+        const int count = stackCount[sp];
+
+        if (count > 0) {
+            for (int k = item; k < item + count; k++) {
+                const Triangle &tri = _tris[k];
+                /* Moller-Trumbore, both sides of the triangle, as in trace() */
+                float px = d[1] * tri.e2.z - d[2] * tri.e2.y;
+                float py = d[2] * tri.e2.x - d[0] * tri.e2.z;
+                float pz = d[0] * tri.e2.y - d[1] * tri.e2.x;
+                float det = tri.e1.x * px + tri.e1.y * py + tri.e1.z * pz;
+                float idet = 1 / det;
+                float tx = o[0] - tri.v0.x;
+                float ty = o[1] - tri.v0.y;
+                float tz = o[2] - tri.v0.z;
+                float u = (tx * px + ty * py + tz * pz) * idet;
+                float qx = ty * tri.e1.z - tz * tri.e1.y;
+                float qy = tz * tri.e1.x - tx * tri.e1.z;
+                float qz = tx * tri.e1.y - ty * tri.e1.x;
+                float v = (d[0] * qx + d[1] * qy + d[2] * qz) * idet;
+                float t = (tri.e2.x * qx + tri.e2.y * qy + tri.e2.z * qz) * idet;
+                if (det != 0 && u >= 0 && v >= 0 && u + v <= 1 && t > 0 && t < tmax) {
+                    best = k;
+                    tmax = t;
+                }
+            }
+            if (any && best >= 0)
+                break;
+            continue;
+        }
+
+        /* Slab test of all children, decoded from the node grid. Unused slots have inverted boxes */
+        const Node &n = nodes[item];
+        const float scale[3] = {n.scale(0), n.scale(1), n.scale(2)};
+        float tnear[W], tfar[W];
+        for (int j = 0; j < W; j++) {
+            tnear[j] = 0;
+            tfar[j] = tmax;
+        }
+        for (int axis = 0; axis < 3; axis++)
+            for (int j = 0; j < W; j++) {
+                float t1 = (n.origin[axis] + n.lo[axis][j] * scale[axis] - o[axis]) * inv[axis];
+                float t2 = (n.origin[axis] + n.hi[axis][j] * scale[axis] - o[axis]) * inv[axis];
+                tnear[j] = std::max(tnear[j], std::min(t1, t2));
+                tfar[j] = std::min(tfar[j], std::max(t1, t2));
+            }
+        int entered[W];
+        for (int j = 0; j < W; j++)
+            entered[j] = (tnear[j] <= tfar[j]) & (n.child[j] >= 0);
+
+        /* Farthest first, so the nearest child is taken next */
+        int order[W];
+        int m = 0;
+        for (int j = 0; j < W; j++) {
+            if (!entered[j])
+                continue;
+            int at = m++;
+            while (at > 0 && tnear[order[at - 1]] < tnear[j]) {
+                order[at] = order[at - 1];
+                at--;
+            }
+            order[at] = j;
+        }
+        for (int i = 0; i < m; i++) {
+            const int j = order[i];
+            stackItem[sp] = n.child[j];
+            stackCount[sp] = n.count[j];
+            stackNear[sp++] = tnear[j];
+        }
+    }
+    return best < 0 ? RayHit() : hitOf(ray, best);
+}
+
+RayHit RayQuery::hitOf(const Ray &ray, int k) const {
+    /* Same arithmetic as the lane test, so the values match the hit that was found */
+    RayHit hit;
+    const Triangle &tri = _tris[k];
+    const Point &d = ray.dir;
+    Point p(d.y * tri.e2.z - d.z * tri.e2.y, d.z * tri.e2.x - d.x * tri.e2.z, d.x * tri.e2.y - d.y * tri.e2.x);
+    float inv = 1 / (tri.e1.x * p.x + tri.e1.y * p.y + tri.e1.z * p.z);
+    Point o(ray.origin, tri.v0);
+    Point q(o.y * tri.e1.z - o.z * tri.e1.y, o.z * tri.e1.x - o.x * tri.e1.z, o.x * tri.e1.y - o.y * tri.e1.x);
+    hit.triangle = _tree.faces()[k];
+    hit.u = (o.x * p.x + o.y * p.y + o.z * p.z) * inv;
+    hit.v = (d.x * q.x + d.y * q.y + d.z * q.z) * inv;
+    hit.t = (tri.e2.x * q.x + tri.e2.y * q.y + tri.e2.z * q.z) * inv;
+    return hit;
+}
+
+RayHit RayQuery::closest(const Ray &ray) const {
+    RayHit hit;
+    trace<1, false>(&ray, &hit);
+    return hit;
+}
+
+bool RayQuery::occluded(const Ray &ray) const {
+    RayHit hit;
+    trace<1, true>(&ray, &hit);
+    return hit.triangle >= 0;
+}
+
+template<int N>
+void RayQuery::occluded(const Ray *rays, bool *hit) const {
+    RayHit hits[N];
+    trace<N, true>(rays, hits);
+    for (int j = 0; j < N; j++)
+        hit[j] = hits[j].triangle >= 0;
+}
+
+template void RayQuery::trace<4, false>(const Ray *, RayHit *) const;
+template void RayQuery::trace<8, false>(const Ray *, RayHit *) const;
+template void RayQuery::occluded<4>(const Ray *, bool *) const;
+template void RayQuery::occluded<8>(const Ray *, bool *) const;
+template RayHit RayQuery::traceWide<4, false>(const Ray &, const WideBVH<4> &) const;
+template RayHit RayQuery::traceWide<4, true>(const Ray &, const WideBVH<4> &) const;
+template RayHit RayQuery::traceWide<8, false>(const Ray &, const WideBVH<8> &) const;
+template RayHit RayQuery::traceWide<8, true>(const Ray &, const WideBVH<8> &) const;
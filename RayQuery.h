@@ -0,0 +1,73 @@
+#ifndef __RAYQUERY_H__
+#define __RAYQUERY_H__
+
+#include "Mesh.h"
+#include "AABBTree.h"
+#include "WideBVH.h"
+
+#include <vector>
+#include <limits>
+
+/* Points origin + t * dir for 0 < t < tmax */
+struct Ray {
+    Point origin;
+    Point dir;
+    float tmax;
+    Ray() { }
+    Ray(const Point &origin, const Point &dir, float tmax = std::numeric_limits<float>::max())
+        : origin(origin), dir(dir), tmax(tmax) { }
+};
+
+/* Triangle of the TriMesh, or -1 for a miss. The hit point is (1 - u - v) v1 + u v2 + v v3 */
+struct RayHit {
+    int triangle;
+    float t, u, v;
+    RayHit() : triangle(-1), t(std::numeric_limits<float>::max()), u(0), v(0) { }
+};
+
+/*
+ * Casts rays against the triangles of a TriMesh through its AABBTree.
+ * Rays are given relative to the center the tree was built around.
+ * Triangles are copied once in tree order as a corner and two edges,
+ * which the Moller-Trumbore test uses directly. Packets of N rays walk
+ * the tree together, every box and triangle test runs over all lanes
+ * at once in loops the compiler turns into SIMD code. Single rays can
+ * also walk a WideBVH of the same tree, testing all children of a node
+ * at once and visiting them nearest first
+ * */
+
+class RayQuery {
+    struct Triangle {
+        Point v0, e1, e2;
+    };
+    const AABBTree &_tree;
+    std::vector<Triangle> _tris;
+
+    template<int N, bool any>
+    void trace(const Ray *rays, RayHit *hits) const;
+    template<int W, bool any>
+    RayHit traceWide(const Ray &ray, const WideBVH<W> &wide) const;
+    /* Hit of ray on triangle k in tree order */
+    RayHit hitOf(const Ray &ray, int k) const;
+public:
+    /* Throws if the tree is deeper than the traversal stack */
+    RayQuery(const TriMesh &m, const AABBTree &tree, const Point &center);
+
+    RayHit closest(const Ray &ray) const;
+    /* Stops at the first hit */
+    bool occluded(const Ray &ray) const;
+
+    /* N is 4 or 8 */
+    template<int N>
+    void closest(const Ray *rays, RayHit *hits) const { trace<N, false>(rays, hits); }
+    template<int N>
+    void occluded(const Ray *rays, bool *hit) const;
+
+    /* W is 4 or 8, wide must be built from the tree of this query */
+    template<int W>
+    RayHit closest(const Ray &ray, const WideBVH<W> &wide) const { return traceWide<W, false>(ray, wide); }
+    template<int W>
+    bool occluded(const Ray &ray, const WideBVH<W> &wide) const { return traceWide<W, true>(ray, wide).triangle >= 0; }
+};
+
+#endif
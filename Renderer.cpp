@@ -176,8 +176,12 @@ void Renderer::updateModelView() {
     glUniformMatrix4fv(normalMatrix, 1, GL_TRUE, tmp.data());
 }
 
+Matrix Renderer::perspective(float aspectRatio) {
+    return PerspectiveMatrix(0.5f, 4.5f, 30, aspectRatio);
+}
+
 void Renderer::setPerspective() {
-    PerspectiveMatrix m(0.5f, 4.5f, 30, viewWidth / viewHeight);
+    Matrix m(perspective(viewWidth / viewHeight));
     GLint projMatrix = glGetUniformLocation(program(), "projMatrix");
     glUniformMatrix4fv(projMatrix, /*num*/1, /*row major*/GL_TRUE, m.data());
 }
@@ -208,6 +212,13 @@ void Renderer::setSpecularity(float v) {
     glUniform1f(specularity, v);
 }
 
+void Renderer::setPositionDecoding(const Point &offset, const Point &scale) {
+    GLint positionOffset = glGetUniformLocation(program(), "positionOffset");
+    glUniform3f(positionOffset, offset.x, offset.y, offset.z);
+    GLint positionScale = glGetUniformLocation(program(), "positionScale");
+    glUniform3f(positionScale, scale.x, scale.y, scale.z);
+}
+
 void Renderer::setLightIntens(float v) {
     GLint lightIntens = glGetUniformLocation(program(), "lightIntens");
     glUniform1f(lightIntens, v);
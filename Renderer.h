@@ -29,8 +29,11 @@ struct Renderer {
     void setColor(float r, float g, float b, float a);
     void setLightIntens(float v);
     void setSpecularity(float v);
+    void setPositionDecoding(const Point &offset, const Point &scale);
     void smoothNormals(bool v);
     void shadePhong(bool v);
+    /* Projection of the model, picking and culling in Engine use it as well */
+    static Matrix perspective(float aspectRatio);
     void setPerspective();
     void setOrtho();
     void reshape(int x, int y);
@@ -0,0 +1,99 @@
+#include "StencilTable.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+StencilTable::StencilTable(std::vector<offset_t> &start, std::vector<int> &index, std::vector<float> &weight, size_t numControl)
+    : _numControl(numControl)
+{
+    if (start.empty() || index.size() != weight.size() || static_cast<size_t>(start.back()) != index.size())
+        throw std::invalid_argument("Malformed stencil table");
+    _start.swap(start);
+    _index.swap(index);
+    _weight.swap(weight);
+}
+
+StencilTable::StencilTable(const StencilTable &outer, const StencilTable &inner) : _numControl(inner.numControl()) {
+    if (outer.numControl() != inner.numStencils())
+        throw std::invalid_argument("Stencil tables do not match");
+    const size_t nS = outer.numStencils();
+
+    /*
+     * Rows are merged through a dense accumulator per thread. The first pass
+     * only counts distinct control points, the second one fills the rows in place
+     * */
+    _start.assign(nS + 1, 0);
+    parallelFor(nS, [this, &outer, &inner] (size_t begin, size_t end) {
+        std::vector<char> seen(_numControl, 0);
+        std::vector<int> touched;
+        for (size_t r = begin; r < end; r++) {
+            touched.clear();
+            for (offset_t k = outer._start[r]; k < outer._start[r + 1]; k++) {
+                int s = outer._index[k];
+                for (offset_t q = inner._start[s]; q < inner._start[s + 1]; q++) {
+                    int c = inner._index[q];
+                    if (!seen[c]) {
+                        seen[c] = 1;
+                        touched.push_back(c);
+                    }
+                }
+            }
+            for (auto c = touched.begin(); c != touched.end(); c++)
+                seen[*c] = 0;
+            _start[r + 1] = static_cast<offset_t>(touched.size());
+        }
+    }, 1024);
+    for (size_t r = 0; r < nS; r++)
+        _start[r + 1] += _start[r];
+
+    _index.resize(_start[nS]);
+    _weight.resize(_start[nS]);
+    parallelFor(nS, [this, &outer, &inner] (size_t begin, size_t end) {
+        std::vector<double> acc(_numControl, 0);
+        std::vector<char> seen(_numControl, 0);
+        std::vector<int> touched;
+        for (size_t r = begin; r < end; r++) {
+            touched.clear();
+            for (offset_t k = outer._start[r]; k < outer._start[r + 1]; k++) {
+                int s = outer._index[k];
+                double w = outer._weight[k];
+                for (offset_t q = inner._start[s]; q < inner._start[s + 1]; q++) {
+                    int c = inner._index[q];
+                    if (!seen[c]) {
+                        seen[c] = 1;
+                        touched.push_back(c);
+                    }
+                    acc[c] += w * inner._weight[q];
+                }
+            }
+            /* Sorted indices keep the control point reads of apply() local */
+            std::sort(touched.begin(), touched.end());
+            offset_t out = _start[r];
+            for (auto c = touched.begin(); c != touched.end(); c++, out++) {
+                _index[out] = *c;
+                _weight[out] = static_cast<float>(acc[*c]);
+                acc[*c] = 0;
+                seen[*c] = 0;
+            }
+        }
+    }, 1024);
+}
+
+void StencilTable::apply(const Point *control, Point *out) const {
+    parallelFor(numStencils(), [this, control, out] (size_t begin, size_t end) {
+        const int *index = _index.data();
+        const float *weight = _weight.data();
+        for (size_t r = begin; r < end; r++) {
+            float x = 0, y = 0, z = 0;
+            for (offset_t k = _start[r]; k < _start[r + 1]; k++) {
+                const Point &p = control[index[k]];
+                float w = weight[k];
+                x += w * p.x;
+                y += w * p.y;
+                z += w * p.z;
+            }
+            out[r] = Point(x, y, z);
+        }
+    }, 4096);
+}
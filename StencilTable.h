@@ -0,0 +1,34 @@
+#ifndef __STENCILTABLE_H__
+#define __STENCILTABLE_H__
+
+#include "Mesh.h"
+
+#include <vector>
+#include <cstddef>
+
+/*
+ * Sparse linear map from control points to output points, stored as CSR.
+ * Row r is out[r] = sum_k weight[k] * control[index[k]], k in [start[r], start[r + 1])
+ * */
+
+class StencilTable {
+    std::vector<offset_t> _start;
+    std::vector<int> _index;
+    std::vector<float> _weight;
+    size_t _numControl;
+public:
+    StencilTable() : _start(1, 0), _numControl(0) { }
+    /* Takes over the arrays */
+    StencilTable(std::vector<offset_t> &start, std::vector<int> &index, std::vector<float> &weight, size_t numControl);
+    /* outer applied after inner. outer.numControl() must be inner.numStencils() */
+    StencilTable(const StencilTable &outer, const StencilTable &inner);
+
+    size_t numStencils() const { return _start.size() - 1; }
+    size_t numControl() const { return _numControl; }
+    size_t numEntries() const { return _index.size(); }
+
+    /* out must hold numStencils() points */
+    void apply(const Point *control, Point *out) const;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "DooSabinStencil.h"
+#include "DooSabin.h"
+#include "Mesh.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+
+/*
+ * Checks recorded Doo-Sabin stencils against refining level by level:
+ *   stenciltest file.ply ...
+ * Returns the number of failed checks
+ * */
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string &what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+/* Largest coordinate difference between matching vertices, infinite when the topologies differ */
+float difference(const std::vector<Point> &a, const Mesh &b) {
+    if (a.size() != b.numVertices())
+        return INFINITY;
+    float worst = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        worst = std::max(worst, std::max(std::fabs(a[i].x - b.vert(i).x),
+            std::max(std::fabs(a[i].y - b.vert(i).y), std::fabs(a[i].z - b.vert(i).z))));
+    return worst;
+}
+
+void levels(const std::string &name, const Mesh &control, int levels) {
+    float size = 0;
+    for (size_t i = 0; i < control.numVertices(); i++) {
+        Point d(control.vert(i), control.center());
+        size = std::max(size, std::max(std::fabs(d.x), std::max(std::fabs(d.y), std::fabs(d.z))));
+    }
+    const float tolerance = 1e-5f * std::max(size, 1.f);
+
+    std::unique_ptr<Mesh> refined(new Mesh(control));
+    for (int l = 1; l <= levels; l++) {
+        const std::string what = name + ", level " + std::to_string(l) + ": ";
+        refined.reset(new DooSabin(*refined));
+        DooSabinStencil stencil(control, l);
+        check(stencil.faceStarts() == refined->faceStarts() && stencil.faceVerts() == refined->faceVerts(),
+            what + "same faces as refining");
+        check(difference(stencil.verts(), *refined) <= tolerance, what + "recorded points match refining");
+
+        /* Rows sum to one, so moving every control point moves every refined one the same way */
+        const Point shift(0.5f * size, -0.25f * size, size);
+        std::vector<Point> moved(control.verts());
+        for (auto p = moved.begin(); p != moved.end(); p++)
+            *p += shift;
+        stencil.update(moved);
+        std::vector<Point> expected(refined->verts());
+        for (auto p = expected.begin(); p != expected.end(); p++)
+            *p += shift;
+        check(difference(expected, stencil) <= 2 * tolerance, what + "update follows moved control points");
+
+        stencil.update(control.verts());
+        check(difference(stencil.verts(), *refined) <= tolerance, what + "update on the control points matches refining");
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        PLYMesh control(argv[i]);
+        levels(argv[i], control, 3);
+    }
+    if (failures)
+        std::cerr << failures << " checks failed" << std::endl;
+    return failures;
+}
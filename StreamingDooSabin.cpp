@@ -0,0 +1,431 @@
+#include "StreamingDooSabin.h"
+#include "DooSabin.h"
+#include "Adjacency.h"
+#include "HalfEdge.h"
+#include "Progress.h"
+#include "Parallel.h"
+#include "PLY.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <limits>
+#include <cstring>
+#include <cstdio>
+
+namespace {
+
+/* Spreads the low 21 bits of v to every third bit */
+inline uint64_t spreadBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+}
+
+/*
+ * Faces sorted along a Morton curve of their centroids. Part p of n is
+ * the range [ceil(p * nF / n), ceil((p + 1) * nF / n)) of that order
+ * */
+class FaceOrder {
+    std::vector<int> _face;
+    std::vector<int> _rank;
+public:
+    FaceOrder(const Mesh &m);
+    size_t size() const { return _face.size(); }
+    const int *begin(int p, int parts) const {
+        return _face.data() + (static_cast<uint64_t>(size()) * p + parts - 1) / parts;
+    }
+    const int *end(int p, int parts) const { return begin(p + 1, parts); }
+    int part(int f, int parts) const {
+        return static_cast<int>(static_cast<uint64_t>(_rank[f]) * parts / size());
+    }
+};
+
+FaceOrder::FaceOrder(const Mesh &m) {
+    const size_t nF = m.numFaces();
+    Point lo(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Point hi(-lo);
+    for (auto p = m.verts().begin(); p != m.verts().end(); p++) {
+        lo = Point(std::min(lo.x, p->x), std::min(lo.y, p->y), std::min(lo.z, p->z));
+        hi = Point(std::max(hi.x, p->x), std::max(hi.y, p->y), std::max(hi.z, p->z));
+    }
+    float extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+    const float scale = extent > 0 ? 2097151.f / extent : 0;
+
+    std::vector<std::pair<uint64_t, int> > key(nF);
+    parallelFor(nF, [&m, &key, &lo, scale] (size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            PolyFace pf = m.face(f);
+            Point c(0, 0, 0);
+            for (auto v = pf.begin; v != pf.end; v++)
+                c += m.vert(*v);
+            c = (1.f / (pf.end - pf.begin)) * c;
+            uint64_t x = static_cast<uint64_t>((c.x - lo.x) * scale);
+            uint64_t y = static_cast<uint64_t>((c.y - lo.y) * scale);
+            uint64_t z = static_cast<uint64_t>((c.z - lo.z) * scale);
+            key[f] = std::make_pair(spreadBits(x) | spreadBits(y) << 1 | spreadBits(z) << 2, static_cast<int>(f));
+        }
+    }, 1024);
+    std::sort(key.begin(), key.end());
+    _face.resize(nF);
+    _rank.resize(nF);
+    for (size_t i = 0; i < nF; i++) {
+        _face[i] = key[i].second;
+        _rank[key[i].second] = static_cast<int>(i);
+    }
+}
+
+/* Faces of part p and all faces around their vertices, ascending. Marks them with p in stamp */
+void collectPart(const Mesh &m, const Adjacency &adj, const FaceOrder &order, int p, int parts,
+        std::vector<int> &stamp, std::vector<int> &faces)
+{
+    faces.clear();
+    for (const int *f = order.begin(p, parts); f != order.end(p, parts); f++) {
+        PolyFace pf = m.face(*f);
+        for (auto v = pf.begin; v != pf.end; v++)
+            for (const int *g = adj.facesBegin(*v); g != adj.facesEnd(*v); g++)
+                if (stamp[*g] != p) {
+                    stamp[*g] = p;
+                    faces.push_back(*g);
+                }
+    }
+    std::sort(faces.begin(), faces.end());
+}
+
+/*
+ * The collected faces as a mesh of their own. Faces and vertices keep their
+ * relative order, so DooSabin builds the very same faces from them as from
+ * the whole mesh. A vertex whose faces fall apart into several fans gets
+ * one copy per fan, copies stay next to each other
+ * */
+class PartMesh : public Mesh {
+public:
+    PartMesh(const Mesh &m, const HalfEdge &he, const std::vector<int> &faces, const std::vector<int> &stamp, int p);
+};
+
+PartMesh::PartMesh(const Mesh &m, const HalfEdge &he, const std::vector<int> &faces,
+        const std::vector<int> &stamp, int p) : Mesh(m.filename())
+{
+    const std::vector<offset_t> &fs = m.faceStarts();
+    const std::vector<index_t> &fv = m.faceVerts();
+
+    std::vector<offset_t> &facestart = faceStartData();
+    facestart.resize(faces.size() + 1);
+    facestart[0] = 0;
+    for (size_t i = 0; i < faces.size(); i++)
+        facestart[i + 1] = facestart[i] + fs[faces[i] + 1] - fs[faces[i]];
+
+    std::vector<int> used;
+    used.reserve(facestart.back());
+    for (size_t i = 0; i < faces.size(); i++)
+        used.insert(used.end(), fv.begin() + fs[faces[i]], fv.begin() + fs[faces[i] + 1]);
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+
+    /* Fan number of every corner and the number of fans of every vertex */
+    std::vector<int> fan(facestart.back());
+    std::vector<int> first(used.size() + 1);
+    first[0] = 0;
+    auto inside = [&stamp, p] (int f) { return stamp[f] == p; };
+    parallelFor(used.size(), [&he, &fs, &faces, &used, &facestart, &fan, &first, &inside] (size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            int fans = 0;
+            he.forEachRun(used[k], inside, [&he, &fs, &faces, &facestart, &fan, &fans] (int h, int count, bool) {
+                for (int j = 0; j < count; j++, h = he.rotate(h)) {
+                    int f = he.face(h);
+                    size_t local = std::lower_bound(faces.begin(), faces.end(), f) - faces.begin();
+                    fan[facestart[local] + h - fs[f]] = fans;
+                }
+                fans++;
+            });
+            first[k + 1] = fans;
+        }
+    }, 1024);
+    for (size_t k = 0; k < used.size(); k++)
+        first[k + 1] += first[k];
+
+    std::vector<Point> &verts = vertData();
+    verts.resize(first.back());
+    for (size_t k = 0; k < used.size(); k++)
+        std::fill(verts.begin() + first[k], verts.begin() + first[k + 1], m.vert(used[k]));
+    std::vector<index_t> &facevert = faceVertData();
+    facevert.resize(facestart.back());
+    parallelFor(faces.size(), [&fs, &fv, &faces, &used, &facestart, &fan, &first, &facevert] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            for (offset_t j = facestart[i]; j < facestart[i + 1]; j++) {
+                int v = fv[fs[faces[i]] + j - facestart[i]];
+                size_t k = std::lower_bound(used.begin(), used.end(), v) - used.begin();
+                facevert[j] = first[k] + fan[j];
+            }
+    }, 1024);
+    updateSum();
+}
+
+/* Vertex, face and corner counts */
+struct Sizes {
+    uint64_t v, f, c;
+};
+
+/* Doo-Sabin step on a closed mesh: a point per corner, a face per face, vertex and edge */
+Sizes step(const Sizes &s) {
+    Sizes n = {s.c, s.f + s.v + s.c / 2, 4 * s.c};
+    return n;
+}
+
+uint64_t meshBytes(const Sizes &s) {
+    return sizeof(Point) * s.v + sizeof(offset_t) * (s.f + 1) + sizeof(index_t) * s.c;
+}
+
+/* Adjacency and HalfEdge of a mesh */
+uint64_t topologyBytes(const Sizes &s) {
+    return sizeof(offset_t) * 2 * s.v + sizeof(int) * 3 * s.c + sizeof(int) * (3 * s.v + 3 * s.c);
+}
+
+/* Memory to refine a part of the given size, then write it out */
+uint64_t partBytes(Sizes s, int levels) {
+    uint64_t peak = 0;
+    for (int l = 0; l < levels; l++) {
+        Sizes n = step(s);
+        /* Old and new mesh, topology of the old one, DooSabin's prefix sums, parents and anchors */
+        peak = std::max(peak, meshBytes(s) + meshBytes(n) + topologyBytes(s) +
+                sizeof(int) * (3 * s.v + 2 * n.f + s.f));
+        s = n;
+    }
+    /* The result, its adjacency, anchors, owners and output indices */
+    return std::max(peak, meshBytes(s) + sizeof(offset_t) * 2 * s.v + sizeof(int) * 3 * s.c + 5 * s.f + sizeof(int) * s.v);
+}
+
+/* Longest output face, new faces are as long as old faces, as vertex valences or quads */
+int maxOrder(const Mesh &m, const Adjacency &adj) {
+    int order = 4;
+    for (size_t f = 0; f < m.numFaces(); f++)
+        order = std::max(order, static_cast<int>(m.faceStarts()[f + 1] - m.faceStarts()[f]));
+    for (size_t v = 0; v < m.numVertices(); v++)
+        order = std::max(order, adj.numFaces(v));
+    return order;
+}
+
+/* Counts go in fixed width so the header can be rewritten in place once they are known */
+std::string plyHeader(uint64_t numVertices, uint64_t numFaces, bool byteCount) {
+    return plyMeshHeader(true, numVertices, numFaces, byteCount, "StreamingDooSabin", 20);
+}
+
+StreamingDooSabin::Estimate estimateWith(const Mesh &m, const Adjacency &adj, const FaceOrder &order,
+        int levels, int parts)
+{
+    Sizes whole = {m.numVertices(), m.numFaces(), m.faceVerts().size()};
+    /* Control topology, the face order and the part stamps stay for the whole run */
+    const uint64_t resident = topologyBytes(whole) + 3 * sizeof(int) * whole.f + sizeof(int) * whole.v;
+    for (int l = 0; l < levels; l++)
+        whole = step(whole);
+
+    StreamingDooSabin::Estimate e;
+    e.vertices = whole.v;
+    e.faces = whole.f;
+    e.corners = whole.c;
+    const bool byteCount = maxOrder(m, adj) <= std::numeric_limits<unsigned char>::max();
+    e.fileBytes = plyHeader(0, 0, byteCount).size() + sizeof(Point) * whole.v +
+        (byteCount ? 1 : sizeof(int)) * whole.f + sizeof(int) * whole.c;
+
+    std::vector<int> stamp(m.numFaces(), -1);
+    std::vector<int> vertexStamp(m.numVertices(), -1);
+    std::vector<int> faces;
+    uint64_t peak = 0;
+    for (int p = 0; p < parts; p++) {
+        collectPart(m, adj, order, p, parts, stamp, faces);
+        Sizes s = {0, faces.size(), 0};
+        for (auto f = faces.begin(); f != faces.end(); f++) {
+            PolyFace pf = m.face(*f);
+            s.c += pf.end - pf.begin;
+            for (auto v = pf.begin; v != pf.end; v++)
+                if (vertexStamp[*v] != p) {
+                    vertexStamp[*v] = p;
+                    s.v++;
+                }
+        }
+        peak = std::max(peak, partBytes(s, levels));
+    }
+    e.peakBytes = resident + peak;
+    return e;
+}
+
+/* Bit pattern of a point, the key vertices on the cuts between parts are merged by */
+struct PointKey {
+    uint32_t x, y, z;
+    PointKey(const Point &p) {
+        memcpy(&x, &p.x, 4);
+        memcpy(&y, &p.y, 4);
+        memcpy(&z, &p.z, 4);
+    }
+    bool operator==(const PointKey &o) const { return x == o.x && y == o.y && z == o.z; }
+};
+
+struct PointKeyHash {
+    size_t operator()(const PointKey &k) const {
+        uint64_t h = (static_cast<uint64_t>(k.x) << 32 | k.y) * 0x9e3779b97f4a7c15ULL;
+        h ^= k.z * 0xc4ceb9fe1a85ec53ULL;
+        return static_cast<size_t>(h ^ h >> 29);
+    }
+};
+
+}
+
+StreamingDooSabin::Estimate StreamingDooSabin::estimate(const Mesh &m, int levels, int parts) {
+    const Adjacency adj(m);
+    const FaceOrder order(m);
+    return estimateWith(m, adj, order, levels, parts);
+}
+
+int StreamingDooSabin::partsFor(const Mesh &m, int levels, uint64_t budget) {
+    const Adjacency adj(m);
+    const FaceOrder order(m);
+    int parts = 1;
+    while (static_cast<size_t>(2 * parts) <= m.numFaces() && estimateWith(m, adj, order, levels, parts).peakBytes > budget)
+        parts *= 2;
+    return parts;
+}
+
+void StreamingDooSabin::refine(const Mesh &m, int levels, int parts, const std::string &filename, Progress *progress) {
+    if (levels < 1 || parts < 1)
+        throw std::invalid_argument("Streaming refinement needs at least one level and one part");
+    const Adjacency adj(m);
+    adj.checkTopology();
+    const HalfEdge he(m);
+    const FaceOrder order(m);
+
+    Estimate e = estimateWith(m, adj, order, levels, parts);
+    std::cout << "Streaming " << levels << " Doo-Sabin levels in " << parts << " parts: up to "
+        << e.vertices << " vertices, " << e.faces << " faces, "
+        << e.fileBytes / 1048576 << " MB on disk, " << e.peakBytes / 1048576 << " MB peak memory" << std::endl;
+    const bool byteCount = maxOrder(m, adj) <= std::numeric_limits<unsigned char>::max();
+
+    /* Vertices go right after the header, faces to a side file appended at the end */
+    const std::string faceFile = filename + ".faces.tmp";
+    std::fstream out(filename, std::ios::out | std::ios::binary);
+    std::fstream faceOut(faceFile, std::ios::out | std::ios::binary);
+    if (!out || !faceOut)
+        throw std::invalid_argument("Open file `" + filename + "' failed");
+
+    try {
+        out << plyHeader(0, 0, byteCount);
+
+        std::unordered_map<PointKey, int, PointKeyHash> shared;
+        uint64_t numVertices = 0;
+        uint64_t numFaces = 0;
+        std::vector<int> stamp(m.numFaces(), -1);
+        std::vector<int> faces;
+        std::string vbuf;
+        std::string fbuf;
+        for (int p = 0; p < parts; p++) {
+            if (order.begin(p, parts) == order.end(p, parts))
+                continue;
+            collectPart(m, adj, order, p, parts, stamp, faces);
+
+            /* Control face every face descends from */
+            std::vector<int> anchor(faces);
+            std::unique_ptr<Mesh> cur(new PartMesh(m, he, faces, stamp, p));
+            for (int l = 0; l < levels; l++) {
+                if (progress)
+                    progress->update((p + static_cast<float>(l) / (levels + 1)) / parts);
+                std::vector<int> parent;
+                std::unique_ptr<Mesh> next(new DooSabin(*cur, 0, &parent, false));
+                std::vector<int> a(parent.size());
+                for (size_t f = 0; f < parent.size(); f++)
+                    a[f] = anchor[parent[f]];
+                anchor.swap(a);
+                cur = std::move(next);
+            }
+            if (progress)
+                progress->update((p + static_cast<float>(levels) / (levels + 1)) / parts);
+
+            /*
+             * Keep the faces descending from the part itself. Their vertices are
+             * new unless a face of another part or the cut edge of this piece
+             * touches them, those are looked up by position
+             * */
+            const Mesh &r = *cur;
+            const Adjacency radj(r);
+            std::vector<char> owned(r.numFaces());
+            for (size_t f = 0; f < r.numFaces(); f++)
+                owned[f] = order.part(anchor[f], parts) == p;
+            std::vector<int> index(r.numVertices(), -1);
+            for (size_t f = 0; f < r.numFaces(); f++) {
+                if (!owned[f])
+                    continue;
+                PolyFace pf = r.face(f);
+                int n = static_cast<int>(pf.end - pf.begin);
+                if (byteCount)
+                    fbuf.push_back(static_cast<char>(n));
+                else
+                    plyAppendLittleEndian(fbuf, n);
+                for (auto v = pf.begin; v != pf.end; v++) {
+                    int &i = index[*v];
+                    if (i < 0) {
+                        bool inner = !radj.isBorder(*v);
+                        for (const int *g = radj.facesBegin(*v); inner && g != radj.facesEnd(*v); g++)
+                            inner = owned[*g] != 0;
+                        if (!inner) {
+                            auto found = shared.find(PointKey(r.vert(*v)));
+                            if (found != shared.end())
+                                i = found->second;
+                        }
+                        if (i < 0) {
+                            if (numVertices > static_cast<uint64_t>(std::numeric_limits<int>::max()))
+                                throw std::overflow_error("Too many vertices for a PLY file with int indices");
+                            i = static_cast<int>(numVertices++);
+                            if (!inner)
+                                shared.insert(std::make_pair(PointKey(r.vert(*v)), i));
+                            plyAppendLittleEndian(vbuf, r.vert(*v).x);
+                            plyAppendLittleEndian(vbuf, r.vert(*v).y);
+                            plyAppendLittleEndian(vbuf, r.vert(*v).z);
+                        }
+                    }
+                    plyAppendLittleEndian(fbuf, i);
+                }
+                numFaces++;
+                if (fbuf.size() > (1 << 20)) {
+                    faceOut.write(fbuf.data(), fbuf.size());
+                    fbuf.clear();
+                }
+                if (vbuf.size() > (1 << 20)) {
+                    out.write(vbuf.data(), vbuf.size());
+                    vbuf.clear();
+                }
+            }
+            if (!out || !faceOut)
+                throw std::runtime_error("Writing file `" + filename + "' failed");
+        }
+        out.write(vbuf.data(), vbuf.size());
+        faceOut.write(fbuf.data(), fbuf.size());
+
+        faceOut.close();
+        std::ifstream in(faceFile, std::ios::in | std::ios::binary);
+        std::vector<char> chunk(1 << 20);
+        while (in) {
+            in.read(chunk.data(), chunk.size());
+            out.write(chunk.data(), in.gcount());
+        }
+        in.close();
+        out.seekp(0);
+        out << plyHeader(numVertices, numFaces, byteCount);
+        if (!out)
+            throw std::runtime_error("Writing file `" + filename + "' failed");
+        std::cout << "Wrote " << numVertices << " vertices and " << numFaces << " faces to `" << filename << "'" << std::endl;
+    } catch (...) {
+        out.close();
+        faceOut.close();
+        remove(faceFile.c_str());
+        remove(filename.c_str());
+        throw;
+    }
+    remove(faceFile.c_str());
+}
@@ -0,0 +1,39 @@
+#ifndef __STREAMINGDOOSABIN_H__
+#define __STREAMINGDOOSABIN_H__
+
+#include "Mesh.h"
+
+#include <string>
+#include <cstdint>
+
+/*
+ * Doo-Sabin refinement for results larger than memory. Faces of the control
+ * mesh are cut into parts along a Morton curve of their centroids. Each part
+ * is refined together with the faces around its vertices, which is all the
+ * context the faces descending from it need at any depth. Only those faces
+ * are kept and streamed to a binary PLY file, vertices on the cuts between
+ * parts are written once
+ * */
+
+class StreamingDooSabin {
+public:
+    struct Estimate {
+        uint64_t vertices;
+        uint64_t faces;
+        uint64_t corners;
+        uint64_t fileBytes;
+        /* Largest memory use at any moment, without the control mesh and the table of cut vertices */
+        uint64_t peakBytes;
+    };
+
+    /* Output sizes are exact for closed meshes and upper bounds otherwise */
+    static Estimate estimate(const Mesh &m, int levels, int parts);
+
+    /* Fewest parts, a power of two, whose peak fits into budget bytes */
+    static int partsFor(const Mesh &m, int levels, uint64_t budget);
+
+    /* Refines m by levels steps into a binary PLY file */
+    static void refine(const Mesh &m, int levels, int parts, const std::string &filename, Progress *progress = 0);
+};
+
+#endif
@@ -0,0 +1,24 @@
+#include "Subdivision.h"
+#include "DooSabin.h"
+#include "CatmullClark.h"
+#include "Loop.h"
+
+#include <stdexcept>
+
+const char *schemeName(SubdivisionScheme scheme) {
+    switch (scheme) {
+        case DOO_SABIN: return "Doo-Sabin";
+        case CATMULL_CLARK: return "Catmull-Clark";
+        case LOOP: return "Loop";
+        default: return "unknown";
+    }
+}
+
+Mesh *subdivide(const Mesh &m, SubdivisionScheme scheme, Progress *progress) {
+    switch (scheme) {
+        case DOO_SABIN: return new DooSabin(m, progress);
+        case CATMULL_CLARK: return new CatmullClark(m, progress);
+        case LOOP: return new Loop(m, progress);
+        default: throw std::invalid_argument("Unknown subdivision scheme");
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef __SUBDIVISION_H__
+#define __SUBDIVISION_H__
+
+#include "Mesh.h"
+
+enum SubdivisionScheme {
+    DOO_SABIN, CATMULL_CLARK, LOOP, NUM_SCHEMES
+};
+
+const char *schemeName(SubdivisionScheme scheme);
+
+/* One level of the chosen scheme. Caller owns the result */
+Mesh *subdivide(const Mesh &m, SubdivisionScheme scheme, Progress *progress = 0);
+
+#endif
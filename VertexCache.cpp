@@ -0,0 +1,166 @@
+#include "VertexCache.h"
+#include "Parallel.h"
+
+#include <algorithm>
+
+namespace {
+
+/* Misses of a FIFO cache, and the number of vertices in use */
+void simulate(const Face *faces, size_t numFaces, size_t numVertices, int cacheSize, size_t &misses, size_t &used) {
+    /* A vertex is cached while fewer than cacheSize misses came after its own */
+    std::vector<size_t> missed(numVertices, 0);
+    misses = used = 0;
+    for (size_t i = 0; i < numFaces; i++) {
+        const int corner[3] = {faces[i].v1, faces[i].v2, faces[i].v3};
+        for (int j = 0; j < 3; j++) {
+            size_t &m = missed[corner[j]];
+            if (m > 0 && misses - m < static_cast<size_t>(cacheSize))
+                continue;
+            if (m == 0)
+                used++;
+            m = ++misses;
+        }
+    }
+}
+
+}
+
+void VertexCache::optimize(Face *faces, size_t numFaces, size_t numVertices, int cacheSize) {
+    /* Triangles around every vertex */
+    std::vector<int> start(numVertices + 1, 0);
+    for (size_t i = 0; i < numFaces; i++) {
+        start[faces[i].v1 + 1]++;
+        start[faces[i].v2 + 1]++;
+        start[faces[i].v3 + 1]++;
+    }
+    for (size_t v = 0; v < numVertices; v++)
+        start[v + 1] += start[v];
+    std::vector<int> around(3 * numFaces);
+    std::vector<int> fill(start.begin(), start.end() - 1);
+    for (size_t i = 0; i < numFaces; i++) {
+        around[fill[faces[i].v1]++] = static_cast<int>(i);
+        around[fill[faces[i].v2]++] = static_cast<int>(i);
+        around[fill[faces[i].v3]++] = static_cast<int>(i);
+    }
+
+    /* Triangles not emitted yet around every vertex, and when it last entered the cache */
+    std::vector<int> live(numVertices);
+    for (size_t v = 0; v < numVertices; v++)
+        live[v] = start[v + 1] - start[v];
+    std::vector<int> entered(numVertices, 0);
+    int time = cacheSize + 1;
+    std::vector<char> emitted(numFaces, 0);
+    std::vector<int> recent;
+    std::vector<int> candidates;
+    std::vector<Face> result;
+    result.reserve(numFaces);
+
+    size_t next = 0;
+    while (next < numVertices && live[next] == 0)
+        next++;
+    int fan = next < numVertices ? static_cast<int>(next) : -1;
+    while (fan >= 0) {
+        candidates.clear();
+        for (int k = start[fan]; k < start[fan + 1]; k++) {
+            int t = around[k];
+            if (emitted[t])
+                continue;
+            emitted[t] = 1;
+            result.push_back(faces[t]);
+            const int corner[3] = {faces[t].v1, faces[t].v2, faces[t].v3};
+            for (int j = 0; j < 3; j++) {
+                int v = corner[j];
+                recent.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - entered[v] > cacheSize)
+                    entered[v] = time++;
+            }
+        }
+
+        /* The cached vertex that stays cached through its own fan and entered the cache first */
+        fan = -1;
+        int best = -1;
+        for (size_t j = 0; j < candidates.size(); j++) {
+            int v = candidates[j];
+            if (live[v] == 0)
+                continue;
+            int priority = time - entered[v] + 2 * live[v] <= cacheSize ? time - entered[v] : 0;
+            if (priority > best) {
+                best = priority;
+                fan = v;
+            }
+        }
+        while (fan < 0 && !recent.empty()) {
+            if (live[recent.back()] > 0)
+                fan = recent.back();
+            recent.pop_back();
+        }
+        while (fan < 0 && next < numVertices) {
+            if (live[next] > 0)
+                fan = static_cast<int>(next);
+            next++;
+        }
+    }
+    std::copy(result.begin(), result.end(), faces);
+}
+
+void VertexCache::optimizeRanges(Face *faces, const std::vector<int> &first, const std::vector<int> &count, int cacheSize) {
+    parallelFor(first.size(), [faces, &first, &count, cacheSize] (size_t begin, size_t end) {
+        /* Ranges are numbered locally, with the vertices they use in ascending order */
+        std::vector<int> local;
+        for (size_t r = begin; r < end; r++) {
+            Face *f = faces + first[r];
+            size_t n = count[r];
+            local.clear();
+            for (size_t i = 0; i < n; i++) {
+                local.push_back(f[i].v1);
+                local.push_back(f[i].v2);
+                local.push_back(f[i].v3);
+            }
+            std::sort(local.begin(), local.end());
+            local.erase(std::unique(local.begin(), local.end()), local.end());
+            for (size_t i = 0; i < n; i++) {
+                f[i].v1 = static_cast<int>(std::lower_bound(local.begin(), local.end(), f[i].v1) - local.begin());
+                f[i].v2 = static_cast<int>(std::lower_bound(local.begin(), local.end(), f[i].v2) - local.begin());
+                f[i].v3 = static_cast<int>(std::lower_bound(local.begin(), local.end(), f[i].v3) - local.begin());
+            }
+            optimize(f, n, local.size(), cacheSize);
+            for (size_t i = 0; i < n; i++) {
+                f[i].v1 = local[f[i].v1];
+                f[i].v2 = local[f[i].v2];
+                f[i].v3 = local[f[i].v3];
+            }
+        }
+    }, 64);
+}
+
+std::vector<int> VertexCache::orderVertices(Face *faces, size_t numFaces, size_t numVertices) {
+    std::vector<int> order(numVertices, -1);
+    int next = 0;
+    for (size_t i = 0; i < numFaces; i++) {
+        int *corner[3] = {&faces[i].v1, &faces[i].v2, &faces[i].v3};
+        for (int j = 0; j < 3; j++) {
+            int &o = order[*corner[j]];
+            if (o < 0)
+                o = next++;
+            *corner[j] = o;
+        }
+    }
+    for (size_t v = 0; v < numVertices; v++)
+        if (order[v] < 0)
+            order[v] = next++;
+    return order;
+}
+
+float VertexCache::acmr(const Face *faces, size_t numFaces, size_t numVertices, int cacheSize) {
+    size_t misses, used;
+    simulate(faces, numFaces, numVertices, cacheSize, misses, used);
+    return numFaces ? static_cast<float>(misses) / numFaces : 0;
+}
+
+float VertexCache::atvr(const Face *faces, size_t numFaces, size_t numVertices, int cacheSize) {
+    size_t misses, used;
+    simulate(faces, numFaces, numVertices, cacheSize, misses, used);
+    return used ? static_cast<float>(misses) / used : 0;
+}
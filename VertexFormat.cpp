@@ -0,0 +1,102 @@
+#include "VertexFormat.h"
+#include "Parallel.h"
+#include "Box.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace {
+
+/* Vertices are packed in blocks of separate coordinate arrays, so the loops over them are vectorized */
+const int block = 256;
+
+/* Clamped after rounding, float comparisons would become branches */
+inline uint16_t fraction16(float x) {
+    int c = static_cast<int>(x + 0.5f);
+    c = c > 0 ? c : 0;
+    return static_cast<uint16_t>(c < 65535 ? c : 65535);
+}
+
+/* Rounded to nearest as a 10 bit two's complement field */
+inline uint32_t snorm10(float x) {
+    int c = static_cast<int>(x * 511 + 512.5f) - 512;
+    c = c > -511 ? c : -511;
+    return static_cast<uint32_t>(c < 511 ? c : 511) & 1023;
+}
+
+}
+
+void VertexFormat::pack(Layout layout, const TriMesh &m, const std::vector<int> &order,
+        std::vector<char> &out, Point &offset, Point &scale) {
+    const std::vector<Point> &vertexData = m.vertsWithNormals();
+    const size_t numVertices = m.numVertices();
+    const size_t size = stride(layout);
+    out.resize(numVertices * size);
+
+    AABB bounds;
+    if (layout == PACKED) {
+        std::mutex lock;
+        parallelFor(numVertices, [&vertexData, &bounds, &lock] (size_t begin, size_t end) {
+            AABB part;
+            for (size_t v = begin; v < end; v++)
+                part.add(vertexData[v]);
+            std::lock_guard<std::mutex> guard(lock);
+            bounds.add(part);
+        });
+    }
+    if (layout == FLOAT || bounds.isEmpty()) {
+        offset = Point(0, 0, 0);
+        scale = Point(1, 1, 1);
+    } else {
+        offset = Point(bounds.x1, bounds.y1, bounds.z1);
+        scale = Point(bounds.x2 - bounds.x1, bounds.y2 - bounds.y1, bounds.z2 - bounds.z1);
+    }
+    /* Flat boxes store zeros along their flat axes */
+    const float sx = scale.x > 0 ? 65535 / scale.x : 0;
+    const float sy = scale.y > 0 ? 65535 / scale.y : 0;
+    const float sz = scale.z > 0 ? 65535 / scale.z : 0;
+
+    /* Coordinates are read as flat float arrays with offset and scale repeated per axis */
+    static_assert(sizeof(Point) == 3 * sizeof(float), "Points are not packed");
+    const float *coords = &vertexData[0].x;
+    float repeatedOffset[3 * block], repeatedScale[3 * block];
+    for (int i = 0; i < 3 * block; i += 3) {
+        repeatedOffset[i] = offset.x;
+        repeatedOffset[i + 1] = offset.y;
+        repeatedOffset[i + 2] = offset.z;
+        repeatedScale[i] = sx;
+        repeatedScale[i + 1] = sy;
+        repeatedScale[i + 2] = sz;
+    }
+
+    char *target = out.data();
+    parallelFor(numVertices, [layout, &order, numVertices, target, coords, &repeatedOffset, &repeatedScale] (size_t begin, size_t end) {
+        uint16_t position[3 * block];
+        uint32_t normal[3 * block];
+        for (size_t b = begin; b < end; b += block) {
+            const int n = static_cast<int>(std::min<size_t>(block, end - b));
+            const float *p = coords + 3 * b;
+            const float *q = coords + 3 * (numVertices + b);
+            if (layout == FLOAT) {
+                for (int i = 0; i < n; i++) {
+                    Float &f = reinterpret_cast<Float *>(target)[order[b + i]];
+                    std::copy(p + 3 * i, p + 3 * i + 3, f.position);
+                    std::copy(q + 3 * i, q + 3 * i + 3, f.normal);
+                }
+                continue;
+            }
+            for (int i = 0; i < 3 * n; i++) {
+                position[i] = fraction16((p[i] - repeatedOffset[i]) * repeatedScale[i]);
+                normal[i] = snorm10(q[i]);
+            }
+            for (int i = 0; i < n; i++) {
+                Packed &k = reinterpret_cast<Packed *>(target)[order[b + i]];
+                k.position[0] = position[3 * i];
+                k.position[1] = position[3 * i + 1];
+                k.position[2] = position[3 * i + 2];
+                k.unused = 0;
+                k.normal = normal[3 * i] | normal[3 * i + 1] << 10 | normal[3 * i + 2] << 20;
+            }
+        }
+    });
+}
@@ -0,0 +1,46 @@
+#ifndef __VERTEXFORMAT_H__
+#define __VERTEXFORMAT_H__
+
+#include "Mesh.h"
+
+#include <vector>
+#include <cstdint>
+
+/*
+ * Interleaved vertex buffers for the GPU. FLOAT keeps 32 bit floats, 24
+ * bytes a vertex. PACKED takes 12 bytes: positions as 16 bit fractions of
+ * the bounding box of the mesh, read as normalized unsigned shorts, and
+ * normals as normalized GL_INT_2_10_10_10_REV. Positions decode as
+ * offset + scale * p in the vertex shader.
+ *
+ * PACKED positions are off by half a grid step, 1 / 131070 of the box
+ * extent along each axis, plus float rounding. Normal components are
+ * rounded to steps of 1 / 511, together with the differing decoding rules
+ * of GL 3.3 and 4.2 a unit normal turns by less than 0.2 degrees
+ * */
+
+class VertexFormat {
+public:
+    enum Layout { FLOAT, PACKED };
+
+    struct Float {
+        float position[3];
+        float normal[3];
+    };
+    struct Packed {
+        uint16_t position[3];
+        uint16_t unused;
+        uint32_t normal;
+    };
+
+    static size_t stride(Layout layout) { return layout == PACKED ? sizeof(Packed) : sizeof(Float); }
+
+    /*
+     * Writes vertex v of m as vertex order[v] of out, order is a permutation.
+     * Sets the decoding of stored positions p to offset + scale * p
+     * */
+    static void pack(Layout layout, const TriMesh &m, const std::vector<int> &order,
+        std::vector<char> &out, Point &offset, Point &scale);
+};
+
+#endif
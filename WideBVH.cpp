@@ -0,0 +1,133 @@
+#include "WideBVH.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+namespace {
+
+/* Smallest power of two exponent whose grid of 255 steps from lo reaches hi */
+int gridExponent(float lo, float hi) {
+    int e = -126;
+    if (hi > lo) {
+        std::frexp((hi - lo) / 255, &e);
+        e = std::max(e, -126);
+    }
+    while (e < 127 && lo + 255 * std::ldexp(1.f, e) < hi)
+        e++;
+    return e;
+}
+
+}
+
+template<int W>
+AABB WideBVH<W>::Node::box(int i) const {
+    AABB b;
+    b.x1 = origin[0] + lo[0][i] * scale(0);
+    b.y1 = origin[1] + lo[1][i] * scale(1);
+    b.z1 = origin[2] + lo[2][i] * scale(2);
+    b.x2 = origin[0] + hi[0][i] * scale(0);
+    b.y2 = origin[1] + hi[1][i] * scale(1);
+    b.z2 = origin[2] + hi[2][i] * scale(2);
+    return b;
+}
+
+template<int W>
+WideBVH<W>::WideBVH(const AABBTree &tree) : _faces(tree.faces()), _bounds(tree.nodes()[0].box) {
+    const std::vector<AABBTree::Node> &bin = tree.nodes();
+
+    /*
+     * Wide node k stands for binary node source[k]. Its children open the
+     * inner child of largest area until W of them are found, slot j of
+     * node k refers to binary node slot[k * W + j] and, if inner, to wide
+     * node wide[k * W + j]. A binary root leaf becomes the only child
+     * */
+    std::vector<int> source(1, 0);
+    std::vector<int> slot;
+    std::vector<int> wide;
+    for (size_t k = 0; k < source.size(); k++) {
+        const AABBTree::Node &n = bin[source[k]];
+        std::vector<int> children;
+        if (n.isLeaf()) {
+            if (n.count > 0)
+                children.push_back(source[k]);
+        } else {
+            children.push_back(n.first);
+            children.push_back(n.first + 1);
+        }
+        while (static_cast<int>(children.size()) < W) {
+            int widest = -1;
+            for (size_t j = 0; j < children.size(); j++)
+                if (!bin[children[j]].isLeaf() &&
+                        (widest < 0 || bin[children[j]].box.area() > bin[children[widest]].box.area()))
+                    widest = static_cast<int>(j);
+            if (widest < 0)
+                break;
+            int opened = bin[children[widest]].first;
+            children[widest] = opened;
+            children.push_back(opened + 1);
+        }
+        for (int j = 0; j < W; j++) {
+            int c = j < static_cast<int>(children.size()) ? children[j] : -1;
+            slot.push_back(c);
+            wide.push_back(-1);
+            if (c < 0)
+                continue;
+            if (bin[c].isLeaf() && bin[c].count > 255)
+                throw std::invalid_argument("Tree leaf too large for a wide node");
+            if (!bin[c].isLeaf()) {
+                wide.back() = static_cast<int>(source.size());
+                source.push_back(c);
+            }
+        }
+    }
+
+    _numNodes = source.size();
+    _storage.resize(_numNodes * sizeof(Node) + 64);
+    _nodes = reinterpret_cast<Node *>((reinterpret_cast<uintptr_t>(_storage.data()) + 63) & ~uintptr_t(63));
+
+    parallelFor(_numNodes, [this, &bin, &source, &slot, &wide] (size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            Node &node = _nodes[k];
+            const AABB &box = bin[source[k]].box;
+            for (int axis = 0; axis < 3; axis++) {
+                node.origin[axis] = lower(box, axis);
+                node.exponent[axis] = static_cast<int8_t>(gridExponent(lower(box, axis), upper(box, axis)));
+            }
+            for (int j = 0; j < W; j++) {
+                const int c = slot[k * W + j];
+                node.count[j] = 0;
+                node.child[j] = -1;
+                for (int axis = 0; axis < 3; axis++) {
+                    node.lo[axis][j] = 255;
+                    node.hi[axis][j] = 0;
+                }
+                if (c < 0)
+                    continue;
+                const AABBTree::Node &n = bin[c];
+                node.count[j] = n.isLeaf() ? static_cast<uint8_t>(n.count) : 0;
+                node.child[j] = n.isLeaf() ? n.first : wide[k * W + j];
+
+                /* Rounded outwards, then stepped until decoding in float gives a box around the exact one */
+                for (int axis = 0; axis < 3; axis++) {
+                    const float o = node.origin[axis];
+                    const float s = node.scale(axis);
+                    const float cl = lower(n.box, axis);
+                    const float ch = upper(n.box, axis);
+                    int ql = std::min(255, std::max(0, static_cast<int>(std::floor((cl - o) / s))));
+                    int qh = std::min(255, std::max(ql, static_cast<int>(std::ceil((ch - o) / s))));
+                    while (ql > 0 && o + ql * s > cl)
+                        ql--;
+                    while (qh < 255 && o + qh * s < ch)
+                        qh++;
+                    node.lo[axis][j] = static_cast<uint8_t>(ql);
+                    node.hi[axis][j] = static_cast<uint8_t>(qh);
+                }
+            }
+        }
+    }, 1024);
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
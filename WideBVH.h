@@ -0,0 +1,70 @@
+#ifndef __WIDEBVH_H__
+#define __WIDEBVH_H__
+
+#include "AABBTree.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Compressed copy of an AABBTree for traversal. Every node holds up to W
+ * children, made by pulling the largest inner nodes of the binary tree up
+ * into their parent. Child boxes are stored as 8 bit coordinates on a grid
+ * spanning the node, grid steps are powers of two so decoded boxes always
+ * contain the exact ones. A node of width 4 fills one 64 byte cache line,
+ * a node of width 8 two of them, and nodes start on cache line boundaries.
+ * Leaves and the face permutation are those of the binary tree
+ * */
+
+template<int W>
+class WideBVH {
+public:
+    struct alignas(64) Node {
+        float origin[3];
+        int8_t exponent[3];
+        /* Triangles of a leaf child, 0 for inner children and unused slots */
+        uint8_t count[W];
+        /* Child box on the grid, per axis */
+        uint8_t lo[3][W];
+        uint8_t hi[3][W];
+        /* Node of an inner child, first triangle in faces() of a leaf, -1 for unused slots */
+        int32_t child[W];
+
+        bool isUsed(int i) const { return child[i] >= 0; }
+        bool isLeaf(int i) const { return count[i] > 0; }
+        /* 2^exponent[axis], built from its bits since exponents stay in the normal range */
+        float scale(int axis) const {
+            uint32_t bits = static_cast<uint32_t>(exponent[axis] + 127) << 23;
+            float s;
+            memcpy(&s, &bits, sizeof(s));
+            return s;
+        }
+        AABB box(int i) const;
+    };
+    static_assert(sizeof(Node) == 64 * ((W + 3) / 4), "Wide node does not fill whole cache lines");
+private:
+    std::vector<char> _storage;
+    Node *_nodes;
+    size_t _numNodes;
+    std::vector<int> _faces;
+    AABB _bounds;
+public:
+    /* Throws if a leaf of tree holds more than 255 triangles */
+    explicit WideBVH(const AABBTree &tree);
+    WideBVH(const WideBVH &) = delete;
+    WideBVH &operator=(const WideBVH &) = delete;
+
+    /* The root is node 0 */
+    const Node *nodes() const { return _nodes; }
+    size_t numNodes() const { return _numNodes; }
+    const std::vector<int> &faces() const { return _faces; }
+    const AABB &bounds() const { return _bounds; }
+
+    size_t bytes() const { return _numNodes * sizeof(Node) + _faces.size() * sizeof(int); }
+};
+
+typedef WideBVH<4> WideBVH4;
+typedef WideBVH<8> WideBVH8;
+
+#endif
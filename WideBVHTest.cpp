@@ -0,0 +1,125 @@
+#include "WideBVH.h"
+#include "RayQuery.h"
+#include "Mesh.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <limits>
+
+/*
+ * Checks wide trees and rays cast through them without a GL context:
+ *   widebvhtest file.ply ...
+ * Returns the number of failed checks
+ * */
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string &what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+bool contains(const AABB &outer, const AABB &inner) {
+    return outer.x1 <= inner.x1 && outer.y1 <= inner.y1 && outer.z1 <= inner.z1 &&
+        outer.x2 >= inner.x2 && outer.y2 >= inner.y2 && outer.z2 >= inner.z2;
+}
+
+/*
+ * Exact box of the triangles below wide node k. Checks on the way that
+ * every decoded child box contains the exact one and counts how often
+ * every triangle position is reached
+ * */
+template<int W>
+AABB exactBox(const WideBVH<W> &wide, int k, const std::vector<AABB> &triangleBox, std::vector<int> &reached,
+        bool &ok)
+{
+    const typename WideBVH<W>::Node &n = wide.nodes()[k];
+    AABB all;
+    for (int j = 0; j < W; j++) {
+        if (!n.isUsed(j))
+            continue;
+        AABB exact;
+        if (n.isLeaf(j)) {
+            for (int t = n.child[j]; t < n.child[j] + n.count[j]; t++) {
+                exact.add(triangleBox[t]);
+                reached[t]++;
+            }
+        } else {
+            exact = exactBox(wide, n.child[j], triangleBox, reached, ok);
+        }
+        ok = ok && contains(n.box(j), exact);
+        all.add(exact);
+    }
+    return all;
+}
+
+template<int W>
+void wideTree(const std::string &what, const TriMesh &m, const AABBTree &tree, const Point &center,
+        const RayQuery &query)
+{
+    WideBVH<W> wide(tree);
+    const std::vector<Point> &v = m.vertsWithNormals();
+    const std::vector<int> &order = tree.faces();
+    std::vector<AABB> triangleBox(order.size());
+    for (size_t k = 0; k < order.size(); k++) {
+        const Face &f = m.faces()[order[k]];
+        triangleBox[k].add(Point(v[f.v1], center));
+        triangleBox[k].add(Point(v[f.v2], center));
+        triangleBox[k].add(Point(v[f.v3], center));
+    }
+    bool ok = true;
+    std::vector<int> reached(order.size(), 0);
+    AABB exact = exactBox(wide, 0, triangleBox, reached, ok);
+    check(ok, what + "decoded child boxes contain the exact ones");
+    check(contains(wide.bounds(), exact), what + "bounds contain all triangles");
+    bool once = true;
+    for (size_t k = 0; k < reached.size(); k++)
+        once = once && reached[k] == 1;
+    check(once, what + "every triangle is in exactly one leaf");
+
+    /* Rays from around the model at its center and at random points, same hits as the binary tree */
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    const float radius = tree.radius();
+    int closest = 0, occluded = 0;
+    for (int i = 0; i < 2000; i++) {
+        Point origin(unit(random), unit(random), unit(random));
+        origin = (2 * radius) * origin;
+        Point target(unit(random), unit(random), unit(random));
+        target = (i % 2 ? 0.5f * radius : 0.f) * target;
+        Ray ray(origin, Point(target, origin), i % 3 ? std::numeric_limits<float>::max() : 0.5f);
+        RayHit expected = query.closest(ray);
+        RayHit hit = query.closest(ray, wide);
+        closest += hit.triangle != expected.triangle && hit.t != expected.t;
+        occluded += query.occluded(ray, wide) != query.occluded(ray);
+    }
+    check(closest == 0, what + "closest hits match the binary tree");
+    check(occluded == 0, what + "occlusion matches the binary tree");
+}
+
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        PLYMesh control(argv[i]);
+        TriMesh m(control);
+        for (int b = 0; b < 2; b++) {
+            AABBTree::Builder builder = static_cast<AABBTree::Builder>(b);
+            AABBTree tree(m, control.center(), 0, builder);
+            RayQuery query(m, tree, control.center());
+            const std::string what = std::string(argv[i]) + (builder == AABBTree::SAH ? ", SAH" : ", LBVH");
+            wideTree<4>(what + ", width 4: ", m, tree, control.center(), query);
+            wideTree<8>(what + ", width 8: ", m, tree, control.center(), query);
+        }
+    }
+    if (failures)
+        std::cerr << failures << " checks failed" << std::endl;
+    return failures;
+}
@@ -0,0 +1,505 @@
+#include "Mesh.h"
+#include "Subdivision.h"
+#include "StreamingDooSabin.h"
+#include "DooSabinStencil.h"
+#include "WideBVH.h"
+#include "RayQuery.h"
+#include "Culling.h"
+#include "VertexCache.h"
+#include "Parallel.h"
+
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <random>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#ifdef __GLIBC__
+# include <malloc.h>
+#endif
+
+/*
+ * Compares subdivision schemes level by level:
+ *   meshbench [-l levels] [file.ply ...]
+ * Without files the bundled models are used, loading rates of the models
+ * are reported before their levels. The peak is the resident size high
+ * water mark of each level alone, "-" where it cannot be reset. Streams
+ * Doo-Sabin levels of one model to a binary PLY file in parts that fit
+ * into the memory budget:
+ *   meshbench -o out.ply [-b megabytes] [-l levels] file.ply
+ * Builds trees over generated meshes of 100K up to the given number of
+ * triangles with every builder and compares their sizes in wide form:
+ *   meshbench -t [-n triangles]
+ * Casts camera and random rays at a generated mesh of the given size, one
+ * by one and in packets, and one by one through the wide trees:
+ *   meshbench -r [-n triangles]
+ * Measures vertex cache misses of triangle orders on Doo-Sabin levels:
+ *   meshbench -c [-l levels] [file.ply ...]
+ * Records Doo-Sabin levels as stencils, times re-evaluating them against
+ * refining again and reports how far apart the two results are:
+ *   meshbench -s [-l levels] [file.ply ...]
+ * */
+
+double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double meshMegabytes(const Mesh &m) {
+    size_t bytes = m.verts().size() * sizeof(Point)
+        + m.faceStarts().size() * sizeof(offset_t) + m.faceVerts().size() * sizeof(index_t);
+    return bytes / 1048576.;
+}
+
+/*
+ * Starts a new peak of the resident size at the current one. Linux only,
+ * elsewhere the peak stays process-wide and false is returned
+ * */
+bool resetPeak() {
+#ifdef __GLIBC__
+    /* Freed heap kept by malloc would otherwise count towards the next run */
+    malloc_trim(0);
+#endif
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5" << std::flush;
+    return clear.good();
+}
+
+/* Peak resident size since the last resetPeak(), -1 when unknown */
+double peakMegabytes() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (!line.compare(0, 6, "VmHWM:"))
+            return atof(line.c_str() + 6) / 1024.;
+    return -1;
+}
+
+/* Peak column of a run that began with resetPeak() */
+std::string peakColumn(bool reset) {
+    double peak = peakMegabytes();
+    if (!reset || peak < 0)
+        return "-";
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << peak;
+    return out.str();
+}
+
+/* Torus with ripples, about the given number of triangles in a 4:1 grid */
+class RippledTorus : public TriMesh {
+public:
+    RippledTorus(size_t triangles) {
+        const float pi = 3.14159265f;
+        const int nv = std::max(3, static_cast<int>(std::sqrt(triangles / 8.)));
+        const int nu = std::max(3, static_cast<int>(triangles / (2 * nv)));
+        std::vector<Point> &v = vertData();
+        v.resize(2 * static_cast<size_t>(nu) * nv);
+        const size_t nV = v.size() / 2;
+        for (int i = 0; i < nu; i++)
+            for (int j = 0; j < nv; j++) {
+                float u = 2 * pi * i / nu;
+                float w = 2 * pi * j / nv;
+                float r = 1 + 0.1f * std::sin(37 * u) * std::sin(11 * w);
+                Point n(std::cos(u) * std::cos(w), std::sin(u) * std::cos(w), std::sin(w));
+                Point p(4 * std::cos(u), 4 * std::sin(u), 0);
+                p += r * n;
+                v[static_cast<size_t>(i) * nv + j] = p;
+                v[nV + static_cast<size_t>(i) * nv + j] = n;
+            }
+        std::vector<Face> &f = faceData();
+        f.reserve(2 * nV);
+        for (int i = 0; i < nu; i++)
+            for (int j = 0; j < nv; j++) {
+                int a = i * nv + j;
+                int b = ((i + 1) % nu) * nv + j;
+                int c = ((i + 1) % nu) * nv + (j + 1) % nv;
+                int d = i * nv + (j + 1) % nv;
+                f.push_back(Face(a, b, c));
+                f.push_back(Face(a, c, d));
+            }
+    }
+};
+
+int trees(size_t largest) {
+    const size_t sizes[] = {100000, 1000000, 5000000, 20000000};
+    std::cout << std::setw(10) << "triangles" << std::setw(8) << "builder" << std::setw(11) << "time, s"
+        << std::setw(10) << "Mtris/s" << std::setw(10) << "SAH cost" << std::setw(11) << "nodes"
+        << std::setw(7) << "depth" << std::setw(10) << "tree, MB" << std::setw(10) << "wide4, MB"
+        << std::setw(10) << "wide8, MB" << std::endl;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && sizes[s] <= largest; s++) {
+        RippledTorus m(sizes[s]);
+        const char *names[] = {"SAH", "LBVH"};
+        for (int b = 0; b < 2; b++) {
+            double start = seconds();
+            AABBTree tree(m, Point(0, 0, 0), 0, static_cast<AABBTree::Builder>(b));
+            double elapsed = seconds() - start;
+            size_t treeBytes = tree.nodes().size() * sizeof(AABBTree::Node) + tree.faces().size() * sizeof(int);
+            size_t wide4Bytes = WideBVH4(tree).bytes();
+            size_t wide8Bytes = WideBVH8(tree).bytes();
+            std::ios::fmtflags flags = std::cout.flags(std::ios::fixed);
+            std::cout << std::setw(10) << m.faces().size() << std::setw(8) << names[b]
+                << std::setw(11) << std::setprecision(4) << elapsed
+                << std::setw(10) << std::setprecision(2) << m.faces().size() / elapsed / 1e6
+                << std::setw(10) << tree.sahCost() << std::setw(11) << tree.nodes().size()
+                << std::setw(7) << tree.depth() << std::setprecision(1) << std::setw(10) << treeBytes / 1048576.
+                << std::setw(10) << wide4Bytes / 1048576. << std::setw(10) << wide8Bytes / 1048576. << std::endl;
+            std::cout.flags(flags);
+        }
+    }
+    return 0;
+}
+
+/* Casts rays in packets of N, returns Mrays/s. Hits are counted into hits */
+template<int N>
+double cast(const RayQuery &query, const std::vector<Ray> &rays, bool any, size_t &hits) {
+    std::atomic<size_t> total(0);
+    double start = seconds();
+    parallelFor(rays.size() / N, [&query, &rays, any, &total] (size_t begin, size_t end) {
+        size_t found = 0;
+        for (size_t p = begin; p < end; p++) {
+            const Ray *packet = &rays[p * N];
+            if (N == 1 && any) {
+                found += query.occluded(*packet);
+            } else if (N == 1) {
+                found += query.closest(*packet).triangle >= 0;
+            } else if (any) {
+                bool hit[N];
+                query.occluded<N>(packet, hit);
+                for (int j = 0; j < N; j++)
+                    found += hit[j];
+            } else {
+                RayHit hit[N];
+                query.closest<N>(packet, hit);
+                for (int j = 0; j < N; j++)
+                    found += hit[j].triangle >= 0;
+            }
+        }
+        total += found;
+    }, 64);
+    double elapsed = seconds() - start;
+    hits = total;
+    return rays.size() / elapsed / 1e6;
+}
+
+/* Casts single rays through a wide tree, returns Mrays/s */
+template<int W>
+double castWide(const RayQuery &query, const WideBVH<W> &wide, const std::vector<Ray> &rays, bool any, size_t &hits) {
+    std::atomic<size_t> total(0);
+    double start = seconds();
+    parallelFor(rays.size(), [&query, &wide, &rays, any, &total] (size_t begin, size_t end) {
+        size_t found = 0;
+        for (size_t r = begin; r < end; r++)
+            found += any ? query.occluded(rays[r], wide) : query.closest(rays[r], wide).triangle >= 0;
+        total += found;
+    }, 64);
+    double elapsed = seconds() - start;
+    hits = total;
+    return rays.size() / elapsed / 1e6;
+}
+
+int castRays(size_t triangles) {
+    RippledTorus m(triangles);
+    const Point center(0, 0, 0);
+    AABBTree tree(m, center);
+    RayQuery query(m, tree, center);
+    WideBVH4 wide4(tree);
+    WideBVH8 wide8(tree);
+
+    /* Camera rays in tiles of 4 x 2 pixels, each made of two 2 x 2 tiles */
+    const int width = 1024;
+    const int height = 1024;
+    const float tanHalf = 0.6f;
+    const float len = std::sqrt(9.f * 9.f + 4.5f * 4.5f);
+    const Point eye(0, -9, 4.5f);
+    const Point forward(0, 9 / len, -4.5f / len);
+    const Point right(1, 0, 0);
+    const Point up(0, 4.5f / len, 9 / len);
+    std::vector<Ray> coherent;
+    coherent.reserve(width * height);
+    for (int ty = 0; ty < height; ty += 2)
+        for (int tx = 0; tx < width; tx += 4)
+            for (int k = 0; k < 8; k++) {
+                int x = tx + (k >> 2) * 2 + (k & 1);
+                int y = ty + ((k >> 1) & 1);
+                float sx = tanHalf * (2 * (x + 0.5f) / width - 1);
+                float sy = tanHalf * (1 - 2 * (y + 0.5f) / height);
+                Point dir(forward);
+                dir += sx * right;
+                dir += sy * up;
+                coherent.push_back(Ray(eye, dir));
+            }
+
+    /* Random origins around the torus, random directions */
+    std::vector<Ray> incoherent(coherent.size());
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> box(-6, 6);
+    std::normal_distribution<float> normal;
+    for (auto r = incoherent.begin(); r != incoherent.end(); r++)
+        *r = Ray(Point(box(random), box(random), 0.5f * box(random)), Point(normal(random), normal(random), normal(random)));
+
+    std::cout << m.faces().size() << " triangles, " << numThreads() << " threads" << std::endl;
+    std::cout << std::left << std::setw(12) << "rays" << std::setw(10) << "query" << std::setw(8) << "tree"
+        << std::right << std::setw(8) << "packet" << std::setw(10) << "Mrays/s" << std::setw(8) << "hits, %" << std::endl;
+    const char *kinds[] = {"coherent", "incoherent"};
+    /* Binary tree with packets of 1, 4 and 8 rays, then single rays through the wide trees */
+    const char *treeNames[] = {"binary", "binary", "binary", "wide4", "wide8"};
+    const int packets[] = {1, 4, 8, 1, 1};
+    for (int k = 0; k < 2; k++) {
+        const std::vector<Ray> &rays = k == 0 ? coherent : incoherent;
+        for (int any = 0; any < 2; any++)
+            for (int c = 0; c < 5; c++) {
+                size_t hits = 0;
+                double rate = c == 0 ? cast<1>(query, rays, any, hits) :
+                    c == 1 ? cast<4>(query, rays, any, hits) :
+                    c == 2 ? cast<8>(query, rays, any, hits) :
+                    c == 3 ? castWide(query, wide4, rays, any, hits) : castWide(query, wide8, rays, any, hits);
+                std::ios::fmtflags flags = std::cout.flags(std::ios::fixed);
+                std::cout << std::left << std::setw(12) << kinds[k] << std::setw(10) << (any ? "any" : "closest")
+                    << std::setw(8) << treeNames[c] << std::right << std::setw(8) << packets[c]
+                    << std::setw(10) << std::setprecision(2) << rate
+                    << std::setw(8) << std::setprecision(1) << 100. * hits / rays.size() << std::endl;
+                std::cout.flags(flags);
+            }
+    }
+    return 0;
+}
+
+/*
+ * Fan order as triangulated, tree order as culled and drawn before and after
+ * optimizing its clusters, and the whole mesh optimized at once
+ * */
+void cacheOrders(const std::string &name, const Mesh &m, int level) {
+    TriMesh tri(m);
+    const std::vector<Face> &fan = tri.faces();
+    const size_t n = fan.size();
+    const size_t numVertices = tri.numVertices();
+
+    AABBTree tree(tri, m.center());
+    std::vector<Face> clustered(n);
+    for (size_t k = 0; k < n; k++)
+        clustered[k] = fan[tree.faces()[k]];
+    float treeAcmr = VertexCache::acmr(clustered.data(), n, numVertices);
+    DrawRanges ranges(tree);
+    std::vector<int> first, count;
+    ranges.clusters(first, count);
+    VertexCache::optimizeRanges(clustered.data(), first, count);
+    VertexCache::orderVertices(clustered.data(), n, numVertices);
+
+    std::vector<Face> whole(fan);
+    double start = seconds();
+    VertexCache::optimize(whole.data(), n, numVertices);
+    VertexCache::orderVertices(whole.data(), n, numVertices);
+    double elapsed = seconds() - start;
+
+    std::ios::fmtflags flags = std::cout.flags(std::ios::fixed);
+    std::cout << std::left << std::setw(14) << name << std::right << std::setw(6) << level << std::setw(11) << n
+        << std::setprecision(3)
+        << std::setw(9) << VertexCache::acmr(fan.data(), n, numVertices)
+        << std::setw(9) << VertexCache::atvr(fan.data(), n, numVertices)
+        << std::setw(9) << treeAcmr
+        << std::setw(9) << VertexCache::acmr(clustered.data(), n, numVertices)
+        << std::setw(9) << VertexCache::atvr(clustered.data(), n, numVertices)
+        << std::setw(9) << VertexCache::acmr(whole.data(), n, numVertices)
+        << std::setw(9) << VertexCache::atvr(whole.data(), n, numVertices)
+        << std::setw(10) << std::setprecision(2) << n / elapsed / 1e6 << std::endl;
+    std::cout.flags(flags);
+}
+
+int cacheBench(const std::vector<std::string> &files, int levels) {
+    std::cout << "ACMR and ATVR of a 16 vertex FIFO cache" << std::endl;
+    std::cout << std::left << std::setw(14) << "model" << std::right << std::setw(6) << "level" << std::setw(11) << "triangles"
+        << std::setw(9) << "fan" << std::setw(9) << "ATVR" << std::setw(9) << "tree"
+        << std::setw(9) << "cluster" << std::setw(9) << "ATVR" << std::setw(9) << "whole" << std::setw(9) << "ATVR"
+        << std::setw(10) << "Mtris/s" << std::endl;
+    for (auto f = files.begin(); f != files.end(); f++) {
+        try {
+            std::unique_ptr<Mesh> m(new PLYMesh(*f));
+            for (int l = 0; l <= levels; l++) {
+                if (l > 0)
+                    m.reset(subdivide(*m, DOO_SABIN));
+                cacheOrders(*f, *m, l);
+            }
+        } catch (std::exception &e) {
+            std::cerr << "Skipping `" << *f << "': " << e.what() << std::endl;
+        }
+    }
+    return 0;
+}
+
+/* Largest distance between matching vertices of two meshes of the same topology */
+float maxDistance(const Mesh &a, const Mesh &b) {
+    if (a.numVertices() != b.numVertices() || a.faceVerts() != b.faceVerts())
+        throw std::logic_error("Meshes differ in topology");
+    float worst = 0;
+    for (size_t i = 0; i < a.numVertices(); i++) {
+        Point d(a.vert(i), b.vert(i));
+        worst = std::max(worst, std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z));
+    }
+    return worst;
+}
+
+int stencilBench(const std::vector<std::string> &files, int levels) {
+    std::cout << std::left << std::setw(14) << "model" << std::right << std::setw(6) << "level"
+        << std::setw(12) << "vertices" << std::setw(12) << "entries" << std::setw(11) << "record, s"
+        << std::setw(11) << "refine, s" << std::setw(11) << "update, ms" << std::setw(10) << "speedup"
+        << std::setw(12) << "max error" << std::endl;
+    for (auto f = files.begin(); f != files.end(); f++) {
+        try {
+            PLYMesh control(*f);
+            std::unique_ptr<Mesh> refined(new Mesh(control));
+            double refine = 0;
+            for (int l = 1; l <= levels; l++) {
+                double start = seconds();
+                refined.reset(subdivide(*refined, DOO_SABIN));
+                refine += seconds() - start;
+
+                start = seconds();
+                DooSabinStencil stencil(control, l);
+                double record = seconds() - start;
+
+                /* Repeated until the timing is long enough to trust */
+                int runs = 0;
+                start = seconds();
+                do {
+                    stencil.update(control.verts());
+                    runs++;
+                } while (seconds() - start < 0.2);
+                double update = (seconds() - start) / runs;
+
+                std::ios::fmtflags flags = std::cout.flags(std::ios::fixed);
+                std::cout << std::left << std::setw(14) << *f << std::right << std::setw(6) << l
+                    << std::setw(12) << stencil.numVertices() << std::setw(12) << stencil.stencils().numEntries()
+                    << std::setprecision(4) << std::setw(11) << record << std::setw(11) << refine
+                    << std::setw(11) << 1000 * update << std::setprecision(1) << std::setw(10) << refine / update
+                    << std::scientific << std::setprecision(2) << std::setw(12) << maxDistance(stencil, *refined)
+                    << std::endl;
+                std::cout.flags(flags);
+            }
+        } catch (std::exception &e) {
+            std::cerr << "Skipping `" << *f << "': " << e.what() << std::endl;
+        }
+    }
+    return 0;
+}
+
+int stream(const std::string &source, const std::string &target, int levels, uint64_t budget) {
+    try {
+        PLYMesh control(source);
+        int parts = StreamingDooSabin::partsFor(control, levels, budget);
+        bool reset = resetPeak();
+        double start = seconds();
+        StreamingDooSabin::refine(control, levels, parts, target);
+        std::ios::fmtflags flags = std::cout.flags(std::ios::fixed);
+        std::cout << std::setprecision(4) << seconds() - start << " s, "
+            << peakColumn(reset) << " MB peak" << std::endl;
+        std::cout.flags(flags);
+    } catch (std::exception &e) {
+        std::cerr << "Streaming `" << source << "' failed: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int levels = 3;
+    std::string target;
+    uint64_t budget = 1024;
+    bool treeBench = false;
+    bool rayBench = false;
+    bool cacheBenchmark = false;
+    bool stencilBenchmark = false;
+    size_t largest = 0;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-l") && i + 1 < argc)
+            levels = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            target = argv[++i];
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            budget = strtoull(argv[++i], 0, 10);
+        else if (!strcmp(argv[i], "-t"))
+            treeBench = true;
+        else if (!strcmp(argv[i], "-r"))
+            rayBench = true;
+        else if (!strcmp(argv[i], "-c"))
+            cacheBenchmark = true;
+        else if (!strcmp(argv[i], "-s"))
+            stencilBenchmark = true;
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            largest = strtoull(argv[++i], 0, 10);
+        else
+            files.push_back(argv[i]);
+    }
+    if (treeBench)
+        return trees(largest ? largest : 20000000);
+    if (rayBench)
+        return castRays(largest ? largest : 1000000);
+    if (!target.empty()) {
+        if (files.size() != 1) {
+            std::cerr << "Streaming takes exactly one model" << std::endl;
+            return 1;
+        }
+        return stream(files[0], target, levels, budget << 20);
+    }
+    if (files.empty()) {
+        const char *bundled[] = {"african.ply", "cube.ply", "cut.ply", "suzanne.ply", "teapot.ply", "tee.ply", "tee2.ply"};
+        files.assign(bundled, bundled + sizeof(bundled) / sizeof(bundled[0]));
+    }
+    if (cacheBenchmark)
+        return cacheBench(files, levels);
+    if (stencilBenchmark)
+        return stencilBench(files, levels);
+
+    std::cout << std::left << std::setw(14) << "model" << std::setw(15) << "scheme" << std::right
+        << std::setw(6) << "level" << std::setw(12) << "vertices" << std::setw(12) << "faces"
+        << std::setw(11) << "time, s" << std::setw(11) << "mesh, MB" << std::setw(11) << "peak, MB" << std::endl;
+    for (auto f = files.begin(); f != files.end(); f++) {
+        std::unique_ptr<Mesh> control;
+        double start = seconds();
+        try {
+            control.reset(new PLYMesh(*f));
+        } catch (std::exception &e) {
+            std::cerr << "Skipping `" << *f << "': " << e.what() << std::endl;
+            continue;
+        }
+        double loaded = seconds() - start;
+        double megabytes = std::ifstream(*f, std::ios::in | std::ios::binary | std::ios::ate).tellg() / 1048576.;
+        std::ios::fmtflags flags = std::cout.flags(std::ios::fixed);
+        std::cout << std::left << std::setw(14) << *f << std::setw(15) << "loaded" << std::right
+            << std::setprecision(1) << megabytes << " MB in " << std::setprecision(4) << loaded << " s, "
+            << std::setprecision(1) << megabytes / loaded << " MB/s" << std::endl;
+        std::cout.flags(flags);
+        for (int s = 0; s < NUM_SCHEMES; s++) {
+            SubdivisionScheme scheme = static_cast<SubdivisionScheme>(s);
+            std::unique_ptr<Mesh> m(new Mesh(*control));
+            for (int l = 1; l <= levels; l++) {
+                bool reset = resetPeak();
+                double start = seconds();
+                try {
+                    m.reset(subdivide(*m, scheme));
+                } catch (std::exception &e) {
+                    std::cerr << schemeName(scheme) << " failed on `" << *f << "': " << e.what() << std::endl;
+                    break;
+                }
+                double elapsed = seconds() - start;
+                std::ios::fmtflags flags = std::cout.flags(std::ios::fixed);
+                std::cout << std::left << std::setw(14) << *f << std::setw(15) << schemeName(scheme) << std::right
+                    << std::setw(6) << l << std::setw(12) << m->numVertices() << std::setw(12) << m->numFaces()
+                    << std::setw(11) << std::setprecision(4) << elapsed
+                    << std::setw(11) << std::setprecision(1) << meshMegabytes(*m)
+                    << std::setw(11) << peakColumn(reset) << std::endl;
+                std::cout.flags(flags);
+            }
+        }
+    }
+    return 0;
+}
@@ -6,12 +6,15 @@ layout(location = 1) in vec4 normal;
 uniform mat4 modelView;
 uniform mat4 normalMatrix;
 uniform mat4 projMatrix;
+/* Packed positions are fractions of the bounding box */
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
 
 out vec4 theNormal;
 out vec4 eyeCoord;
 
 void main() {
-    eyeCoord = modelView * position;
+    eyeCoord = modelView * vec4(positionOffset + positionScale * position.xyz, 1.0);
     gl_Position = projMatrix * eyeCoord;
     theNormal = normalMatrix * normal;
     theNormal.xyz = normalize(theNormal.xyz);